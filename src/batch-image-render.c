@@ -23,6 +23,7 @@
 
 #include "config.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "batch-image-render.h"
 
@@ -36,12 +37,30 @@ typedef struct {
     GTimer*     status_timer;
 } BatchImageRender;
 
+/* One extra image rendered from the finished histogram */
+typedef struct {
+    IterativeMap*     map;
+    const gchar*      spec;
+    gchar*            filename;
+    HistogramImager*  imager;
+    guint             bit_depth;
+    gboolean          exr_density;
+} BatchOutput;
+
 static void       on_calc_finished            (IterativeMap*      map,
 					       BatchImageRender*  self);
+static void       save_image                  (HistogramImager*   hi,
+					       const char*        filename,
+					       guint              bit_depth,
+					       gboolean           exr_density);
+static void       output_init                 (BatchOutput*       output);
 
 void batch_image_render(IterativeMap*  map,
 			const char*    filename,
-			double         quality)
+			double         quality,
+			guint          bit_depth,
+			gboolean       exr_density,
+			GSList*        output_specs)
 {
     BatchImageRender self;
 
@@ -49,8 +68,12 @@ void batch_image_render(IterativeMap*  map,
     {
 	ClusterModel *cluster = cluster_model_get(map, FALSE);
 	if (cluster) {
-	    /* Stream in new results very infrequently, since this is batch rendering */
+	    /* Stream in new results very infrequently, since this is batch rendering.
+	     * Nodes only get as much work as it looks like we'll need to reach
+	     * our quality target, and they all stop as soon as we reach it.
+	     */
 	    cluster_model_set_min_stream_interval(cluster, 10.0);
+	    cluster_model_set_target_quality(cluster, quality);
 	    g_object_unref(cluster);
 	}
     }
@@ -73,28 +96,119 @@ void batch_image_render(IterativeMap*  map,
 
     g_timer_destroy(self.status_timer);
 
+    if (filename)
+	save_image(HISTOGRAM_IMAGER(map), filename, bit_depth, exr_density);
+
+    if (output_specs) {
+	/* Every extra output gets its own imager, which resamples the shared
+	 * histogram to its own size and colorizes it with its own parameters.
+	 * They're rendered one at a time, since loading the histogram may
+	 * update the map and saving isn't thread-safe. Colorizing and
+	 * compressing each image already uses every thread.
+	 */
+	guint n_outputs = g_slist_length(output_specs);
+	BatchOutput *outputs = g_new0(BatchOutput, n_outputs);
+	guint i;
+
+	for (i=0; i<n_outputs; i++) {
+	    outputs[i].map = map;
+	    outputs[i].spec = g_slist_nth_data(output_specs, i);
+	    outputs[i].bit_depth = bit_depth;
+	    outputs[i].exr_density = exr_density;
+	    output_init(&outputs[i]);
+	}
+
+	for (i=0; i<n_outputs; i++) {
+	    histogram_imager_load_histogram(outputs[i].imager, HISTOGRAM_IMAGER(map));
+	    save_image(outputs[i].imager, outputs[i].filename,
+		       outputs[i].bit_depth, outputs[i].exr_density);
+	}
+
+	for (i=0; i<n_outputs; i++) {
+	    if (outputs[i].imager)
+		g_object_unref(outputs[i].imager);
+	    g_free(outputs[i].filename);
+	}
+	g_free(outputs);
+    }
+}
+
+static void       save_image                  (HistogramImager*   hi,
+					       const char*        filename,
+					       guint              bit_depth,
+					       gboolean           exr_density)
+{
+    GError *error = NULL;
+
 #ifdef HAVE_EXR
     /* Save as an OpenEXR file if it has a .exr extension, otherwise use PNG */
     if (strlen(filename) > 4 && strcmp(".exr", filename + strlen(filename) - 4)==0) {
-	GError *error = NULL;
-	printf("Creating OpenEXR image...\n");
-	exr_save_image_file(HISTOGRAM_IMAGER(map), filename, &error);
-	if (error) {
-	    g_print ("Error: %s\n", error->message);
-	    g_error_free (error);
-	}
+	printf("Creating OpenEXR image %s...\n", filename);
+	exr_save_image_file(hi, filename, exr_density, &error);
     }
     else
 #endif
-	{
-            GError *error = NULL;
-	    printf("Creating PNG image...\n");
-	    histogram_imager_save_image_file(HISTOGRAM_IMAGER(map), filename, &error);
-	    if (error) {
-                g_print ("Error: %s\n", error->message);
-		g_error_free (error);
-	    }
+    if (bit_depth == 16) {
+	printf("Creating 16-bit PNG image %s...\n", filename);
+	histogram_imager_save_image_file_16bit(hi, filename, &error);
+    }
+    else {
+	printf("Creating PNG image %s...\n", filename);
+	histogram_imager_save_image_file(hi, filename, &error);
+    }
+
+    if (error) {
+	g_print ("Error: %s\n", error->message);
+	g_error_free (error);
+    }
+}
+
+static void       output_init                 (BatchOutput*       output)
+{
+    /* Parse an output spec of the form FILE[,KEY=VALUE...]. Keys are any of
+     * the HistogramImager's parameters, like size, exposure, gamma, fgcolor,
+     * or bgcolor, which default to the values used for the calculation.
+     * The 'depth' key picks 8 or 16-bit PNG output.
+     */
+    gchar **tokens = g_strsplit(output->spec, ",", 0);
+    GParamSpec **properties;
+    guint n_properties, i;
+
+    output->filename = g_strdup(tokens[0]);
+    output->imager = histogram_imager_new();
+
+    /* Start out with all of the map's own image parameters */
+    properties = g_object_class_list_properties(g_type_class_peek(HISTOGRAM_IMAGER_TYPE), &n_properties);
+    for (i=0; i<n_properties; i++) {
+	if (properties[i]->flags & PARAM_SERIALIZED) {
+	    GValue val;
+	    memset(&val, 0, sizeof(val));
+	    g_value_init(&val, properties[i]->value_type);
+	    g_object_get_property(G_OBJECT(output->map), properties[i]->name, &val);
+	    g_object_set_property(G_OBJECT(output->imager), properties[i]->name, &val);
+	    g_value_unset(&val);
 	}
+    }
+    g_free(properties);
+
+    for (i=1; tokens[i]; i++) {
+	gchar **pair = g_strsplit(tokens[i], "=", 2);
+
+	if (!(pair[0] && pair[1]))
+	    fprintf(stderr, "Ignoring malformed output parameter '%s'\n", tokens[i]);
+	else if (!strcmp(pair[0], "depth"))
+	    output->bit_depth = atol(pair[1]);
+	else
+	    parameter_holder_set(PARAMETER_HOLDER(output->imager), pair[0], pair[1]);
+
+	g_strfreev(pair);
+    }
+    g_strfreev(tokens);
+
+    if (output->bit_depth != 8 && output->bit_depth != 16) {
+	fprintf(stderr, "Only 8 and 16 bit output is supported, using 8 bits for %s\n", output->filename);
+	output->bit_depth = 8;
+    }
 }
 
 
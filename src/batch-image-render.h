@@ -28,7 +28,10 @@
 
 void batch_image_render(IterativeMap*  map,
 			const char*    output_filename,
-			double         quality);
+			double         quality,
+			guint          bit_depth,
+			gboolean       exr_density,
+			GSList*        output_specs);
 
 #endif /* __BATCH_IMAGE_RENDER_H__ */
 
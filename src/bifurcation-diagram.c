@@ -74,6 +74,9 @@ static void bifurcation_diagram_class_init(BifurcationDiagramClass *klass) {
     object_class = (GObjectClass*) klass;
 
     object_class->dispose      = bifurcation_diagram_dispose;
+
+    /* Our columns always span the whole histogram height */
+    HISTOGRAM_IMAGER_CLASS(klass)->resize_stretches = TRUE;
 }
 
 static void bifurcation_diagram_init(BifurcationDiagram *self) {
@@ -82,7 +82,7 @@ static guint32 update_crc(guint32 crc, const guchar *buf, guint len) {
 }
 
 /* Return the CRC of a data field and a type field */
-static guint32 chunk_crc(ChunkType type, gsize length, const guchar* data) {
+guint32 chunk_crc(ChunkType type, gsize length, const guchar* data) {
     guint32 c = 0xffffffffL;
     guint32 word;
 
@@ -56,6 +56,7 @@ void      chunked_file_read_all(FILE* self, ChunkCallback callback, gpointer use
 void      chunked_file_warn_unknown_type(ChunkType type);
 
 gchar*    chunk_type_to_string(ChunkType type);
+guint32   chunk_crc(ChunkType type, gsize length, const guchar* data);
 
 G_END_DECLS
 
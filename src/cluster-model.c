@@ -25,13 +25,44 @@
 
 #include "config.h"
 #include "cluster-model.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <string.h>
+#include <unistd.h>
 
 typedef void      (*ClusterForeachCallback)   (ClusterModel*         self,
 					       RemoteClient*         client,
 					       gpointer              user_data);
 
+/* What the quota scheduler knows about the whole cluster */
+typedef struct {
+    double remaining_iterations;
+    double total_speed;
+} ClusterSchedule;
+
+/* Nodes get enough work to keep them busy for this many seconds, or for
+ * two stream intervals, whichever is longer, so they don't sit idle
+ * waiting for us to see their progress. Nodes we haven't measured yet
+ * go by their advertised benchmark, or start with INITIAL_QUOTA
+ * iterations if they don't have one.
+ */
+#define QUOTA_SECONDS   4.0
+#define INITIAL_QUOTA   2e7
+#define MINIMUM_QUOTA   1e5
+
+/* Stream interval and render time tuning. Intervals may grow to this
+ * many times the minimum to keep stream overhead down. Nodes calculate
+ * in slices of about RENDER_SLICES per stream, so they answer us
+ * promptly, but never in slices shorter than a normal map's.
+ */
+#define DEFAULT_STREAM_OVERHEAD  0.05
+#define MAX_INTERVAL_RATIO       8.0
+#define INTERVAL_HYSTERESIS      0.2
+#define RENDER_SLICES            16.0
+#define MIN_RENDER_TIME          0.015
+#define MAX_RENDER_TIME          0.25
+
 static void       cluster_model_class_init    (ClusterModelClass*    klass);
 static void       cluster_model_init          (ClusterModel*         self);
 static void       cluster_model_dispose       (GObject*              gobject);
@@ -70,13 +101,32 @@ static void       cluster_node_stop           (ClusterModel  *self,
 static void       cluster_node_merge_results  (ClusterModel  *self,
 					       RemoteClient  *client,
 					       gpointer       user_data);
+static void       cluster_node_add_speed      (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data);
+static void       cluster_node_schedule       (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data);
 static void       cluster_node_set_min_stream_interval (ClusterModel  *self,
 							RemoteClient  *client,
 							gpointer       user_data);
+static void       cluster_node_count          (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data);
+static void       cluster_node_tune           (ClusterModel  *self,
+					       RemoteClient  *client);
 static void       cluster_model_discovery_callback     (DiscoveryClient* self,
 							const gchar*     host,
 							int              port,
+							const gchar*     info,
 							gpointer         user_data);
+static double     cluster_node_speed          (RemoteClient  *client);
+static void       cluster_node_request_preview (ClusterModel  *self,
+						RemoteClient  *client,
+						gpointer       user_data);
+static void       cluster_node_detach         (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data);
 
 
 /************************************************************************************/
@@ -117,9 +167,29 @@ static void cluster_model_class_init(ClusterModelClass *klass)
 static void cluster_model_dispose(GObject *gobject)
 {
     ClusterModel *self = CLUSTER_MODEL(gobject);
+    int i;
 
     cluster_model_disable_discovery(self);
 
+    /* Closing their stdin tells our local workers to exit */
+    if (self->worker_pipes) {
+	for (i=0; i<self->worker_pipes->len; i++)
+	    close(g_array_index(self->worker_pipes, gint, i));
+	g_array_free(self->worker_pipes, TRUE);
+	self->worker_pipes = NULL;
+    }
+
+    /* Our nodes may outlive us for a moment, while their last streams
+     * are merged. Make sure they don't call us back in the meantime.
+     */
+    cluster_foreach_node(self, cluster_node_detach, NULL, FALSE);
+
+    if (self->preview) {
+	g_free(self->preview);
+	self->preview = NULL;
+    }
+    self->preview_callback = NULL;
+
     if (self->master_map) {
 	g_object_set_data(G_OBJECT(self->master_map), "ClusterModel", NULL);
 
@@ -134,6 +204,9 @@ static void cluster_model_dispose(GObject *gobject)
 
 static void cluster_model_init(ClusterModel *self)
 {
+    /* The same as RemoteClient's own default */
+    self->min_stream_interval = 1.0;
+    self->stream_overhead = DEFAULT_STREAM_OVERHEAD;
 }
 
 ClusterModel*  cluster_model_new              (IterativeMap*         master_map)
@@ -147,9 +220,10 @@ ClusterModel*  cluster_model_new              (IterativeMap*         master_map)
 	/* CLUSTER_MODEL_CLIENT      */  G_TYPE_OBJECT,
 	/* CLUSTER_MODEL_SPEED       */  G_TYPE_STRING,
 	/* CLUSTER_MODEL_BANDWIDTH   */  G_TYPE_STRING,
+	/* CLUSTER_MODEL_COMPRESSION */  G_TYPE_STRING,
     };
 
-    gtk_list_store_set_column_types(GTK_LIST_STORE(self), 7, types);
+    gtk_list_store_set_column_types(GTK_LIST_STORE(self), 8, types);
 
     self->master_map = g_object_ref(master_map);
 
@@ -198,6 +272,45 @@ RemoteClient*  cluster_model_add_node         (ClusterModel*         self,
     return cluster_model_enable_node(self, &iter);
 }
 
+void           cluster_model_add_local_workers (ClusterModel*        self,
+						const gchar*         program,
+						int                  n_workers)
+{
+    /* Start worker processes, each running 'program --worker', and add
+     * them as nodes. They announce their port on stdout, and we keep
+     * their stdin open for as long as we want them around.
+     */
+    gchar *argv[] = { (gchar*) program, "--threads", "1", "--worker", NULL };
+    GError *error = NULL;
+    gint in_fd, out_fd;
+    FILE *out;
+    int i, port;
+
+    for (i=0; i<n_workers; i++) {
+	if (!g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL,
+				      NULL, &in_fd, &out_fd, NULL, &error)) {
+	    g_warning("Can't start a local worker: %s", error->message);
+	    g_error_free(error);
+	    return;
+	}
+
+	out = fdopen(out_fd, "r");
+	if (fscanf(out, "port %d", &port) != 1) {
+	    g_warning("Local worker didn't tell us its port");
+	    fclose(out);
+	    close(in_fd);
+	    continue;
+	}
+	fclose(out);
+
+	if (!self->worker_pipes)
+	    self->worker_pipes = g_array_new(FALSE, FALSE, sizeof(gint));
+	g_array_append_val(self->worker_pipes, in_fd);
+
+	cluster_model_add_node(self, "127.0.0.1", port);
+    }
+}
+
 void           cluster_model_add_nodes        (ClusterModel*         self,
 					       const gchar*          hosts)
 {
@@ -310,6 +423,12 @@ RemoteClient*  cluster_model_enable_node      (ClusterModel*         self,
     if (self->set_min_stream_interval)
 	client->min_stream_interval = self->min_stream_interval;
 
+    /* Servers on this machine, like our local workers, can share their
+     * histograms with us in memory instead of streaming them.
+     */
+    if (!strcmp(host, "127.0.0.1") || !strcmp(host, "localhost"))
+	client->is_local = TRUE;
+
     gtk_list_store_set(GTK_LIST_STORE(self), iter,
 		       CLUSTER_MODEL_CLIENT, client,
 		       CLUSTER_MODEL_ENABLED, TRUE,
@@ -331,12 +450,24 @@ RemoteClient*  cluster_model_enable_node      (ClusterModel*         self,
 void           cluster_model_disable_node     (ClusterModel*         self,
 					       GtkTreeIter*          iter)
 {
+    RemoteClient *client;
+
+    /* A preview in progress shouldn't wait for this node any longer */
+    gtk_tree_model_get(GTK_TREE_MODEL(self), iter,
+		       CLUSTER_MODEL_CLIENT, &client,
+		       -1);
+    if (client) {
+	remote_client_cancel_preview(client);
+	g_object_unref(client);
+    }
+
     gtk_list_store_set(GTK_LIST_STORE(self), iter,
 		       CLUSTER_MODEL_CLIENT, NULL,
 		       CLUSTER_MODEL_ENABLED, FALSE,
 		       CLUSTER_MODEL_STATUS, "",
 		       CLUSTER_MODEL_SPEED, "",
 		       CLUSTER_MODEL_BANDWIDTH, "",
+		       CLUSTER_MODEL_COMPRESSION, "",
 		       -1);
 }
 
@@ -349,6 +480,7 @@ void           cluster_model_show_status      (ClusterModel*         self)
     gchar* status;
     gchar* speed;
     gchar* bandwidth;
+    gchar* compression;
     gchar* host_and_port;
 
     /* Iterate over all cluster nodes that are ready */
@@ -361,6 +493,7 @@ void           cluster_model_show_status      (ClusterModel*         self)
 			       CLUSTER_MODEL_STATUS, &status,
 			       CLUSTER_MODEL_SPEED, &speed,
 			       CLUSTER_MODEL_BANDWIDTH, &bandwidth,
+			       CLUSTER_MODEL_COMPRESSION, &compression,
 			       -1);
 	    if (enabled) {
 
@@ -370,10 +503,11 @@ void           cluster_model_show_status      (ClusterModel*         self)
 		    host_and_port = g_strdup_printf("%s:%d", host, port);
 
 		/* These widths were chosen to line up somewhat with batch-rendering results */
-		printf("  %-19s %-17s %16s [%s]\n",
+		printf("  %-19s %-17s %16s %-24s [%s]\n",
 		       host_and_port,
 		       speed ? speed : "",
 		       bandwidth ? bandwidth : "",
+		       compression ? compression : "",
 		       status);
 
 		g_free(host_and_port);
@@ -390,6 +524,50 @@ void           cluster_model_set_min_stream_interval (ClusterModel*  self,
     cluster_foreach_node(self, cluster_node_set_min_stream_interval, NULL, FALSE);
 }
 
+void           cluster_model_set_stream_overhead (ClusterModel*    self,
+						  gdouble          fraction)
+{
+    self->stream_overhead = fraction;
+    cluster_foreach_node(self, cluster_node_set_min_stream_interval, NULL, FALSE);
+}
+
+void           cluster_model_request_preview  (ClusterModel*          self,
+					       guint                  width,
+					       guint                  height,
+					       ClusterPreviewCallback callback,
+					       gpointer               user_data)
+{
+    if (!self->preview || self->preview_width != width || self->preview_height != height) {
+	g_free(self->preview);
+	self->preview = g_new(guint32, width * height);
+	self->preview_width = width;
+	self->preview_height = height;
+    }
+    memset(self->preview, 0, sizeof(self->preview[0]) * width * height);
+
+    self->preview_callback = callback;
+    self->preview_user_data = user_data;
+
+    /* We're on the main loop, so nothing is calculating. Pick up any
+     * streams we've already received first, or they'd be left out.
+     */
+    remote_client_fold_results(self->master_map);
+    histogram_imager_add_preview(HISTOGRAM_IMAGER(self->master_map),
+				 self->preview, width, height);
+
+    self->preview_pending = 0;
+    cluster_foreach_node(self, cluster_node_request_preview, NULL, TRUE);
+
+    callback(self, self->preview, width, height, self->preview_pending, user_data);
+}
+
+void           cluster_model_set_target_quality (ClusterModel*     self,
+						 gdouble           quality)
+{
+    self->target_quality = quality;
+    self->target_met = FALSE;
+}
+
 void           cluster_model_enable_discovery (ClusterModel* self)
 {
     /* Currently, our scanning interval is hardcoded at 5 minutes */
@@ -418,6 +596,7 @@ static void      client_status_callback          (RemoteClient*  client,
 {
     ClusterModel*self = CLUSTER_MODEL(user_data);
     GtkTreeIter iter;
+    gchar* speed_str;
 
     /* This node might have just become ready. If our cluster is supposed to
      * be running, make sure this node is running too.
@@ -432,6 +611,40 @@ static void      client_status_callback          (RemoteClient*  client,
     gtk_list_store_set(GTK_LIST_STORE(self), &iter,
 		       CLUSTER_MODEL_STATUS, status,
 		       -1);
+
+    /* Until we've measured its speed, show what the node claims */
+    if (!client->iters_per_sec && client->benchmark_speed > 0) {
+	speed_str = g_strdup_printf("~%.3e iter/s", client->benchmark_speed);
+	gtk_list_store_set(GTK_LIST_STORE(self), &iter,
+			   CLUSTER_MODEL_SPEED, speed_str,
+			   -1);
+	g_free(speed_str);
+    }
+}
+
+static void      client_preview_callback         (RemoteClient*  client,
+						  const guint32* preview,
+						  guint          width,
+						  guint          height,
+						  gpointer       user_data)
+{
+    /* Every node we asked answers exactly once, even if it has nothing
+     * to add, so our caller can tell when the preview is complete.
+     */
+    ClusterModel* self = CLUSTER_MODEL(user_data);
+    guint i;
+
+    if (!self->preview_callback)
+	return;
+
+    if (preview && width == self->preview_width && height == self->preview_height)
+	for (i=0; i<width*height; i++)
+	    self->preview[i] += preview[i];
+    if (self->preview_pending > 0)
+	self->preview_pending--;
+
+    self->preview_callback(self, self->preview, self->preview_width, self->preview_height,
+			   self->preview_pending, self->preview_user_data);
 }
 
 static void      client_speed_callback           (RemoteClient*  client,
@@ -443,18 +656,35 @@ static void      client_speed_callback           (RemoteClient*  client,
     GtkTreeIter iter;
     gchar* speed_str;
     gchar* bandwidth_str;
+    gchar* compression_str;
 
     cluster_model_find_client(self, client, &iter);
 
     speed_str = g_strdup_printf("%.3e iter/s", iters_per_sec);
     bandwidth_str = g_strdup_printf("%.2f KB/s", bytes_per_sec / 1000);
 
+    /* Compression ratio, and the average time spent compressing
+     * and decompressing each stream.
+     */
+    if (client->stream_compression && client->compression_ratio > 0)
+	compression_str = g_strdup_printf("%.1f:1 %.1f/%.1f ms",
+					  client->compression_ratio,
+					  client->encode_time * 1000,
+					  client->decode_time * 1000);
+    else
+	compression_str = g_strdup("");
+
     gtk_list_store_set(GTK_LIST_STORE(self), &iter,
 		       CLUSTER_MODEL_SPEED, speed_str,
 		       CLUSTER_MODEL_BANDWIDTH, bandwidth_str,
+		       CLUSTER_MODEL_COMPRESSION, compression_str,
 		       -1);
     g_free(speed_str);
     g_free(bandwidth_str);
+    g_free(compression_str);
+
+    if (self->stream_overhead > 0 && remote_client_is_ready(client))
+	cluster_node_tune(self, client);
 }
 
 static void       on_param_notify             (ParameterHolder* holder,
@@ -467,13 +697,43 @@ static void       on_param_notify             (ParameterHolder* holder,
 static void       on_calc_finished            (IterativeMap*  map,
 					       ClusterModel*  self)
 {
+    ClusterSchedule schedule;
+    double quality;
+
+    /* Between calculation slices is a safe time to pick up the
+     * results our nodes' streams have left in the staging histogram.
+     */
+    remote_client_fold_results(map);
     cluster_foreach_node(self, cluster_node_merge_results, NULL, TRUE);
+
+    if (self->target_quality <= 0 || self->target_met)
+	return;
+
+    /* Stop everyone as soon as the merged results are good enough. Until
+     * then, estimate how many more iterations it will take, assuming
+     * quality grows linearly like the batch renderer's time estimate.
+     * Nodes won't get quotas for much more than their share of that.
+     */
+    quality = histogram_imager_compute_quality(HISTOGRAM_IMAGER(map));
+    if (quality >= self->target_quality) {
+	self->target_met = TRUE;
+	cluster_foreach_node(self, cluster_node_stop, NULL, TRUE);
+	return;
+    }
+
+    schedule.remaining_iterations = 0;
+    if (quality > 0)
+	schedule.remaining_iterations = map->iterations * (self->target_quality / quality - 1);
+    schedule.total_speed = 0;
+    cluster_foreach_node(self, cluster_node_add_speed, &schedule, TRUE);
+    cluster_foreach_node(self, cluster_node_schedule, &schedule, TRUE);
 }
 
 static void       on_calc_start               (IterativeMap*  map,
 					       ClusterModel*  self)
 {
     self->is_running = TRUE;
+    self->target_met = FALSE;
     cluster_foreach_node(self, cluster_node_start, NULL, TRUE);
 }
 
@@ -487,23 +747,37 @@ static void       on_calc_stop                (IterativeMap*  map,
 static void       cluster_model_discovery_callback (DiscoveryClient* client,
 						    const gchar*     host,
 						    int              port,
+						    const gchar*     info,
 						    gpointer         user_data)
 {
     /* This is called by our DiscoveryClient when it's found a cluster
      * node. We may or may not already have this node- if we don't,
-     * it gets added.
+     * it gets added. Newer nodes describe themselves in a second reply,
+     * which lets us weigh them before they've even connected.
      */
     GtkTreeIter iter;
+    RemoteClient* node;
     ClusterModel* self = CLUSTER_MODEL(user_data);
     g_return_if_fail(client == self->discovery);
 
     if (cluster_model_find_address(self, host, port, &iter)) {
 	/* Already found this host */
+	if (info) {
+	    gtk_tree_model_get(GTK_TREE_MODEL(self), &iter,
+			       CLUSTER_MODEL_CLIENT, &node,
+			       -1);
+	    if (node) {
+		remote_client_set_capabilities(node, info);
+		g_object_unref(node);
+	    }
+	}
 	return;
     }
 
     /* Yay, a new node */
-    cluster_model_add_node(self, host, port);
+    node = cluster_model_add_node(self, host, port);
+    if (info)
+	remote_client_set_capabilities(node, info);
 }
 
 
@@ -539,13 +813,32 @@ static void      cluster_node_update_param       (ClusterModel  *self,
 						  gpointer       user_data)
 {
     GParamSpec* spec = (GParamSpec*) user_data;
-    remote_client_send_param(client, PARAMETER_HOLDER(self->master_map), spec->name);
+
+    /* Dragging a tool in the explorer changes parameters much faster than
+     * the cluster could use them. Let the client send only the newest ones.
+     */
+    remote_client_queue_param(client, PARAMETER_HOLDER(self->master_map), spec->name);
 }
 
 static void      cluster_node_start              (ClusterModel  *self,
 						  RemoteClient  *client,
 						  gpointer       user_data)
 {
+    ClusterSchedule schedule;
+
+    if (self->target_quality > 0 && !client->no_quota) {
+	if (self->target_met)
+	    return;
+
+	/* Whatever quota the node had, it was cancelled when it stopped */
+	schedule.remaining_iterations = 0;
+	schedule.total_speed = 0;
+	client->quota_remaining = 0;
+	client->quota_pending = FALSE;
+	cluster_node_schedule(self, client, &schedule);
+	return;
+    }
+
     remote_client_command(client, NULL, NULL, "calc_start");
 }
 
@@ -563,11 +856,122 @@ static void      cluster_node_merge_results      (ClusterModel  *self,
     remote_client_merge_results(client, self->master_map);
 }
 
+static void      cluster_node_add_speed          (ClusterModel  *self,
+						  RemoteClient  *client,
+						  gpointer       user_data)
+{
+    ClusterSchedule* schedule = (ClusterSchedule*) user_data;
+    if (!client->no_quota)
+	schedule->total_speed += cluster_node_speed(client);
+}
+
+static void       cluster_node_request_preview (ClusterModel  *self,
+						RemoteClient  *client,
+						gpointer       user_data)
+{
+    if (client->no_preview)
+	return;
+    self->preview_pending++;
+    remote_client_get_preview(client, self->preview_width, self->preview_height,
+			      client_preview_callback, self);
+}
+
+static void       cluster_node_detach         (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data)
+{
+    remote_client_set_status_cb(client, NULL, NULL);
+    remote_client_set_speed_cb(client, NULL, NULL);
+    client->preview_callback = NULL;
+}
+
+static double     cluster_node_speed          (RemoteClient  *client)
+{
+    /* Until we've measured a node ourselves, go by its own benchmark */
+    if (client->iters_per_sec > 0)
+	return client->iters_per_sec;
+    return client->benchmark_speed;
+}
+
+static void      cluster_node_schedule           (ClusterModel  *self,
+						  RemoteClient  *client,
+						  gpointer       user_data)
+{
+    /* Give this node a new quota once it's used up about half of its
+     * last one. The quota is sized by the node's measured speed, and
+     * limited to its share of the work we estimate is left.
+     */
+    ClusterSchedule* schedule = (ClusterSchedule*) user_data;
+    double speed = cluster_node_speed(client);
+    double quota;
+
+    if (client->no_quota || client->quota_pending)
+	return;
+
+    if (speed > 0) {
+	quota = speed * MAX(QUOTA_SECONDS, client->min_stream_interval * 2);
+	if (schedule->remaining_iterations > 0 && schedule->total_speed > 0)
+	    quota = MIN(quota, schedule->remaining_iterations * speed / schedule->total_speed);
+	quota = MAX(quota, MAX(MINIMUM_QUOTA, speed));
+    }
+    else {
+	quota = INITIAL_QUOTA;
+    }
+
+    if (client->quota_remaining < quota / 2)
+	remote_client_set_quota(client, quota);
+}
+
 static void       cluster_node_set_min_stream_interval (ClusterModel  *self,
 							RemoteClient  *client,
 							gpointer       user_data)
 {
+    /* Tuning starts over from the new minimum */
     client->min_stream_interval = self->min_stream_interval;
 }
 
+static void       cluster_node_count          (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data)
+{
+    (*(int*) user_data)++;
+}
+
+static void       cluster_node_tune           (ClusterModel  *self,
+					       RemoteClient  *client)
+{
+    /* Every stream costs the node the time it takes to encode it, and
+     * costs us the time it takes to merge it. We merge on one thread for
+     * the whole cluster, so each node only gets its share of that. Pick
+     * the shortest interval that keeps the total under our overhead
+     * target, and only change it when it's well off, since pushed
+     * streams need a new subscription for each change.
+     */
+    double cost, interval, render_time, quota_time;
+    int n_nodes = 0;
+
+    cluster_foreach_node(self, cluster_node_count, &n_nodes, TRUE);
+
+    cost = client->encode_time + client->merge_time * MAX(n_nodes, 1);
+    interval = CLAMP(cost / self->stream_overhead,
+		     self->min_stream_interval,
+		     self->min_stream_interval * MAX_INTERVAL_RATIO);
+
+    if (fabs(interval - client->min_stream_interval) >
+	client->min_stream_interval * INTERVAL_HYSTERESIS)
+	client->min_stream_interval = interval;
+
+    /* Long calculation slices waste less of the node's time, but it
+     * can't answer us or push a stream until each one ends. A node
+     * working through a quota also checks it only between slices, so
+     * at its measured speed a slice shouldn't overshoot it by much.
+     */
+    render_time = client->min_stream_interval / RENDER_SLICES;
+    if (client->quota_remaining > 0 && client->iters_per_sec > 0) {
+	quota_time = client->quota_remaining / client->iters_per_sec;
+	render_time = MIN(render_time, quota_time / RENDER_SLICES);
+    }
+    remote_client_set_render_time(client, CLAMP(render_time, MIN_RENDER_TIME, MAX_RENDER_TIME));
+}
+
 /* The End */
@@ -42,6 +42,14 @@ G_BEGIN_DECLS
 typedef struct _ClusterModel         ClusterModel;
 typedef struct _ClusterModelClass    ClusterModelClass;
 
+/* Called as each node's part of a preview arrives, with the sum so far */
+typedef void (*ClusterPreviewCallback) (ClusterModel*   self,
+					const guint32*  preview,
+					guint           width,
+					guint           height,
+					int             nodes_pending,
+					gpointer        user_data);
+
 struct _ClusterModel {
     GtkListStore parent;
 
@@ -50,8 +58,20 @@ struct _ClusterModel {
 
     gdouble       min_stream_interval;  /* Default for new clients */
     gboolean      set_min_stream_interval;
+    gdouble       stream_overhead;      /* Zero if intervals aren't adapted */
+
+    gdouble       target_quality;       /* Zero if nodes run until stopped */
+    gboolean      target_met;
 
     DiscoveryClient* discovery;
+    GArray*          worker_pipes;  /* stdin of each local worker */
+
+    /* The preview being assembled, see cluster_model_request_preview() */
+    guint32*         preview;
+    guint            preview_width, preview_height;
+    int              preview_pending;
+    ClusterPreviewCallback preview_callback;
+    gpointer         preview_user_data;
 };
 
 struct _ClusterModelClass {
@@ -66,6 +86,7 @@ enum {
     CLUSTER_MODEL_CLIENT,
     CLUSTER_MODEL_SPEED,
     CLUSTER_MODEL_BANDWIDTH,
+    CLUSTER_MODEL_COMPRESSION,
 };
 
 
@@ -89,6 +110,35 @@ RemoteClient*  cluster_model_add_node         (ClusterModel*         self,
 void           cluster_model_set_min_stream_interval (ClusterModel*  self,
 						      gdouble        seconds);
 
+/* Tune each node's stream interval and render time from its measured
+ * speeds, so that encoding and merging its streams takes no more than
+ * this fraction of the time. The minimum stream interval still bounds
+ * how long we wait for results. Zero keeps every node at the minimum.
+ */
+void           cluster_model_set_stream_overhead (ClusterModel*    self,
+						  gdouble          fraction);
+
+/* Hand out work to the nodes in iteration quotas sized by their speed,
+ * and stop them all as soon as the master map reaches this quality.
+ * Zero lets nodes run until the master map stops.
+ */
+void           cluster_model_set_target_quality (ClusterModel*     self,
+						 gdouble           quality);
+
+/* Build a coarse width x height preview of everything the cluster has
+ * calculated, without waiting for full-resolution streams. It starts
+ * out with the master map's own histogram, block-summed down, and each
+ * node adds the counts it hasn't sent yet. The callback runs right
+ * away and then once for each node, whether or not that node had a
+ * preview to give, so the round is complete when nodes_pending reaches
+ * zero. A new request replaces the old.
+ */
+void           cluster_model_request_preview  (ClusterModel*          self,
+					       guint                  width,
+					       guint                  height,
+					       ClusterPreviewCallback callback,
+					       gpointer               user_data);
+
 /* Show the cluster status on stdout. Good for debugging, and batch-mode rendering */
 void           cluster_model_show_status      (ClusterModel*         self);
 
@@ -96,6 +146,13 @@ void           cluster_model_show_status      (ClusterModel*         self);
 void           cluster_model_add_nodes        (ClusterModel*         self,
 					       const gchar*          hosts);
 
+/* Start worker processes on this machine, running 'program' with the
+ * hidden --worker option, and add them as nodes.
+ */
+void           cluster_model_add_local_workers (ClusterModel*        self,
+						const gchar*         program,
+						int                  n_workers);
+
 /* Enable/disable automatic autodiscovery of cluster nodes */
 void           cluster_model_enable_discovery (ClusterModel*         self);
 void           cluster_model_disable_discovery(ClusterModel*         self);
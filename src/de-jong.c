@@ -24,7 +24,9 @@
 
 #include "de-jong.h"
 #include "math-util.h"
+#include "parallel.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 static void de_jong_class_init(DeJongClass *klass);
@@ -32,11 +34,15 @@ static void de_jong_init(DeJong *self);
 static void de_jong_init_calc_params(GObjectClass *object_class);
 static void de_jong_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec);
 static void de_jong_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec);
+static void de_jong_finalize(GObject *object);
 static void de_jong_reset_calc(DeJong *self);
+static void de_jong_require_points(DeJong *self);
 static void de_jong_calculate(IterativeMap *self, guint iterations);
 static void de_jong_calculate_motion(IterativeMap *self, guint iterations, gboolean continuation, ParameterInterpolator *interp, gpointer interp_data);
 static ToolInfoPH *de_jong_get_tools();
 
+static gpointer parent_class = NULL;
+
 static void update_double_if_necessary(gdouble new_value, gboolean *dirty_flag, gdouble *param, gdouble epsilon);
 static void update_boolean_if_necessary(gboolean new_value, gboolean *dirty_flag, gboolean *param);
 
@@ -168,12 +174,15 @@ static void de_jong_class_init(DeJongClass *klass) {
     IterativeMapClass *im_class;
     ParameterHolderClass *ph_class;
 
+    parent_class = g_type_class_peek_parent(klass);
+
     object_class = (GObjectClass*) klass;
     im_class = (IterativeMapClass*) klass;
     ph_class = (ParameterHolderClass*) klass;
 
     object_class->set_property = de_jong_set_property;
     object_class->get_property = de_jong_get_property;
+    object_class->finalize = de_jong_finalize;
 
     im_class->calculate = de_jong_calculate;
     im_class->calculate_motion = de_jong_calculate_motion;
@@ -199,7 +208,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "de Jong parameter A",
 				      -100, 100, 2.38767,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.01, 5);
     g_object_class_install_property  (object_class, PROP_A, spec);
@@ -209,7 +218,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "de Jong parameter B",
 				      -100, 100, -1.22713,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.01, 5);
     g_object_class_install_property  (object_class, PROP_B, spec);
@@ -219,7 +228,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "de Jong parameter C",
 				      -100, 100, -0.39595,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.01, 5);
     g_object_class_install_property  (object_class, PROP_C, spec);
@@ -229,7 +238,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "de Jong parameter D",
 				      -100, 100, -4.67104,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.01, 5);
     g_object_class_install_property  (object_class, PROP_D, spec);
@@ -239,7 +248,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Zoom factor",
 				      0.01, 1000, 1,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.01, 0.1, 3);
     g_object_class_install_property  (object_class, PROP_ZOOM, spec);
@@ -249,7 +258,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Aspect ratio",
 				      0.01, 100, 1,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.1, 3);
     g_object_class_install_property  (object_class, PROP_ASPECT, spec);
@@ -259,7 +268,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Horizontal image offset",
 				      -100, 100, 0,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.01, 3);
     g_object_class_install_property  (object_class, PROP_XOFFSET, spec);
@@ -269,7 +278,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Vertical image offset",
 				      -100, 100, 0,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.01, 3);
     g_object_class_install_property  (object_class, PROP_YOFFSET, spec);
@@ -279,7 +288,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Rotation angle, in radians",
 				      -100, 100, 0,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.01, 3);
     g_object_class_install_property  (object_class, PROP_ROTATION, spec);
@@ -289,7 +298,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Gaussian blur radius",
 				      0, 100, 0,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.0001, 0.001, 4);
     g_object_class_install_property  (object_class, PROP_BLUR_RADIUS, spec);
@@ -299,7 +308,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Amount of blurred vs non-blurred rendering",
 				      0, 1, 1,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.01, 0.1, 4);
     g_object_class_install_property  (object_class, PROP_BLUR_RATIO, spec);
@@ -309,7 +318,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "When set, the image is wrapped rather than clipped at the edges",
 				      FALSE,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     g_object_class_install_property  (object_class, PROP_TILEABLE, spec);
 
@@ -318,7 +327,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Re-randomize the point periodically to emphasize transients",
 				      FALSE,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     g_object_class_install_property  (object_class, PROP_EMPHASIZE_TRANSIENT, spec);
 
@@ -327,7 +336,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Number of iterations between re-randomization, when 'Emphasize transient' is enabled",
 				      1, 100000, 50,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 1, 10, 0);
     param_spec_set_dependency        (spec, "emphasize-transient");
@@ -339,7 +348,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      initial_conditions_enum_get_type(),
 				      0,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_dependency        (spec, "emphasize-transient");
     g_object_class_install_property  (object_class, PROP_INITIAL_CONDITIONS, spec);
@@ -349,7 +358,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Horizontal initial condition scale factor",
 				      0, 1000, 1,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.01, 3);
     param_spec_set_dependency        (spec, "emphasize-transient");
@@ -360,7 +369,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Vertical initial condition scale factor",
 				      0, 1000, 1,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.01, 3);
     param_spec_set_dependency        (spec, "emphasize-transient");
@@ -371,7 +380,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Horizontal initial condition offset",
 				      -100, 100, 0,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.01, 3);
     param_spec_set_dependency        (spec, "emphasize-transient");
@@ -382,7 +391,7 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      "Vertical initial condition offset",
 				      -100, 100, 0,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.01, 3);
     param_spec_set_dependency        (spec, "emphasize-transient");
@@ -390,7 +399,17 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 }
 
 static void de_jong_init(DeJong *self) {
-    /* Nothing to do here yet, everything's set up by our G_PARAM_CONSTRUCT properties */
+    /* Everything else is set up by our G_PARAM_CONSTRUCT properties */
+    self->calc_threads = 1;
+}
+
+static void de_jong_finalize(GObject *object) {
+    DeJong *self = DE_JONG(object);
+
+    g_free(self->points);
+    self->points = NULL;
+
+    G_OBJECT_CLASS(parent_class)->finalize(object);
 }
 
 DeJong* de_jong_new() {
@@ -610,121 +629,70 @@ static void de_jong_get_property (GObject *object, guint prop_id, GValue *value,
 /********************************************************************** Calculation */
 /************************************************************************************/
 
-void de_jong_calculate(IterativeMap *map, guint iterations) {
-    /* Copy frequently used parameters to local variables */
-    DeJong *self = DE_JONG(map);
-    HistogramImager *hi = HISTOGRAM_IMAGER(map);
-    const gboolean tileable = self->tileable;
-    const DeJongParams param = self->param;
-
-    /* Histogram state */
+/* Everything a calculation thread needs to know that stays constant
+ * over one call to de_jong_calculate(). Threads only read this.
+ */
+typedef struct {
+    DeJong *self;
     HistogramPlot plot;
+    guint iterations;
     int hist_width, hist_height;
 
-    /* Toggles to disable features that aren't needed */
-    const gboolean rotation_enabled = self->rotation > 0.0001 || self->rotation < -0.0001;
-    const gboolean blur_enabled = self->blur_ratio > 0.0001 && self->blur_radius > 0.00001;
-    const gboolean aspect_enabled = self->aspect > 1.0001 || self->aspect < 0.9999;
-    const gboolean matrix_enabled = aspect_enabled || rotation_enabled;
-    const gboolean emphasize_transient = self->emphasize_transient;
-    const gboolean oversample_enabled = hi->oversample > 1;
-
-    /* Blurring variables */
-    int blur_table_size = 0;
-    int blur_ratio_period = 0;
-    int blur_index = 0, blur_ratio_index = 0, blur_ratio_threshold = 0;
-    float *blur_table = NULL;
-
-    /* Oversampling irregularity table.
-     * Fixed size for now. Must be a power of two! 
-     */
-    const int oversample_table_size = 32;
-    int oversample_index = 0;
-    float oversample_table[oversample_table_size];
-
-    /* Rotation/aspect matrix variables */
-    double sine_rotation, cosine_rotation, mat_a = 0, mat_b = 0, mat_c = 0, mat_d = 0;
-
-    /* Iteration and projection variables */
-    double x, y, point_x, point_y;
+    DeJongParams param;
+    gboolean tileable, blur_enabled, matrix_enabled;
+    gboolean emphasize_transient, oversample_enabled;
     double scale, xcenter, ycenter;
-    int i, ix, iy;
-    guint remaining_transient_iterations;
-    initial_conditions_t initial_func;
-
-    /* Reset calculation if we need to */
-    if (self->calc_dirty_flag || HISTOGRAM_IMAGER(self)->histogram_clear_flag)
-	de_jong_reset_calc(self);
+    double mat_a, mat_b, mat_c, mat_d;
 
-    /* Ask the histogram imager to prepare a group of plots */
-    histogram_imager_prepare_plots(HISTOGRAM_IMAGER(self), &plot);
-    histogram_imager_get_hist_size(HISTOGRAM_IMAGER(self), &hist_width, &hist_height);
+    float *blur_table;
+    int blur_table_size, blur_ratio_threshold;
+    float *oversample_table;
 
-    /* Calculate the scale and offset in histogram coordinates */
-    scale = hist_width / 5.0 * self->zoom;
-    xcenter = hist_width / 2.0 + self->xoffset * scale;
-    ycenter = hist_height / 2.0 + self->yoffset * scale;
-
-    /* Set up the matrix used for rotation and aspect ratio adjustment */
-    if (matrix_enabled) {
-	if (rotation_enabled) {
-	    sine_rotation = sin(self->rotation);
-	    cosine_rotation = cos(self->rotation);
-	    mat_a = cosine_rotation * self->aspect;
-	    mat_b = sine_rotation / self->aspect;
-	    mat_c = -sine_rotation * self->aspect;
-	    mat_d = cosine_rotation / self->aspect;
-	}
-	else {
-	    mat_a = self->aspect;
-	    mat_b = 0;
-	    mat_c = 0;
-	    mat_d = 1/self->aspect;
-	}
-    }
-
-    /* Initialize the blur table with a set of precalculated normally distributed
-     * random numbers. Larger blur tables just increase the independence between
-     * blocks of iterations. Since a new blur table is calculated at each run_iterations,
-     * at infinity the image still has the same effect, but each iteration runs much faster.
-     */
-    if (blur_enabled) {
-	/* Find a good size for the blur table. Our current heuristic finds
-	 * the smallest power of two that's still larger than 1/50 our iteration count.
-	 */
-	blur_table_size = find_upper_pow2(iterations / 50);
-
-	/* Allocate and fill the blur table */
-	blur_table = alloca(blur_table_size * sizeof(blur_table[0]));
-	for (i=0; i<blur_table_size; i+=2) {
-	    double a, b;
-	    normal_variate_pair(&a, &b);
-	    blur_table[i] = a * self->blur_radius;
-	    blur_table[i+1] = b * self->blur_radius;
-	}
-	blur_index = 0;
-
-	/* Initialize the blur ratio counter and threshold */
-	blur_ratio_index = 0;
-	blur_ratio_period = 1024;
-	blur_ratio_threshold = self->blur_ratio * blur_ratio_period;
-    }
+    initial_conditions_t initial_func;
+    guint transient_iterations;
+    double initial_xscale, initial_yscale, initial_xoffset, initial_yoffset;
+
+    /* Results from each thread, combined once they've all finished */
+    HistogramPlot *thread_plots;
+} DeJongCalc;
+
+/* Must be a power of two */
+#define BLUR_RATIO_PERIOD      1024
+#define OVERSAMPLE_TABLE_SIZE  32
+
+static void de_jong_calculate_point(const DeJongCalc *calc,
+				    DeJongPoint      *point,
+				    HistogramPlot    *plot,
+				    guint             iterations,
+				    int               blur_index,
+				    int               oversample_index,
+				    gboolean          atomic) {
+    /* Copy frequently used parameters to local variables */
+    const gboolean tileable = calc->tileable;
+    const gboolean blur_enabled = calc->blur_enabled;
+    const gboolean matrix_enabled = calc->matrix_enabled;
+    const gboolean emphasize_transient = calc->emphasize_transient;
+    const gboolean oversample_enabled = calc->oversample_enabled;
+    const DeJongParams param = calc->param;
+    const int hist_width = calc->hist_width;
+    const int hist_height = calc->hist_height;
+    const double scale = calc->scale, xcenter = calc->xcenter, ycenter = calc->ycenter;
+    const double mat_a = calc->mat_a, mat_b = calc->mat_b;
+    const double mat_c = calc->mat_c, mat_d = calc->mat_d;
+    const float *blur_table = calc->blur_table;
+    const float *oversample_table = calc->oversample_table;
+    const int blur_mask = calc->blur_table_size - 1;
+    const int blur_ratio_threshold = calc->blur_ratio_threshold;
+    int blur_ratio_index = 0;
 
-    /* Initialize the oversample irregularity table. When we're oversampling, we
-     * add +/- 1 subpixel of noise to the image in order to achieve the same effect
-     * as irregular-grid FSAA: avoiding unpleasant interference patterns by filtering
-     * out very high-frequency details that will generate aliasing artifacts.
-     */
-    if (oversample_enabled) {
-	for (i=0; i<oversample_table_size; i++)
-	    oversample_table[i] = uniform_variate() * 2 - 1;
-	oversample_index = 0;
-    }	
+    /* Iteration and projection variables */
+    double x, y, point_x, point_y;
+    int ix, iy;
+    guint i, remaining_transient_iterations;
 
-    point_x = self->point_x;
-    point_y = self->point_y;
-    remaining_transient_iterations = self->remaining_transient_iterations;
-    initial_func = initial_conditions_table[self->initial_conditions];
+    point_x = point->x;
+    point_y = point->y;
+    remaining_transient_iterations = point->remaining_transient_iterations;
 
     for(i=iterations; i; --i) {
 
@@ -738,10 +706,10 @@ void de_jong_calculate(IterativeMap *map, guint iterations) {
 		remaining_transient_iterations--;
 	    }
 	    else {
-		remaining_transient_iterations = self->transient_iterations-1;
-		initial_func(&point_x, &point_y);
-		point_x = self->initial_xscale * point_x + self->initial_xoffset;
-		point_y = self->initial_yscale * point_y + self->initial_yoffset;
+		remaining_transient_iterations = calc->transient_iterations-1;
+		calc->initial_func(&point_x, &point_y);
+		point_x = calc->initial_xscale * point_x + calc->initial_xoffset;
+		point_y = calc->initial_yscale * point_y + calc->initial_yoffset;
 	    }
 	}
 
@@ -778,11 +746,11 @@ void de_jong_calculate(IterativeMap *map, guint iterations) {
 	if (blur_enabled) {
 	    if (blur_ratio_index < blur_ratio_threshold) {
 		x += blur_table[blur_index];
-		blur_index = (blur_index+1) & (blur_table_size-1);
+		blur_index = (blur_index+1) & blur_mask;
 		y += blur_table[blur_index];
-		blur_index = (blur_index+1) & (blur_table_size-1);
+		blur_index = (blur_index+1) & blur_mask;
 	    }
-	    blur_ratio_index = (blur_ratio_index+1) & (blur_ratio_period-1);
+	    blur_ratio_index = (blur_ratio_index+1) & (BLUR_RATIO_PERIOD-1);
 	}
 
 	/* Scale and translate our (x,y) coordinates into pixel coordinates */
@@ -792,9 +760,9 @@ void de_jong_calculate(IterativeMap *map, guint iterations) {
 	/* Apply the random oversampling jitter, if applicable */
 	if (oversample_enabled) {
 	    x += oversample_table[oversample_index];
-	    oversample_index = (oversample_index+1) & (oversample_table_size-1);
+	    oversample_index = (oversample_index+1) & (OVERSAMPLE_TABLE_SIZE-1);
 	    y += oversample_table[oversample_index];
-	    oversample_index = (oversample_index+1) & (oversample_table_size-1);
+	    oversample_index = (oversample_index+1) & (OVERSAMPLE_TABLE_SIZE-1);
 	}
 
 
@@ -829,13 +797,167 @@ void de_jong_calculate(IterativeMap *map, guint iterations) {
 		continue;
 	}
 
-	HISTOGRAM_IMAGER_PLOT(plot, ix, iy);
+	if (atomic)
+	    HISTOGRAM_IMAGER_PLOT_ATOMIC(*plot, ix, iy);
+	else
+	    HISTOGRAM_IMAGER_PLOT(*plot, ix, iy);
+    }
+
+    point->x = point_x;
+    point->y = point_y;
+    point->remaining_transient_iterations = remaining_transient_iterations;
+}
+
+static void de_jong_calculate_thread(guint first, guint last, gpointer user_data) {
+    /* Each thread follows its own trajectory, starting partway through
+     * the shared random tables so the threads don't all perturb their
+     * points identically. Counts go straight into the shared histogram,
+     * so there's nothing to merge afterwards besides the plot totals.
+     */
+    DeJongCalc *calc = (DeJongCalc*) user_data;
+    guint n_threads = calc->self->n_points;
+    guint t, iterations;
+
+    for (t=first; t<last; t++) {
+	iterations = calc->iterations / n_threads;
+	if (t == 0)
+	    iterations += calc->iterations % n_threads;
+
+	calc->thread_plots[t] = calc->plot;
+	de_jong_calculate_point(calc, &calc->self->points[t], &calc->thread_plots[t], iterations,
+				(t * calc->blur_table_size / n_threads) & ~1,
+				(t * 2) & (OVERSAMPLE_TABLE_SIZE - 1),
+				TRUE);
     }
+}
 
-    histogram_imager_finish_plots(HISTOGRAM_IMAGER(self), &plot);
+void de_jong_calculate(IterativeMap *map, guint iterations) {
+    DeJong *self = DE_JONG(map);
+    HistogramImager *hi = HISTOGRAM_IMAGER(map);
+    DeJongCalc calc;
+    guint t;
+    int i;
+
+    /* Toggles to disable features that aren't needed */
+    const gboolean rotation_enabled = self->rotation > 0.0001 || self->rotation < -0.0001;
+    const gboolean aspect_enabled = self->aspect > 1.0001 || self->aspect < 0.9999;
+
+    /* Oversampling irregularity table */
+    float oversample_table[OVERSAMPLE_TABLE_SIZE];
+
+    /* Rotation/aspect matrix variables */
+    double sine_rotation, cosine_rotation;
+
+    /* Reset calculation if we need to. In decay mode, changing parameters
+     * doesn't reset anything, the old image just fades out as we go.
+     */
+    if (HISTOGRAM_IMAGER(self)->histogram_clear_flag ||
+	(self->calc_dirty_flag && HISTOGRAM_IMAGER(self)->decay_half_life <= 0))
+	de_jong_reset_calc(self);
+    else if (self->calc_dirty_flag) {
+	/* Decaying into the new parameters. They're in effect from here
+	 * on, so the change mustn't cause a reset later if decay is
+	 * switched off.
+	 */
+	self->calc_dirty_flag = FALSE;
+    }
+
+    /* Every thread needs its own point, we add them lazily */
+    de_jong_require_points(self);
+
+    memset(&calc, 0, sizeof(calc));
+    calc.self = self;
+    calc.iterations = iterations;
+    calc.param = self->param;
+    calc.tileable = self->tileable;
+    calc.blur_enabled = self->blur_ratio > 0.0001 && self->blur_radius > 0.00001;
+    calc.matrix_enabled = aspect_enabled || rotation_enabled;
+    calc.emphasize_transient = self->emphasize_transient;
+    calc.oversample_enabled = hi->oversample > 1;
+    calc.initial_func = initial_conditions_table[self->initial_conditions];
+    calc.transient_iterations = self->transient_iterations;
+    calc.initial_xscale = self->initial_xscale;
+    calc.initial_yscale = self->initial_yscale;
+    calc.initial_xoffset = self->initial_xoffset;
+    calc.initial_yoffset = self->initial_yoffset;
+
+    /* Ask the histogram imager to prepare a group of plots */
+    histogram_imager_prepare_plots(HISTOGRAM_IMAGER(self), &calc.plot);
+    histogram_imager_get_hist_size(HISTOGRAM_IMAGER(self), &calc.hist_width, &calc.hist_height);
+
+    /* Calculate the scale and offset in histogram coordinates */
+    calc.scale = calc.hist_width / 5.0 * self->zoom;
+    calc.xcenter = calc.hist_width / 2.0 + self->xoffset * calc.scale;
+    calc.ycenter = calc.hist_height / 2.0 + self->yoffset * calc.scale;
+
+    /* Set up the matrix used for rotation and aspect ratio adjustment */
+    if (calc.matrix_enabled) {
+	if (rotation_enabled) {
+	    sine_rotation = sin(self->rotation);
+	    cosine_rotation = cos(self->rotation);
+	    calc.mat_a = cosine_rotation * self->aspect;
+	    calc.mat_b = sine_rotation / self->aspect;
+	    calc.mat_c = -sine_rotation * self->aspect;
+	    calc.mat_d = cosine_rotation / self->aspect;
+	}
+	else {
+	    calc.mat_a = self->aspect;
+	    calc.mat_b = 0;
+	    calc.mat_c = 0;
+	    calc.mat_d = 1/self->aspect;
+	}
+    }
+
+    /* Initialize the blur table with a set of precalculated normally distributed
+     * random numbers. Larger blur tables just increase the independence between
+     * blocks of iterations. Since a new blur table is calculated at each run_iterations,
+     * at infinity the image still has the same effect, but each iteration runs much faster.
+     */
+    if (calc.blur_enabled) {
+	/* Find a good size for the blur table. Our current heuristic finds
+	 * the smallest power of two that's still larger than 1/50 our iteration count.
+	 */
+	calc.blur_table_size = find_upper_pow2(iterations / 50);
+
+	/* Allocate and fill the blur table */
+	calc.blur_table = alloca(calc.blur_table_size * sizeof(calc.blur_table[0]));
+	for (i=0; i<calc.blur_table_size; i+=2) {
+	    double a, b;
+	    normal_variate_pair(&a, &b);
+	    calc.blur_table[i] = a * self->blur_radius;
+	    calc.blur_table[i+1] = b * self->blur_radius;
+	}
+
+	/* Initialize the blur ratio threshold */
+	calc.blur_ratio_threshold = self->blur_ratio * BLUR_RATIO_PERIOD;
+    }
+
+    /* Initialize the oversample irregularity table. When we're oversampling, we
+     * add +/- 1 subpixel of noise to the image in order to achieve the same effect
+     * as irregular-grid FSAA: avoiding unpleasant interference patterns by filtering
+     * out very high-frequency details that will generate aliasing artifacts.
+     */
+    if (calc.oversample_enabled) {
+	for (i=0; i<OVERSAMPLE_TABLE_SIZE; i++)
+	    oversample_table[i] = uniform_variate() * 2 - 1;
+	calc.oversample_table = oversample_table;
+    }
+
+    if (self->n_points > 1) {
+	calc.thread_plots = alloca(self->n_points * sizeof(HistogramPlot));
+	parallel_for(self->n_points, 1, de_jong_calculate_thread, &calc);
+
+	for (t=0; t<self->n_points; t++) {
+	    calc.plot.plot_count += calc.thread_plots[t].plot_count;
+	    calc.plot.density = MAX(calc.plot.density, calc.thread_plots[t].density);
+	}
+    }
+    else {
+	de_jong_calculate_point(&calc, &self->points[0], &calc.plot, iterations, 0, 0, FALSE);
+    }
+
+    histogram_imager_finish_plots(HISTOGRAM_IMAGER(self), &calc.plot);
     ITERATIVE_MAP(self)->iterations += iterations;
-    self->point_x = point_x;    self->point_y = point_y;
-    self->remaining_transient_iterations = remaining_transient_iterations;
 }
 
 void de_jong_calculate_motion(IterativeMap         *self,
@@ -862,25 +984,56 @@ void de_jong_calculate_motion(IterativeMap         *self,
     }
 }
 
-static void de_jong_reset_calc(DeJong *self) {
-    /* Reset the histogram and calculation state */
-    histogram_imager_clear(HISTOGRAM_IMAGER(self));
-    ITERATIVE_MAP(self)->iterations = 0;
-    self->remaining_transient_iterations = 0;
-
+static void de_jong_reset_point(DeJongPoint *point) {
     /* Random starting point, use a simple uniform variate
      * for this. We have more complex initial condition controls
      * we use when emphasize_transient is on, but when it's off
      * the initial conditions have no effect on the image as iterations
      * approach infinity.
      */
-    self->point_x = uniform_variate();
-    self->point_y = uniform_variate();
+    point->x = uniform_variate();
+    point->y = uniform_variate();
+    point->remaining_transient_iterations = 0;
+}
+
+static void de_jong_require_points(DeJong *self) {
+    /* Make sure we have one point per calculation thread. New
+     * points start out somewhere random, just like after a reset.
+     */
+    guint n = MAX(self->calc_threads, 1);
+    guint i;
+
+    if (n == self->n_points)
+	return;
+
+    self->points = g_renew(DeJongPoint, self->points, n);
+    for (i=self->n_points; i<n; i++)
+	de_jong_reset_point(&self->points[i]);
+    self->n_points = n;
+}
+
+static void de_jong_reset_calc(DeJong *self) {
+    /* Reset the histogram and calculation state */
+    guint i;
+
+    histogram_imager_clear(HISTOGRAM_IMAGER(self));
+    ITERATIVE_MAP(self)->iterations = 0;
+
+    de_jong_require_points(self);
+    for (i=0; i<self->n_points; i++)
+	de_jong_reset_point(&self->points[i]);
 
     HISTOGRAM_IMAGER(self)->histogram_clear_flag = FALSE;
     self->calc_dirty_flag = FALSE;
 }
 
+void de_jong_set_calc_threads(DeJong *self, guint n_threads) {
+    /* Takes effect at the next calculation. Points are only added
+     * or removed, so the image we have so far stays valid.
+     */
+    self->calc_threads = MAX(n_threads, 1);
+}
+
 
 /************************************************************************************/
 /*************************************************************** Initial Conditions */
@@ -43,6 +43,12 @@ typedef struct {
     gdouble a, b, c, d;
 } DeJongParams;
 
+/* Each calculation thread follows its own trajectory */
+typedef struct {
+    gdouble x, y;
+    guint remaining_transient_iterations;
+} DeJongPoint;
+
 struct _DeJong {
     IterativeMap parent;
 
@@ -60,9 +66,10 @@ struct _DeJong {
 
     gboolean calc_dirty_flag;
 
-    /* Current calculation state */
-    gdouble point_x, point_y;
-    guint remaining_transient_iterations;
+    /* Current calculation state, one point per thread */
+    guint calc_threads;
+    DeJongPoint *points;
+    guint n_points;
 };
 
 struct _DeJongClass {
@@ -77,6 +84,12 @@ struct _DeJongClass {
 GType      de_jong_get_type         ();
 DeJong*    de_jong_new              ();
 
+/* Split each calculation across this many threads from the parallel
+ * pool. All threads plot into the same histogram, so this has no
+ * effect on the image besides how fast it converges.
+ */
+void       de_jong_set_calc_threads (DeJong *self, guint n_threads);
+
 G_END_DECLS
 
 #endif /* __DE_JONG_H__ */
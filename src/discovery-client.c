@@ -41,6 +41,9 @@ static gboolean   discovery_client_read          (GIOChannel*            source,
 
 static gboolean   discovery_client_broadcast     (gpointer               user_data);
 
+/* Room for the longest info string we'll accept from a server */
+#define DISCOVERY_MAX_INFO  512
+
 
 /************************************************************************************/
 /**************************************************** Initialization / Finalization */
@@ -124,8 +127,10 @@ DiscoveryClient*  discovery_client_new(const gchar*       service_name,
     self->callback = callback;
     self->user_data = user_data;
 
-    /* Create a buffer big enough to hold our incoming and outgoing packets */
-    self->buffer_size = sizeof(service_name) + 16;
+    /* Create a buffer big enough to hold our incoming and outgoing
+     * packets, including any extra information about the service.
+     */
+    self->buffer_size = strlen(service_name) + DISCOVERY_MAX_INFO;
     self->buffer = g_malloc(self->buffer_size);
 
     /* Sign up to get notified when new packets arrive */
@@ -154,30 +159,37 @@ static gboolean discovery_client_read(GIOChannel*            source,
     DiscoveryClient* self = DISCOVERY_CLIENT(user_data);
     gint length;
     GInetAddr *src;
-    gint port;
+    gint port, name_length;
     const gchar* host;
+    const gchar* info = NULL;
 
     /* Receive the packet waiting for us */
     length = gnet_udp_socket_receive(self->socket, self->buffer,
 				     self->buffer_size, &src);
     self->buffer[self->buffer_size - 1] = '\0';
 
-    /* Ignore it if it doesn't exactly match our service.
-     * It will have a 16-bit port number after the service name,
-     * we ignore that at this point.
+    /* Ignore it if it doesn't match our service. It will have a 16-bit
+     * port number after the service name, and possibly a null-terminated
+     * info string after that.
      */
-    if (length != strlen(self->service_name) + 3)
+    name_length = strlen(self->service_name) + 1;
+    if (length < name_length + 2)
 	return TRUE;
     if (strncmp(self->service_name, self->buffer, self->buffer_size))
 	return TRUE;
+    if (length > name_length + 2) {
+	if (self->buffer[length-1] != '\0')
+	    return TRUE;
+	info = (const gchar*) self->buffer + name_length + 2;
+    }
 
     /* Yay, a service responded. Extract the host and port, and
      * invoke our owner's callback function.
      */
-    port = self->buffer[length-1] | (self->buffer[length-2] << 8);
+    port = self->buffer[name_length+1] | (self->buffer[name_length] << 8);
     host = gnet_inetaddr_get_canonical_name(src);
 
-    self->callback(self, host, port, self->user_data);
+    self->callback(self, host, port, info, self->user_data);
 
     return TRUE;
 }
@@ -42,9 +42,13 @@ G_BEGIN_DECLS
 typedef struct _DiscoveryClient         DiscoveryClient;
 typedef struct _DiscoveryClientClass    DiscoveryClientClass;
 
+/* 'info' is NULL unless the server sent extra information about its
+ * service. Servers that do reply twice, once without it.
+ */
 typedef void (DiscoveryCallback)(DiscoveryClient* client,
 				 const gchar*     host,
 				 int              port,
+				 const gchar*     info,
 				 gpointer         user_data);
 
 struct _DiscoveryClient {
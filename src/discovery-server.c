@@ -87,6 +87,10 @@ static void discovery_server_dispose(GObject *gobject)
 	g_free(self->service_name);
 	self->service_name = NULL;
     }
+    if (self->service_info) {
+	g_free(self->service_info);
+	self->service_info = NULL;
+    }
     if (self->socket) {
 	gnet_udp_socket_delete(self->socket);
 	self->socket = NULL;
@@ -102,15 +106,19 @@ static void discovery_server_init(DiscoveryServer *self)
     self->socket = gnet_udp_socket_new_with_port(FYRE_DISCOVERY_PORT);
 }
 
-DiscoveryServer*  discovery_server_new(const gchar* service_name, int service_port)
+DiscoveryServer*  discovery_server_new(const gchar* service_name, int service_port,
+				       const gchar* service_info)
 {
     DiscoveryServer *self = DISCOVERY_SERVER(g_object_new(discovery_server_get_type(), NULL));
     self->service_name = g_strdup(service_name);
     self->service_port = service_port;
+    self->service_info = g_strdup(service_info);
 
     if (self->socket) {
 	/* Create a buffer big enough to hold our incoming and outgoing packets */
-	self->buffer_size = sizeof(service_name) + 16;
+	self->buffer_size = strlen(service_name) + 16;
+	if (service_info)
+	    self->buffer_size += strlen(service_info);
 	self->buffer = g_malloc(self->buffer_size);
 
 	/* Sign up to get notified when new packets arrive */
@@ -157,6 +165,13 @@ static gboolean discovery_server_read(GIOChannel*            source,
 
     gnet_udp_socket_send(self->socket, self->buffer, length, src);
 
+    /* Newer clients also get the extra information */
+    if (self->service_info) {
+	strcpy((gchar*) self->buffer + length, self->service_info);
+	length += strlen(self->service_info) + 1;
+	gnet_udp_socket_send(self->socket, self->buffer, length, src);
+    }
+
     return TRUE;
 }
 
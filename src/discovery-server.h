@@ -10,6 +10,11 @@
  *                      our provided service, we send a UDP packet back with
  *                      the service name again and the port we run it on.
  *
+ *                      If we have extra information about the service, it
+ *                      follows in a second reply, as a null-terminated
+ *                      string after the port. Clients that don't expect it
+ *                      ignore that packet, since its length is different.
+ *
  * Fyre - rendering and interactive exploration of chaotic functions
  * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
  *
@@ -54,6 +59,7 @@ struct _DiscoveryServer {
 
     gchar*       service_name;
     int          service_port;
+    gchar*       service_info;
 
     GUdpSocket*  socket;
     guchar*      buffer;
@@ -69,8 +75,10 @@ struct _DiscoveryServerClass {
 /************************************************************************************/
 
 GType             discovery_server_get_type         ();
+/* 'service_info' may be NULL, if there's nothing to say about the service */
 DiscoveryServer*  discovery_server_new              (const gchar* service_name,
-						     int          service_port);
+						     int          service_port,
+						     const gchar* service_info);
 
 G_END_DECLS
 
@@ -25,8 +25,20 @@
 #include "config.h"
 #include "explorer.h"
 #include "cluster-model.h"
+#include "histogram-view.h"
+#include "image-fu.h"
 #include <gtk/gtk.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* After the parameters change, the nodes get CLUSTER_PREVIEW_DELAY
+ * seconds to calculate before we ask them for a preview. Previews are
+ * CLUSTER_PREVIEW_SCALE times smaller than the image each way, or more
+ * if that would be larger than the servers will make.
+ */
+#define CLUSTER_PREVIEW_DELAY     0.5
+#define CLUSTER_PREVIEW_SCALE     4
+#define CLUSTER_PREVIEW_MAX_SIZE  1024
 
 static void      explorer_init_cluster_view      (Explorer *self);
 static gboolean  explorer_validate_host_and_port (Explorer *self);
@@ -43,6 +55,9 @@ static void      on_node_enabled_toggled         (GtkCellRendererToggle *cell_re
 						  gchar *path, gpointer user_data);
 static gboolean  on_cluster_window_delete        (GtkWidget *widget, GdkEvent *event,
 						  gpointer user_data);
+static void      on_cluster_preview              (ClusterModel *cluster, const guint32 *preview,
+						  guint width, guint height, int nodes_pending,
+						  gpointer user_data);
 
 
 /************************************************************************************/
@@ -73,6 +88,10 @@ void explorer_init_cluster(Explorer *self)
 				 self->cluster_model->discovery != NULL ? TRUE : FALSE);
 
     explorer_set_port(self, FYRE_DEFAULT_PORT);
+
+    /* Nodes may already be calculating, so a preview helps right away */
+    self->preview_clear_serial = HISTOGRAM_IMAGER(self->map)->clear_serial;
+    self->preview_timer = g_timer_new();
 }
 
 void explorer_dispose_cluster(Explorer *self)
@@ -81,6 +100,22 @@ void explorer_dispose_cluster(Explorer *self)
 	g_object_unref(self->cluster_model);
 	self->cluster_model = NULL;
     }
+    if (self->preview_timer) {
+	g_timer_destroy(self->preview_timer);
+	self->preview_timer = NULL;
+    }
+    if (self->preview_imager) {
+	g_object_unref(self->preview_imager);
+	self->preview_imager = NULL;
+    }
+    if (self->preview_buffer) {
+	histogram_buffer_free(self->preview_buffer);
+	self->preview_buffer = NULL;
+    }
+    if (self->preview_pixbuf) {
+	gdk_pixbuf_unref(self->preview_pixbuf);
+	self->preview_pixbuf = NULL;
+    }
 }
 
 static void explorer_init_cluster_view(Explorer *self) {
@@ -120,6 +155,127 @@ static void explorer_init_cluster_view(Explorer *self) {
 						gtk_cell_renderer_text_new(),
 						"text", CLUSTER_MODEL_BANDWIDTH,
 						NULL);
+
+    gtk_tree_view_insert_column_with_attributes(tv, -1, "Compression",
+						gtk_cell_renderer_text_new(),
+						"text", CLUSTER_MODEL_COMPRESSION,
+						NULL);
+}
+
+
+/************************************************************************************/
+/************************************************************************* Previews */
+/************************************************************************************/
+
+gboolean explorer_update_cluster_preview(Explorer *self)
+{
+    /* Ask the cluster for a coarse preview shortly after each parameter
+     * change, and show it until our own histogram has caught up with it.
+     * Returns TRUE while the preview is standing in for our own image.
+     */
+    HistogramImager *hi = HISTOGRAM_IMAGER(self->map);
+    guint scale;
+
+    if (!self->cluster_model)
+	return FALSE;
+
+    if (hi->clear_serial != self->preview_clear_serial) {
+	self->preview_clear_serial = hi->clear_serial;
+	self->preview_requested = FALSE;
+	self->preview_total = 0;
+	g_timer_start(self->preview_timer);
+    }
+
+    if (!self->preview_requested &&
+	g_timer_elapsed(self->preview_timer, NULL) > CLUSTER_PREVIEW_DELAY) {
+	self->preview_requested = TRUE;
+	scale = MAX(CLUSTER_PREVIEW_SCALE,
+		    (MAX(hi->width, hi->height) + CLUSTER_PREVIEW_MAX_SIZE - 1) / CLUSTER_PREVIEW_MAX_SIZE);
+	cluster_model_request_preview(self->cluster_model,
+				      MAX(hi->width / scale, 1), MAX(hi->height / scale, 1),
+				      on_cluster_preview, self);
+    }
+
+    /* Once the streams have landed, our own histogram has more to show */
+    if (!self->preview_pixbuf || self->preview_total <= hi->total_points_plotted ||
+	gdk_pixbuf_get_width(self->preview_pixbuf) != hi->width ||
+	gdk_pixbuf_get_height(self->preview_pixbuf) != hi->height)
+	return FALSE;
+
+    if (self->preview_dirty) {
+	histogram_view_draw_pixbuf(HISTOGRAM_VIEW(self->view), self->preview_pixbuf);
+	self->preview_dirty = FALSE;
+    }
+    return TRUE;
+}
+
+static void on_cluster_preview(ClusterModel *cluster, const guint32 *preview,
+			       guint width, guint height, int nodes_pending,
+			       gpointer user_data)
+{
+    /* Render the preview with the map's own colors and exposure, then
+     * scale it up to the size of our image.
+     */
+    Explorer *self = EXPLORER(user_data);
+    HistogramImager *hi = HISTOGRAM_IMAGER(self->map);
+    GParamSpec **properties;
+    guint n_properties, i;
+    gdouble total = 0;
+
+    /* Left over from before the parameters changed again */
+    if (hi->clear_serial != self->preview_clear_serial || !self->preview_requested)
+	return;
+
+    for (i=0; i<width*height; i++)
+	total += preview[i];
+    if (total <= hi->total_points_plotted)
+	return;
+
+    if (!self->preview_imager)
+	self->preview_imager = histogram_imager_new();
+
+    properties = g_object_class_list_properties(g_type_class_peek(HISTOGRAM_IMAGER_TYPE), &n_properties);
+    for (i=0; i<n_properties; i++) {
+	if (properties[i]->flags & PARAM_SERIALIZED) {
+	    GValue val;
+	    memset(&val, 0, sizeof(val));
+	    g_value_init(&val, properties[i]->value_type);
+	    g_object_get_property(G_OBJECT(self->map), properties[i]->name, &val);
+	    g_object_set_property(G_OBJECT(self->preview_imager), properties[i]->name, &val);
+	    g_value_unset(&val);
+	}
+    }
+    g_free(properties);
+    g_object_set(self->preview_imager,
+		 "width", width,
+		 "height", height,
+		 "oversample", 1,
+		 "decay_half_life", 0.0,
+		 NULL);
+
+    if (!self->preview_buffer || self->preview_buffer->hist_width != width ||
+	self->preview_buffer->hist_height != height) {
+	if (self->preview_buffer)
+	    histogram_buffer_free(self->preview_buffer);
+	self->preview_buffer = histogram_buffer_new(width, height);
+    }
+    memcpy(self->preview_buffer->histogram, preview, sizeof(preview[0]) * width * height);
+    memset(self->preview_buffer->dirty_tiles, 1,
+	   self->preview_buffer->tiles_width * self->preview_buffer->tiles_height);
+
+    histogram_imager_clear(self->preview_imager);
+    histogram_imager_merge_buffer(self->preview_imager, self->preview_buffer);
+    histogram_imager_update_image(self->preview_imager);
+
+    if (self->preview_pixbuf)
+	gdk_pixbuf_unref(self->preview_pixbuf);
+    self->preview_pixbuf = gdk_pixbuf_scale_simple(self->preview_imager->image,
+						   hi->width, hi->height, GDK_INTERP_BILINEAR);
+    if (hi->fgalpha < 0xFFFF || hi->bgalpha < 0xFFFF)
+	image_add_checkerboard(self->preview_pixbuf);
+
+    self->preview_total = total;
+    self->preview_dirty = TRUE;
 }
 
 
@@ -32,6 +32,7 @@
 #include "histogram-view.h"
 #include "de-jong.h"
 #include "prefix.h"
+#include "png-reader.h"
 
 static void explorer_class_init  (ExplorerClass *klass);
 static void explorer_init        (Explorer *self);
@@ -51,6 +52,7 @@ static gdouble generate_random_param();
 static void     on_randomize                (GtkWidget *widget, Explorer* self);
 static void     on_load_defaults            (GtkWidget *widget, Explorer* self);
 static void     on_save                     (GtkWidget *widget, Explorer* self);
+static void     on_save_finished            (const gchar *filename, GError *error, gpointer user_data);
 static void     on_save_exr                 (GtkWidget *widget, Explorer* self);
 static void     on_quit                     (GtkWidget *widget, Explorer* self);
 static void     on_pause_rendering_toggle   (GtkWidget *widget, Explorer* self);
@@ -154,6 +156,7 @@ static void explorer_init(Explorer *self) {
     /* Set up the statusbar */
     self->statusbar = GTK_STATUSBAR(glade_xml_get_widget(self->xml, "statusbar"));
     self->render_status_context = gtk_statusbar_get_context_id(self->statusbar, "Rendering status");
+    self->save_status_context = gtk_statusbar_get_context_id(self->statusbar, "Saving status");
     self->speed_timer = g_timer_new();
     self->auto_update_rate_timer = g_timer_new();
     self->status_update_rate_timer = g_timer_new();
@@ -253,6 +256,11 @@ void      explorer_init_cluster          (Explorer *self)
 
 void      explorer_dispose_cluster       (Explorer *self) {}
 
+gboolean  explorer_update_cluster_preview (Explorer *self)
+{
+    return FALSE;
+}
+
 #endif /* !HAVE_GNET */
 
 
@@ -327,7 +335,8 @@ static void on_zoom_out(GtkWidget *widget, Explorer* self)
 #if (GTK_CHECK_VERSION(2, 4, 0))
 static void
 update_image_preview (GtkFileChooser *chooser, GtkImage *image) {
-    GdkPixbuf *image_pixbuf, *temp;
+    GdkPixbuf *image_pixbuf;
+    GHashTable *text;
     static GdkPixbuf *emblem_pixbuf = NULL;
     gchar *filename;
     GdkPixmap *pixmap;
@@ -357,13 +366,12 @@ update_image_preview (GtkFileChooser *chooser, GtkImage *image) {
     gdk_draw_rectangle (pixmap, GTK_WIDGET (image)->style->bg_gc[GTK_STATE_NORMAL], TRUE, 0, 0, width + 16, height + 16);
     gdk_draw_pixbuf (pixmap, NULL, image_pixbuf, 0, 0, 0, 0, width - 1, height - 1, GDK_RGB_DITHER_NONE, 0, 0);
 
-    temp = gdk_pixbuf_new_from_file (filename, NULL);
-    if (temp) {
-        if (gdk_pixbuf_get_option (temp, "tEXt::fyre_params"))
-            gdk_draw_pixbuf (pixmap, NULL, emblem_pixbuf, 0, 0, width - 16, height - 16, 31, 31, GDK_RGB_DITHER_NONE, 0, 0);
-        else if (gdk_pixbuf_get_option (temp, "tEXt::de_jong_params"))
+    /* Check for metadata without decoding the whole image a second time */
+    text = png_read_text (filename, NULL);
+    if (text) {
+        if (g_hash_table_lookup (text, "fyre_params") || g_hash_table_lookup (text, "de_jong_params"))
             gdk_draw_pixbuf (pixmap, NULL, emblem_pixbuf, 0, 0, width - 16, height - 16, 31, 31, GDK_RGB_DITHER_NONE, 0, 0);
-        gdk_pixbuf_unref (temp);
+        g_hash_table_destroy (text);
     }
 
     if (image_pixbuf)
@@ -432,7 +440,6 @@ static void on_load_from_image (GtkWidget *widget, Explorer* self) {
 
 static void on_save (GtkWidget *widget, Explorer* self) {
     GtkWidget *dialog;
-    GError *error = NULL;
     gchar *filename = NULL;
 
 #if (GTK_CHECK_VERSION(2, 4, 0))
@@ -447,7 +454,6 @@ static void on_save (GtkWidget *widget, Explorer* self) {
         gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER (dialog), file_location);
     if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_OK) {
 	filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
-	histogram_imager_save_image_file (HISTOGRAM_IMAGER (self->map), filename, &error);
 
 	if (file_location)
             g_free (file_location);
@@ -459,11 +465,29 @@ static void on_save (GtkWidget *widget, Explorer* self) {
 
     if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_OK) {
 	filename = g_strdup (gtk_file_selection_get_filename (GTK_FILE_SELECTION (dialog)));
-	histogram_imager_save_image_file (HISTOGRAM_IMAGER (self->map), filename, &error);
     }
 #endif
     gtk_widget_destroy (dialog);
 
+    if (filename) {
+	/* Compress and write the image in the background, so
+	 * rendering and the GUI can carry on in the meantime.
+	 */
+	gchar *message = g_strdup_printf ("Saving %s...", filename);
+	gtk_statusbar_push (self->statusbar, self->save_status_context, message);
+	g_free (message);
+
+	histogram_imager_save_image_file_async (HISTOGRAM_IMAGER (self->map), filename,
+						on_save_finished, g_object_ref (self));
+	g_free (filename);
+    }
+}
+
+static void on_save_finished (const gchar *filename, GError *error, gpointer user_data) {
+    Explorer *self = EXPLORER (user_data);
+
+    gtk_statusbar_pop (self->statusbar, self->save_status_context);
+
     if (error) {
 	GtkWidget *dialog, *label;
 	gchar *text;
@@ -474,14 +498,12 @@ static void on_save (GtkWidget *widget, Explorer* self) {
 	text = g_strdup_printf ("<span weight=\"bold\" size=\"larger\">Could not save \"%s\"</span>\n\n%s", filename, error->message);
 	gtk_label_set_markup (GTK_LABEL (label), text);
 	g_free (text);
-	g_error_free (error);
 
 	gtk_dialog_run (GTK_DIALOG (dialog));
 	gtk_widget_hide (dialog);
     }
 
-    if (filename)
-	g_free (filename);
+    g_object_unref (self);
 }
 
 static void on_save_exr (GtkWidget *widget, Explorer* self) {
@@ -503,7 +525,7 @@ static void on_save_exr (GtkWidget *widget, Explorer* self) {
 
     if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_OK) {
 	filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
-	exr_save_image_file (HISTOGRAM_IMAGER (self->map), filename, &error);
+	exr_save_image_file (HISTOGRAM_IMAGER (self->map), filename, FALSE, &error);
 
 	if (file_location)
 	    g_free (file_location);
@@ -516,7 +538,7 @@ static void on_save_exr (GtkWidget *widget, Explorer* self) {
     if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_OK) {
 	const gchar *filename;
 	filename = g_strdup (gtk_file_selection_get_filename (GTK_FILE_SELECTION (dialog)));
-	exr_save_image_file (HISTOGRAM_IMAGER (self->map), filename, &error);
+	exr_save_image_file (HISTOGRAM_IMAGER (self->map), filename, FALSE, &error);
     }
 #endif /* GTK_CHECK_VERSION */
     gtk_widget_destroy (dialog);
@@ -669,6 +691,15 @@ void explorer_update_gui(Explorer *self) {
      * frames to the drawing area.
      */
 
+    /* While the cluster's preview is better than our own image, it takes
+     * the place of view updates. The status bar still moves along.
+     */
+    if (explorer_update_cluster_preview(self)) {
+	if (!limit_update_rate(self->status_update_rate_timer, 2.0))
+	    explorer_update_status_bar(self);
+	return;
+    }
+
     /* If we have rendering changes we're trying to push through as quickly
      * as possible, don't bother with the status bar or with frame rate limiting.
      */
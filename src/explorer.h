@@ -64,6 +64,7 @@ struct _Explorer {
     GtkStatusbar*        statusbar;
     guint                render_status_message_id;
     guint                render_status_context;
+    guint                save_status_context;
     gboolean             status_dirty_flag;
 
     GTimer*              auto_update_rate_timer;
@@ -99,6 +100,18 @@ struct _Explorer {
 
 #ifdef HAVE_GNET
     ClusterModel*        cluster_model;
+
+    /* A coarse preview from the cluster, shown in place of our own image
+     * after the parameters change, until our histogram catches up with it.
+     */
+    guint                preview_clear_serial;
+    gboolean             preview_requested;
+    GTimer*              preview_timer;
+    HistogramImager*     preview_imager;
+    HistogramBuffer*     preview_buffer;
+    GdkPixbuf*           preview_pixbuf;
+    gdouble              preview_total;
+    gboolean             preview_dirty;
 #endif
 };
 
@@ -128,6 +141,7 @@ void      explorer_update_animation      (Explorer *self);
 
 void      explorer_init_cluster          (Explorer *self);
 void      explorer_dispose_cluster       (Explorer *self);
+gboolean  explorer_update_cluster_preview (Explorer *self);
 
 void      explorer_init_about            (Explorer *self);
 
@@ -24,114 +24,152 @@
 
 extern "C" {
 #include "histogram-imager.h"
+#include "parallel.h"
 #include "config.h"
 }
 
-#include <ImfRgbaFile.h>
+#include <math.h>
+#include <vector>
+#include <ImfOutputFile.h>
+#include <ImfHeader.h>
+#include <ImfChannelList.h>
+#include <ImfFrameBuffer.h>
+#include <ImfRgba.h>
+#include <ImfStringAttribute.h>
+#include <ImfFloatAttribute.h>
+#include <ImfThreading.h>
 using namespace Imf;
 
-void exr_save_real (HistogramImager *hi, const gchar *filename);
+void exr_save_real (HistogramImager *hi, const gchar *filename, gboolean with_density);
 
 #define fyre_exr_error_quark() (g_quark_from_string("FYRE_EXR_ERROR"))
 enum {
     FYRE_EXR_SAVE_FAILURE,
 } FyreExrError;
 
-extern "C" void exr_save_image_file(HistogramImager *hi, const gchar* filename, GError **error)
+/* Largest count value we keep in the color lookup table. Anything
+ * above this is rare enough that we just calculate it directly.
+ */
+#define EXR_LUT_MAX_COUNT   (1 << 20)
+
+/* Approximate size of each block of scanlines we convert at once */
+#define EXR_BLOCK_BYTES     (8 << 20)
+
+typedef struct {
+    float r, g, b, a;
+} ExrColor;
+
+typedef struct {
+    HistogramImager *hi;
+    float            fscale;
+    float            one_over_gamma;
+    ExrColor         bg, range;
+
+    /* Finished linear colors for every count below lut_size */
+    ExrColor        *lut;
+    guint            lut_size;
+
+    /* The current block of scanlines */
+    Rgba            *pixels;
+    float           *density;
+    int              first_row;
+} ExrSave;
+
+extern "C" void exr_save_image_file(HistogramImager *hi, const gchar* filename,
+				    gboolean with_density, GError **error)
 {
     try {
-	exr_save_real (hi, filename);
+	exr_save_real (hi, filename, with_density);
     } catch (const std::exception &exc) {
-	GError *nerror = g_error_new (fyre_exr_error_quark(), FYRE_EXR_SAVE_FAILURE, exc.what());
-	*error = nerror;
+	if (error)
+	    *error = g_error_new (fyre_exr_error_quark(), FYRE_EXR_SAVE_FAILURE, "%s", exc.what());
     }
 }
 
-void
-exr_save_real (HistogramImager *hi, const gchar *filename)
+static void
+exr_bucket_color (const ExrSave *state, guint count, ExrColor *bucket)
+{
+    /* Linear exposure plus gamma adjustment */
+    float luma = count * state->fscale;
+    luma = pow(luma, state->one_over_gamma);
+
+    /* Optionally clamp before interpolating */
+    if (state->hi->clamped && luma > 1)
+	luma = 1;
+
+    /* Color interpolation, with no per-component clamping */
+    bucket->r = luma * state->range.r + state->bg.r;
+    bucket->g = luma * state->range.g + state->bg.g;
+    bucket->b = luma * state->range.b + state->bg.b;
+    bucket->a = luma * state->range.a + state->bg.a;
+
+    /* Fyre images are generally authored to look good in sRGB,
+     * so they'll already be in the monitor's gamma. This should
+     * perform the inverse of OpenEXR's default monitor gamma
+     * correction. Alpha should always be linear, so leave
+     * that alone.
+     */
+    bucket->r = pow(bucket->r * 3.012, 2.2) / 5.55555;
+    bucket->g = pow(bucket->g * 3.012, 2.2) / 5.55555;
+    bucket->b = pow(bucket->b * 3.012, 2.2) / 5.55555;
+}
+
+static void
+exr_fill_lut (guint first, guint last, gpointer user_data)
+{
+    ExrSave *state = (ExrSave*) user_data;
+    for (guint count=first; count<last; count++)
+	exr_bucket_color (state, count, &state->lut[count]);
+}
+
+static void
+exr_convert_rows (guint first, guint last, gpointer user_data)
 {
-    int width = hi->width;
-    int height = hi->height;
-    RgbaOutputFile file (filename, width, height);
-    Rgba *pixels = new Rgba[width * height];
-    Rgba *cur_pixel = pixels;
+    /* Convert rows of the current block. For each pixel, we loop over the
+     * corresponding histogram bins. For oversample==1 this is only one bin,
+     * otherwise it's a square block of oversample^2 bins. For each bin we
+     * look up the finished color values and add them. We don't actually use
+     * fyre's oversampling gamma here, since the OpenEXR pixel values should
+     * already be linear.
+     */
+    ExrSave *state = (ExrSave*) user_data;
+    HistogramImager *hi = state->hi;
+    const int width = hi->width;
     const guint oversample = hi->oversample;
-    float fscale = histogram_imager_get_pixel_scale(hi);
-    float one_over_gamma = 1.0 / hi->gamma;
-    guint* cur_bucket = hi->histogram;
-
-    struct {
-	float r,g,b,a;
-    } bg, fg, range, bucket, pixel;
-
-    bg.r = hi->bgcolor.red / 65535.0;
-    bg.g = hi->bgcolor.green / 65535.0;
-    bg.b = hi->bgcolor.blue / 65535.0;
-    bg.a = hi->bgalpha / 65535.0;
-
-    fg.r = hi->fgcolor.red / 65535.0;
-    fg.g = hi->fgcolor.green / 65535.0;
-    fg.b = hi->fgcolor.blue / 65535.0;
-    fg.a = hi->fgalpha / 65535.0;
-
-    range.r = fg.r - bg.r;
-    range.g = fg.g - bg.g;
-    range.b = fg.b - bg.b;
-    range.a = fg.a - bg.a;
-
-    int histogram_stride = oversample * width;
-    float oversample_squared = oversample * oversample;
-    int histogram_block_stride = (oversample-1) * histogram_stride;
-
-    /* This outer loop iterates over pixels in the resulting image */
-    for (int pix_y = height; pix_y; pix_y--) {
-	for (int pix_x = width; pix_x; pix_x--) {
+    const int histogram_stride = oversample * width;
+    const float inv_oversample_squared = 1.0f / (oversample * oversample);
 
-	    /* Then for each pixel, loop over the corresponding histogram bins.
-	     * For oversample==1 this is only one bin, otherwise it's a square
-	     * block of oversample^2 bins. For each bin we compute the finished
-	     * color values and add them. We don't actually use fyre's oversampling
-	     * gamma here, since the OpenEXR pixel values should already be linear.
-	     */
-	    pixel.r = pixel.g = pixel.b = pixel.a = 0;
+    for (guint row=first; row<last; row++) {
+	Rgba *cur_pixel = state->pixels + row * width;
+	float *cur_density = state->density ? state->density + row * width : NULL;
+	guint *cur_bucket = hi->histogram + (gsize) (state->first_row + row) * oversample * histogram_stride;
+
+	for (int pix_x = width; pix_x; pix_x--) {
+	    ExrColor pixel = {0, 0, 0, 0};
+	    ExrColor direct;
+	    const ExrColor *bucket;
+	    float total = 0;
 
 	    guint* cur_bucket_row = cur_bucket;
 	    for (int bucket_y = oversample; bucket_y; bucket_y--) {
 		guint* cur_bucket_sample = cur_bucket_row;
 		for (int bucket_x = oversample; bucket_x; bucket_x--) {
+		    guint count = *(cur_bucket_sample++);
 
-		    /* Linear exposure plus gamma adjustment */
-		    float luma = (*cur_bucket_sample) * fscale;
-		    luma = pow(luma, one_over_gamma);
-
-		    /* Optionally clamp before interpolating */
-		    if (hi->clamped && luma > 1)
-			luma = 1;
-
-		    /* Color interpolation, with no per-component clamping */
-		    bucket.r = luma * range.r + bg.r;
-		    bucket.g = luma * range.g + bg.g;
-		    bucket.b = luma * range.b + bg.b;
-		    bucket.a = luma * range.a + bg.a;
-
-		    /* Fyre images are generally authored to look good in sRGB,
-		     * so they'll already be in the monitor's gamma. This should
-		     * perform the inverse of OpenEXR's default monitor gamma
-		     * correction. Alpha should always be linear, so leave
-		     * that alone.
-		     */
-		    bucket.r = pow(bucket.r * 3.012, 2.2) / 5.55555;
-		    bucket.g = pow(bucket.g * 3.012, 2.2) / 5.55555;
-		    bucket.b = pow(bucket.b * 3.012, 2.2) / 5.55555;
+		    if (count < state->lut_size) {
+			bucket = &state->lut[count];
+		    }
+		    else {
+			exr_bucket_color (state, count, &direct);
+			bucket = &direct;
+		    }
 
 		    /* Accumulate this bucket into our current pixel */
-		    pixel.r += bucket.r;
-		    pixel.g += bucket.g;
-		    pixel.b += bucket.b;
-		    pixel.a += bucket.a;
-
-		    /* Next sample in this oversampling square */
-		    cur_bucket_sample++;
+		    pixel.r += bucket->r;
+		    pixel.g += bucket->g;
+		    pixel.b += bucket->b;
+		    pixel.a += bucket->a;
+		    total += count;
 		}
 
 		/* Next line in the oversampling square */
@@ -139,24 +177,109 @@ exr_save_real (HistogramImager *hi, const gchar *filename)
 	    }
 
 	    /* Finish averaging over the oversampling square, and store this pixel */
-	    cur_pixel->r = pixel.r / oversample_squared;
-	    cur_pixel->g = pixel.g / oversample_squared;
-	    cur_pixel->b = pixel.b / oversample_squared;
-	    cur_pixel->a = pixel.a / oversample_squared;
-
-	    /* Jump to the next pixel, and the beginning of the next block of buckets */
+	    cur_pixel->r = pixel.r * inv_oversample_squared;
+	    cur_pixel->g = pixel.g * inv_oversample_squared;
+	    cur_pixel->b = pixel.b * inv_oversample_squared;
+	    cur_pixel->a = pixel.a * inv_oversample_squared;
 	    cur_pixel++;
+
+	    if (cur_density)
+		*(cur_density++) = total * inv_oversample_squared;
+
+	    /* Beginning of the next block of buckets */
 	    cur_bucket += oversample;
 	}
+    }
+}
+
+void
+exr_save_real (HistogramImager *hi, const gchar *filename, gboolean with_density)
+{
+    /* Convert the histogram in blocks of scanlines, so memory usage stays
+     * bounded no matter how large the image is. Each block is converted on
+     * all CPUs using a lookup table of finished colors, then handed to
+     * OpenEXR, which compresses it using its own thread pool.
+     */
+    const int width = hi->width;
+    const int height = hi->height;
+    ExrSave state;
+    gchar *params;
+    int block_rows;
+
+    state.hi = hi;
+    state.fscale = histogram_imager_get_pixel_scale(hi);
+    state.one_over_gamma = 1.0 / hi->gamma;
 
-	/* Skip over all the histogram lines still part of the same row of buckets */
-	cur_bucket += histogram_block_stride;
+    state.bg.r = hi->bgcolor.red / 65535.0;
+    state.bg.g = hi->bgcolor.green / 65535.0;
+    state.bg.b = hi->bgcolor.blue / 65535.0;
+    state.bg.a = hi->bgalpha / 65535.0;
+
+    state.range.r = hi->fgcolor.red / 65535.0   - state.bg.r;
+    state.range.g = hi->fgcolor.green / 65535.0 - state.bg.g;
+    state.range.b = hi->fgcolor.blue / 65535.0  - state.bg.b;
+    state.range.a = hi->fgalpha / 65535.0       - state.bg.a;
+
+    /* Precompute colors for every count value up to the peak density */
+    state.lut_size = MIN(hi->peak_density, EXR_LUT_MAX_COUNT) + 1;
+    std::vector<ExrColor> lut (state.lut_size);
+    state.lut = &lut[0];
+    parallel_for (state.lut_size, parallel_block_size (state.lut_size, 1024), exr_fill_lut, &state);
+
+    /* Half-float RGBA, like RgbaOutputFile would give us, plus an
+     * optional full-precision channel with the average raw histogram
+     * count for each pixel. Multiplying that by fyreDensityScale gives
+     * the luminance Fyre used before gamma correction.
+     */
+    Header header (width, height);
+    header.channels().insert ("R", Channel (HALF));
+    header.channels().insert ("G", Channel (HALF));
+    header.channels().insert ("B", Channel (HALF));
+    header.channels().insert ("A", Channel (HALF));
+    if (with_density) {
+	header.channels().insert ("density", Channel (FLOAT));
+	header.insert ("fyreDensityScale", FloatAttribute (state.fscale));
     }
+    params = parameter_holder_save_string (PARAMETER_HOLDER(hi));
+    header.insert ("fyreParams", StringAttribute (params));
+    g_free (params);
+
+    setGlobalThreadCount (parallel_get_n_threads());
+    OutputFile file (filename, header);
+
+    /* Keep blocks a multiple of 32 lines where possible,
+     * so they line up with OpenEXR's compression blocks.
+     */
+    block_rows = EXR_BLOCK_BYTES / (width * (sizeof(Rgba) + (with_density ? sizeof(float) : 0)));
+    if (block_rows > 32)
+	block_rows &= ~31;
+    block_rows = CLAMP(block_rows, 1, height);
 
-    file.setFrameBuffer(pixels, 1, width);
-    file.writePixels(height);
+    std::vector<Rgba> pixels (block_rows * width);
+    std::vector<float> density (with_density ? block_rows * width : 0);
+    state.pixels = &pixels[0];
+    state.density = with_density ? &density[0] : NULL;
 
-    delete[] pixels;
+    for (state.first_row = 0; state.first_row < height; state.first_row += block_rows) {
+	int n_rows = MIN(block_rows, height - state.first_row);
+
+	parallel_for (n_rows, parallel_block_size (n_rows, 1), exr_convert_rows, &state);
+
+	/* OpenEXR addresses the frame buffer using absolute scanline
+	 * numbers, so offset our base pointers back to line zero.
+	 */
+	const size_t row_offset = (size_t) state.first_row * width;
+	FrameBuffer fb;
+	fb.insert ("R", Slice (HALF, (char*) &(state.pixels - row_offset)->r, sizeof(Rgba), sizeof(Rgba) * width));
+	fb.insert ("G", Slice (HALF, (char*) &(state.pixels - row_offset)->g, sizeof(Rgba), sizeof(Rgba) * width));
+	fb.insert ("B", Slice (HALF, (char*) &(state.pixels - row_offset)->b, sizeof(Rgba), sizeof(Rgba) * width));
+	fb.insert ("A", Slice (HALF, (char*) &(state.pixels - row_offset)->a, sizeof(Rgba), sizeof(Rgba) * width));
+	if (with_density)
+	    fb.insert ("density", Slice (FLOAT, (char*) (state.density - row_offset), sizeof(float), sizeof(float) * width));
+
+	file.setFrameBuffer (fb);
+	file.writePixels (n_rows);
+    }
 }
 
 /* The End */
@@ -25,7 +25,11 @@
 
 #include "histogram-imager.h"
 #include "var-int.h"
+#include "stream-vbyte.h"
 #include "image-fu.h"
+#include "parallel.h"
+#include "png-writer.h"
+#include "png-reader.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -40,12 +44,23 @@ static void histogram_imager_get_property (GObject *object, guint prop_id, GValu
 static void histogram_imager_resize_from_string (HistogramImager *self, const gchar *s);
 
 static void histogram_imager_generate_color_table (HistogramImager *self, gboolean force);
+static void histogram_imager_generate_deep_table (HistogramImager *self);
+static void histogram_imager_render_block (guint first, guint last, gpointer user_data);
 
 static void histogram_imager_check_dirty_flags (HistogramImager *self);
 static void histogram_imager_require_histogram (HistogramImager *self);
+static void histogram_imager_reset_dirty_tiles (HistogramImager *self, gboolean dirty);
 static void histogram_imager_require_image (HistogramImager *self);
 static void histogram_imager_require_oversample_tables (HistogramImager *self);
+static void histogram_imager_resample_histogram (HistogramImager *self);
+static guint* histogram_imager_reduce_histogram (HistogramImager *self, guint width, guint height);
+static void histogram_imager_count_to_color (HistogramImager *self, double count,
+					     float pixel_scale, double one_over_gamma, float *rgba);
 static gulong histogram_imager_get_max_usable_density (HistogramImager *self);
+static void histogram_imager_set_decay_half_life (HistogramImager *self, gdouble half_life);
+static void histogram_imager_apply_decay (HistogramImager *self);
+static void histogram_imager_rescale_counts (HistogramImager *self, gdouble ratio);
+static void histogram_export_free (HistogramExport *pending);
 
 static gboolean update_double_if_necessary (gdouble new_value, gboolean *dirty_flag, gdouble *param, gdouble epsilon);
 static gboolean update_uint_if_necessary (guint new_value, gboolean *dirty_flag, guint *param);
@@ -70,6 +85,7 @@ enum {
     PROP_CLAMPED,
     PROP_FGCOLOR_GDK,
     PROP_BGCOLOR_GDK,
+    PROP_DECAY_HALF_LIFE,
 };
 
 static gpointer parent_class = NULL;
@@ -79,6 +95,15 @@ typedef enum {
     FYRE_HISTOGRAM_IMAGER_ERROR_NO_METADATA,
 } FyreHistogramImagerError;
 
+/* Number of steps in the deep nonlinearize table, covering linear values from 0 to 1 */
+#define HISTOGRAM_IMAGER_DEEP_STEPS 65536
+
+/* In decay mode, the weight of each plot starts at this many counts
+ * and grows to twice that before the histogram is rescaled. The extra
+ * resolution lets small counts fade out smoothly.
+ */
+#define HISTOGRAM_IMAGER_DECAY_BASE_WEIGHT 64
+
 
 /************************************************************************************/
 /**************************************************** Initialization / Finalization */
@@ -120,6 +145,8 @@ histogram_imager_class_init (HistogramImagerClass *klass)
     object_class->get_property = histogram_imager_get_property;
     object_class->dispose      = histogram_imager_dispose;
 
+    stream_vbyte_init ();
+
     histogram_imager_init_size_params (object_class);
     histogram_imager_init_render_params (object_class);
 }
@@ -134,7 +161,8 @@ histogram_imager_init_size_params (GObjectClass *object_class)
 				      "Width",
 				      "Width of the rendered image, in pixels",
 				      1, 32767, 600,
-				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED | PARAM_IN_GUI);
+				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED | PARAM_IN_GUI |
+				      PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 1, 16, 0);
     g_object_class_install_property  (object_class, PROP_WIDTH, spec);
@@ -143,7 +171,8 @@ histogram_imager_init_size_params (GObjectClass *object_class)
 				      "Height",
 				      "Height of the rendered image, in pixels",
 				      1, 32767, 600,
-				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED | PARAM_IN_GUI);
+				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED | PARAM_IN_GUI |
+				      PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 1, 16, 0);
     g_object_class_install_property  (object_class, PROP_HEIGHT, spec);
@@ -152,7 +181,8 @@ histogram_imager_init_size_params (GObjectClass *object_class)
 				      "Oversampling",
 				      "Oversampling factor, 1 for no oversampling to 4 for heavy oversampling",
 				      1, 4, 1,
-				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED | PARAM_IN_GUI);
+				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED | PARAM_IN_GUI |
+				      PARAM_CALCULATION);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 1, 1, 0);
     g_object_class_install_property  (object_class, PROP_OVERSAMPLE, spec);
@@ -168,7 +198,7 @@ histogram_imager_init_size_params (GObjectClass *object_class)
 				      "Size",
 				      "Image size as a WIDTH or WIDTHxHEIGHT string",
 				      NULL,
-				      G_PARAM_READWRITE);
+				      G_PARAM_READWRITE | PARAM_CALCULATION);
     g_object_class_install_property  (object_class, PROP_SIZE, spec);
 }
 
@@ -266,6 +296,14 @@ histogram_imager_init_render_params (GObjectClass *object_class)
 				      PARAM_INTERPOLATE | PARAM_IN_GUI);
     param_spec_set_group             (spec, current_group);
     g_object_class_install_property  (object_class, PROP_CLAMPED, spec);
+
+    spec = g_param_spec_double       ("decay_half_life",
+				      "Decay half-life",
+				      "When nonzero, the histogram fades out with this half-life in seconds, "
+				      "and parameter changes no longer reset it",
+				      0, 3600, 0,
+				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+    g_object_class_install_property  (object_class, PROP_DECAY_HALF_LIFE, spec);
 }
 
 static void
@@ -277,6 +315,14 @@ histogram_imager_dispose (GObject *gobject)
 	g_free (self->histogram);
 	self->histogram = NULL;
     }
+    if (self->dirty_tiles) {
+	g_free (self->dirty_tiles);
+	self->dirty_tiles = NULL;
+    }
+    if (self->export_spare && !self->export_detached) {
+	histogram_export_free (self->export_spare);
+	self->export_spare = NULL;
+    }
     if (self->image) {
 	gdk_pixbuf_unref (self->image);
 	self->image = NULL;
@@ -297,6 +343,14 @@ histogram_imager_dispose (GObject *gobject)
 	g_free (self->oversample_tables.nonlinearize);
 	self->oversample_tables.nonlinearize = NULL;
     }
+    if (self->color_table.deep_table) {
+	g_free (self->color_table.deep_table);
+	self->color_table.deep_table = NULL;
+    }
+    if (self->oversample_tables.deep_nonlinearize) {
+	g_free (self->oversample_tables.deep_nonlinearize);
+	self->oversample_tables.deep_nonlinearize = NULL;
+    }
 
     G_OBJECT_CLASS (parent_class)->dispose (gobject);
 }
@@ -451,6 +505,10 @@ histogram_imager_set_property (GObject *object, guint prop_id, const GValue *val
 	update_boolean_if_necessary (g_value_get_boolean (value), &self->render_dirty_flag, &self->clamped);
 	break;
 
+    case PROP_DECAY_HALF_LIFE:
+	histogram_imager_set_decay_half_life (self, g_value_get_double (value));
+	break;
+
     default:
 	G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 	break;
@@ -524,6 +582,10 @@ histogram_imager_get_property (GObject *object, guint prop_id, GValue *value, GP
 	g_value_set_boxed (value, &self->bgcolor);
 	break;
 
+    case PROP_DECAY_HALF_LIFE:
+	g_value_set_double (value, self->decay_half_life);
+	break;
+
     default:
 	G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 	break;
@@ -538,17 +600,19 @@ histogram_imager_get_property (GObject *object, guint prop_id, GValue *value, GP
 void
 histogram_imager_load_image_file (HistogramImager *self, const gchar *filename, GError **error)
 {
-    /* Try to open the given PNG file and load parameters from it */
+    /* Try to open the given PNG file and load parameters from it. Only
+     * the text chunks are read, the image itself is never decoded.
+     */
     const gchar *params;
-    GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file (filename, error);
-    if (!pixbuf)
+    GHashTable *text = png_read_text (filename, error);
+    if (!text)
 	return;
 
-    params = gdk_pixbuf_get_option (pixbuf, "tEXt::fyre_params");
+    params = g_hash_table_lookup (text, "fyre_params");
 
     /* For backward compatibility with de Jong Explorer and early versions of Fyre */
     if (!params)
-	params = gdk_pixbuf_get_option (pixbuf, "tEXt::de_jong_params");
+	params = g_hash_table_lookup (text, "de_jong_params");
 
     if (params) {
 	parameter_holder_load_string (PARAMETER_HOLDER (self), params);
@@ -560,7 +624,42 @@ histogram_imager_load_image_file (HistogramImager *self, const gchar *filename,
 	    *error = nerror;
 	}
     }
-    gdk_pixbuf_unref (pixbuf);
+    g_hash_table_destroy (text);
+}
+
+typedef struct {
+    GdkPixbuf               *image;
+    gchar                   *params;
+    gchar                   *filename;
+    GError                  *error;
+    HistogramImagerSaveFunc  callback;
+    gpointer                 user_data;
+} HistogramSave;
+
+static gboolean
+histogram_imager_write_png (GdkPixbuf *image, const gchar *params,
+			    const gchar *filename, GError **error)
+{
+    /* Write an 8-bit image using our own encoder, which unlike
+     * gdk_pixbuf_save() compresses on all CPUs at once.
+     */
+    PngWriter *writer;
+    gboolean success;
+
+    writer = png_writer_new (filename, gdk_pixbuf_get_width (image),
+			     gdk_pixbuf_get_height (image), 8, error);
+    if (!writer)
+	return FALSE;
+
+    /* Save our current parameters in a tEXt chunk, using a format that
+     * is both human-readable and easy to load parameters from automatically.
+     */
+    png_writer_add_text (writer, "fyre_params", params);
+
+    success = png_writer_write_rows (writer, gdk_pixbuf_get_pixels (image),
+				     gdk_pixbuf_get_rowstride (image),
+				     gdk_pixbuf_get_height (image), error);
+    return png_writer_close (writer, success ? error : NULL) && success;
 }
 
 void
@@ -570,13 +669,155 @@ histogram_imager_save_image_file (HistogramImager *self, const gchar *filename,
     gchar *params;
 
     histogram_imager_update_image (self);
+    params = parameter_holder_save_string (PARAMETER_HOLDER(self));
+    histogram_imager_write_png (self->image, params, filename, error);
+    g_free (params);
+}
 
-    /* Save our current parameters in a tEXt chunk, using a format that
-     * is both human-readable and easy to load parameters from automatically.
+static gboolean
+histogram_imager_save_finished (gpointer user_data)
+{
+    /* Back in the main thread, report how the save went */
+    HistogramSave *save = (HistogramSave*) user_data;
+
+    if (save->callback)
+	save->callback (save->filename, save->error, save->user_data);
+
+    if (save->error)
+	g_error_free (save->error);
+    gdk_pixbuf_unref (save->image);
+    g_free (save->params);
+    g_free (save->filename);
+    g_free (save);
+    return FALSE;
+}
+
+static gpointer
+histogram_imager_save_thread (gpointer user_data)
+{
+    HistogramSave *save = (HistogramSave*) user_data;
+
+    histogram_imager_write_png (save->image, save->params, save->filename, &save->error);
+    g_idle_add (histogram_imager_save_finished, save);
+    return NULL;
+}
+
+void
+histogram_imager_save_image_file_async (HistogramImager         *self,
+					const gchar             *filename,
+					HistogramImagerSaveFunc  callback,
+					gpointer                 user_data)
+{
+    /* Take a snapshot of the current image and parameters, then compress
+     * and write it from another thread. The histogram is free to keep
+     * changing in the meantime.
+     */
+    HistogramSave *save = g_new0 (HistogramSave, 1);
+
+    histogram_imager_update_image (self);
+    save->image = gdk_pixbuf_copy (self->image);
+    save->params = parameter_holder_save_string (PARAMETER_HOLDER(self));
+    save->filename = g_strdup (filename);
+    save->callback = callback;
+    save->user_data = user_data;
+
+    if (!g_thread_supported () ||
+	!g_thread_create (histogram_imager_save_thread, save, FALSE, NULL)) {
+	/* No threads, so save right away. We still report back from
+	 * the main loop, so callers see the same thing either way.
+	 */
+	histogram_imager_save_thread (save);
+    }
+}
+
+void
+histogram_imager_save_image_file_16bit (HistogramImager *self, const gchar *filename, GError **error)
+{
+    /* Save a .PNG file with 16 bits per channel. Rather than going through
+     * the 8-bit GdkPixbuf, rows are rendered straight from the histogram
+     * a block at a time and streamed to the file, so this never needs a
+     * full-size copy of the image in memory.
      */
+    const gsize block_bytes = 4 << 20;
+    PngWriter *writer;
+    gchar *params;
+    guint16 *block;
+    gsize rowstride;
+    guint block_rows, y, n_rows;
+    gboolean success = TRUE;
+
+    histogram_imager_prepare_render (self, HISTOGRAM_IMAGER_FORMAT_RGBA16);
+
+    writer = png_writer_new (filename, self->width, self->height, 16, error);
+    if (!writer)
+	return;
+
     params = parameter_holder_save_string (PARAMETER_HOLDER(self));
-    gdk_pixbuf_save (self->image, filename, "png", error, "tEXt::fyre_params", params, NULL);
+    png_writer_add_text (writer, "fyre_params", params);
     g_free (params);
+
+    rowstride = self->width * 4 * sizeof (guint16);
+    block_rows = CLAMP(block_bytes / rowstride, 1, self->height);
+    block = g_malloc (rowstride * block_rows);
+
+    for (y=0; success && y<self->height; y+=n_rows) {
+	n_rows = MIN(block_rows, self->height - y);
+	histogram_imager_render_rows (self, HISTOGRAM_IMAGER_FORMAT_RGBA16, block, rowstride, y, n_rows);
+	success = png_writer_write_rows (writer, block, rowstride, n_rows, error);
+    }
+    g_free (block);
+
+    png_writer_close (writer, success ? error : NULL);
+}
+
+static GdkPixbuf*
+histogram_imager_render_thumbnail (HistogramImager *self, guint width, guint height)
+{
+    /* Render a small image without touching our full-size one. The histogram
+     * is box-filtered straight down to the thumbnail size by summing counts,
+     * then only the thumbnail's own pixels need to be colorized. Note that
+     * this averages counts rather than colors, so oversample_gamma doesn't
+     * apply here.
+     */
+    GdkPixbuf *thumb;
+    guint *counts, *count_p;
+    guint32 *pixel_p;
+    guchar *row;
+    float rgba[4];
+    float pixel_scale;
+    double one_over_gamma = 1/self->gamma;
+    guint x, y;
+    int ch, c;
+
+    histogram_imager_check_dirty_flags (self);
+    histogram_imager_require_histogram (self);
+    counts = histogram_imager_reduce_histogram (self, width, height);
+
+    /* Each thumbnail count is the sum of this many histogram buckets, on average */
+    pixel_scale = histogram_imager_get_pixel_scale (self) *
+	((double) width * height) / ((double) self->hist_width * self->hist_height);
+
+    thumb = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width, height);
+    row = gdk_pixbuf_get_pixels (thumb);
+    count_p = counts;
+
+    for (y=0; y<height; y++) {
+	pixel_p = (guint32*) row;
+	for (x=0; x<width; x++) {
+	    guchar channels[4];
+
+	    histogram_imager_count_to_color (self, *(count_p++), pixel_scale, one_over_gamma, rgba);
+	    for (ch=0; ch<4; ch++) {
+		c = ((int) rgba[ch]) >> 8;
+		channels[ch] = CLAMP(c, 0, 255);
+	    }
+	    *(pixel_p++) = IMAGEFU_COLOR(channels[3], channels[0], channels[1], channels[2]);
+	}
+	row += gdk_pixbuf_get_rowstride (thumb);
+    }
+
+    g_free (counts);
+    return thumb;
 }
 
 GdkPixbuf*
@@ -586,9 +827,6 @@ histogram_imager_make_thumbnail (HistogramImager *self, guint max_width, guint m
     guint width, height;
     GdkPixbuf *thumb;
 
-    /* Make sure the histogram is up to date */
-    histogram_imager_update_image (self);
-
     /* Scale it down aspect-correctly */
     if (aspect > 1) {
 	width = max_width;
@@ -600,7 +838,7 @@ histogram_imager_make_thumbnail (HistogramImager *self, guint max_width, guint m
     }
     width = MAX(width, 5);
     height = MAX(height, 5);
-    thumb = gdk_pixbuf_scale_simple (self->image, width, height, GDK_INTERP_BILINEAR);
+    thumb = histogram_imager_render_thumbnail (self, width, height);
 
     /* Do an in-place composite of a checkerboard behind this image, to make alpha visible */
     image_add_checkerboard(thumb);
@@ -637,9 +875,13 @@ histogram_imager_prepare_plots (HistogramImager *self,
 {
     histogram_imager_check_dirty_flags(self);
     histogram_imager_require_histogram(self);
+    histogram_imager_apply_decay(self);
     plot->histogram = self->histogram;
     plot->hist_width = self->width * self->oversample;
+    plot->dirty_tiles = self->dirty_tiles;
+    plot->tiles_width = self->tiles_width;
     plot->density = 0;
+    plot->weight = (guint) (self->decay.weight + 0.5);
     plot->plot_count = 0;
 }
 
@@ -647,7 +889,8 @@ void
 histogram_imager_finish_plots (HistogramImager *self,
 			       HistogramPlot   *plot)
 {
-    self->total_points_plotted += plot->plot_count;
+    /* Like the histogram itself, this is measured in counts, not points */
+    self->total_points_plotted += ((gdouble) plot->plot_count) * plot->weight;
     if (plot->density > self->peak_density)
 	self->peak_density = plot->density;
 }
@@ -657,6 +900,14 @@ histogram_imager_finish_plots (HistogramImager *self,
 /************************************************************************ Rendering */
 /************************************************************************************/
 
+typedef struct {
+    HistogramImager       *self;
+    HistogramImagerFormat  format;
+    guchar                *pixels;
+    gsize                  rowstride;
+    guint                  first_row;
+} HistogramRender;
+
 void
 histogram_imager_update_image (HistogramImager *self)
 {
@@ -664,106 +915,222 @@ histogram_imager_update_image (HistogramImager *self)
      * downsampling by combining all count buckets that represent each of our output pixels.
      */
     histogram_imager_check_dirty_flags (self);
-    histogram_imager_require_histogram (self);
     histogram_imager_require_image (self);
+    histogram_imager_prepare_render (self, HISTOGRAM_IMAGER_FORMAT_RGBA8);
+    histogram_imager_render_rows (self, HISTOGRAM_IMAGER_FORMAT_RGBA8,
+				  gdk_pixbuf_get_pixels (self->image),
+				  gdk_pixbuf_get_rowstride (self->image),
+				  0, self->height);
+}
+
+void
+histogram_imager_prepare_render (HistogramImager *self, HistogramImagerFormat format)
+{
+    histogram_imager_check_dirty_flags (self);
+    histogram_imager_require_histogram (self);
     histogram_imager_generate_color_table (self, TRUE);
 
-    {
-	guint32 *pixel_p;
-	guint32* const color_table = self->color_table.table;
-	guint *hist_p, *sample_p;
-	guint count, hist_clamp;
-	const guint oversample = self->oversample;
-	int x, y;
-
-	pixel_p = (guint32*) gdk_pixbuf_get_pixels (self->image);
-	hist_p = self->histogram;
-
-	/* Clamp count values to the size of our color table.
-	 * Assuming the color table generator did it's job
-	 * correctly, any count values higher than the maximum
-	 * one in the table would generate the same color as
-	 * the highest one.
+    if (format == HISTOGRAM_IMAGER_FORMAT_RGBA8) {
+	if (self->oversample > 1)
+	    histogram_imager_require_oversample_tables (self);
+    }
+    else {
+	histogram_imager_generate_deep_table (self);
+    }
+}
+
+void
+histogram_imager_render_rows (HistogramImager       *self,
+			      HistogramImagerFormat  format,
+			      gpointer               pixels,
+			      gsize                  rowstride,
+			      guint                  first_row,
+			      guint                  n_rows)
+{
+    /* Split the rows into blocks, and colorize them on every CPU we have.
+     * Each row only reads the histogram and tables, and writes its own
+     * pixels, so there's no locking to do.
+     */
+    HistogramRender render;
+
+    g_return_if_fail (first_row + n_rows <= self->height);
+
+    render.self = self;
+    render.format = format;
+    render.pixels = pixels;
+    render.rowstride = rowstride;
+    render.first_row = first_row;
+
+    parallel_for (n_rows, parallel_block_size (n_rows, 4),
+		  histogram_imager_render_block, &render);
+}
+
+static void
+histogram_imager_render_row_8 (HistogramImager *self, guint y, guint32 *pixel_p)
+{
+    guint32* const color_table = self->color_table.table;
+    const guint oversample = self->oversample;
+    guint *hist_p, *sample_p;
+    guint count, hist_clamp;
+    int x;
+
+    hist_p = self->histogram + (gsize) y * oversample * self->width * oversample;
+
+    /* Clamp count values to the size of our color table.
+     * Assuming the color table generator did it's job
+     * correctly, any count values higher than the maximum
+     * one in the table would generate the same color as
+     * the highest one.
+     */
+    hist_clamp = self->color_table.filled_size - 1;
+
+    if (oversample > 1) {
+	/* Nice ugly loop that downsamples multiple (oversample^2)
+	 * histogram buckets to each pixel
 	 */
-	hist_clamp = self->color_table.filled_size - 1;
 
-	if (oversample > 1) {
-	    /* Nice ugly loop that downsamples multiple (oversample^2)
-	     * histogram buckets to each pixel
+	const int sample_stride = (self->width * oversample) - oversample;
+	guint* const linearize_table = self->oversample_tables.linearize;
+	guint8* const nonlinearize_table = self->oversample_tables.nonlinearize;
+	int sample_x, sample_y;
+	int ch0, ch1, ch2, ch3;
+	union {
+	    guint32 word;
+	    struct {
+		guchar ch0, ch1, ch2, ch3;
+	    } channels;
+	} sample_pixel;
+
+	for (x=self->width; x; x--) {
+
+	    /* Convert each oversampled input point to a color separately, then
+	     * average the resulting colors using the ch0 through ch3 channel
+	     * accumulators. Note that which channel is which depends on the
+	     * machine's endianness, so we can't name them red, green, blue,
+	     * and alpha here. This can be though of as dividing each pixel into
+	     * and oversample-by-oversample grid of squares and plotting one
+	     * histogram bucket in each, with antialiasing.
 	     */
 
-	    const int sample_stride = (self->width * oversample) - oversample;
-	    const int sample_y_stride = (self->width * oversample) * (oversample - 1);
-	    guint* linearize_table;
-	    guint8* nonlinearize_table;
-	    int sample_x, sample_y;
-	    int ch0, ch1, ch2, ch3;
-	    union {
-		guint32 word;
-		struct {
-		    guchar ch0, ch1, ch2, ch3;
-		} channels;
-	    } sample_pixel;
+	    ch0 = ch1 = ch2 = ch3 = 0;
+	    sample_p = hist_p;
 
-	    histogram_imager_require_oversample_tables (self);
-	    linearize_table = self->oversample_tables.linearize;
-	    nonlinearize_table = self->oversample_tables.nonlinearize;
-
-	    for (y=self->height; y; y--) {
-		for (x=self->width; x; x--) {
-
-		    /* Convert each oversampled input point to a color separately, then
-		     * average the resulting colors using the ch0 through ch3 channel
-		     * accumulators. Note that which channel is which depends on the
-		     * machine's endianness, so we can't name them red, green, blue,
-		     * and alpha here. This can be though of as dividing each pixel into
-		     * and oversample-by-oversample grid of squares and plotting one
-		     * histogram bucket in each, with antialiasing.
-		     */
-
-		    ch0 = ch1 = ch2 = ch3 = 0;
-		    sample_p = hist_p;
-
-		    for (sample_y=oversample; sample_y; sample_y--) {
-			for (sample_x=oversample; sample_x; sample_x--) {
-
-			    count = *(sample_p++);
-			    if (count > hist_clamp)
-				sample_pixel.word = color_table[hist_clamp];
-			    else
-				sample_pixel.word = color_table[count];
-
-			    ch0 += linearize_table[sample_pixel.channels.ch0];
-			    ch1 += linearize_table[sample_pixel.channels.ch1];
-			    ch2 += linearize_table[sample_pixel.channels.ch2];
-			    ch3 += linearize_table[sample_pixel.channels.ch3];
-			}
-			sample_p += sample_stride;
-		    }
-		    hist_p += oversample;
+	    for (sample_y=oversample; sample_y; sample_y--) {
+		for (sample_x=oversample; sample_x; sample_x--) {
+
+		    count = *(sample_p++);
+		    if (count > hist_clamp)
+			sample_pixel.word = color_table[hist_clamp];
+		    else
+			sample_pixel.word = color_table[count];
 
-		    sample_pixel.channels.ch0 = nonlinearize_table[ch0];
-		    sample_pixel.channels.ch1 = nonlinearize_table[ch1];
-		    sample_pixel.channels.ch2 = nonlinearize_table[ch2];
-		    sample_pixel.channels.ch3 = nonlinearize_table[ch3];
-		    *(pixel_p++) = sample_pixel.word;
+		    ch0 += linearize_table[sample_pixel.channels.ch0];
+		    ch1 += linearize_table[sample_pixel.channels.ch1];
+		    ch2 += linearize_table[sample_pixel.channels.ch2];
+		    ch3 += linearize_table[sample_pixel.channels.ch3];
 		}
-		hist_p += sample_y_stride;
+		sample_p += sample_stride;
 	    }
+	    hist_p += oversample;
+
+	    sample_pixel.channels.ch0 = nonlinearize_table[ch0];
+	    sample_pixel.channels.ch1 = nonlinearize_table[ch1];
+	    sample_pixel.channels.ch2 = nonlinearize_table[ch2];
+	    sample_pixel.channels.ch3 = nonlinearize_table[ch3];
+	    *(pixel_p++) = sample_pixel.word;
 	}
-	else {
-	    /* A much simpler and faster loop to use when oversampling is disabled */
+    }
+    else {
+	/* A much simpler and faster loop to use when oversampling is disabled */
+
+	for (x=self->width; x; x--) {
+	    count = *(hist_p++);
+	    if (count > hist_clamp)
+		*(pixel_p++) = color_table[hist_clamp];
+	    else
+		*(pixel_p++) = color_table[count];
+	}
+    }
+}
 
-	    for (y=self->height; y; y--) {
-		for (x=self->width; x; x--) {
-		    count = *(hist_p++);
-		    if (count > hist_clamp)
-			*(pixel_p++) = color_table[hist_clamp];
-		    else
-			*(pixel_p++) = color_table[count];
+static void
+histogram_imager_render_row_deep (HistogramImager *self, guint y, HistogramImagerFormat format, gpointer dest)
+{
+    /* The deep equivalent of histogram_imager_render_row_8. Colors come
+     * from the float color table, which is already linear when we're
+     * oversampling, so averaging is just a sum and one table lookup.
+     * The per-channel loops are simple enough for the compiler to vectorize.
+     */
+    const float* const deep_table = self->color_table.deep_table;
+    const guint oversample = self->oversample;
+    const guint hist_width = self->width * oversample;
+    const guint hist_clamp = self->color_table.filled_size - 1;
+    const float sample_scale = 1.0f / (oversample * oversample);
+    const float* const nonlinearize_table = self->oversample_tables.deep_nonlinearize;
+    guint16 *rgba16 = (guint16*) dest;
+    float *rgbaf = (float*) dest;
+    guint *hist_p, *sample_p;
+    guint count, sample_x, sample_y;
+    const float *entry;
+    float pixel[4];
+    int x, ch;
+
+    hist_p = self->histogram + (gsize) y * oversample * hist_width;
+
+    for (x=self->width; x; x--) {
+	if (oversample > 1) {
+	    float sum[4] = {0, 0, 0, 0};
+
+	    for (sample_y=0; sample_y<oversample; sample_y++) {
+		sample_p = hist_p + sample_y * hist_width;
+		for (sample_x=oversample; sample_x; sample_x--) {
+		    count = *(sample_p++);
+		    entry = deep_table + 4 * MIN(count, hist_clamp);
+		    for (ch=0; ch<4; ch++)
+			sum[ch] += entry[ch];
 		}
 	    }
+	    hist_p += oversample;
+
+	    /* Back to nonlinear, interpolating between table entries */
+	    for (ch=0; ch<4; ch++) {
+		float f = MIN(sum[ch] * sample_scale * HISTOGRAM_IMAGER_DEEP_STEPS,
+			      HISTOGRAM_IMAGER_DEEP_STEPS);
+		int i = MIN((int) f, HISTOGRAM_IMAGER_DEEP_STEPS - 1);
+		pixel[ch] = nonlinearize_table[i] + (f - i) * (nonlinearize_table[i+1] - nonlinearize_table[i]);
+	    }
 	}
+	else {
+	    count = *(hist_p++);
+	    entry = deep_table + 4 * MIN(count, hist_clamp);
+	    for (ch=0; ch<4; ch++)
+		pixel[ch] = entry[ch];
+	}
+
+	if (format == HISTOGRAM_IMAGER_FORMAT_RGBA16) {
+	    for (ch=0; ch<4; ch++)
+		*(rgba16++) = (guint16) (pixel[ch] * 65535.0f + 0.5f);
+	}
+	else {
+	    for (ch=0; ch<4; ch++)
+		*(rgbaf++) = pixel[ch];
+	}
+    }
+}
+
+static void
+histogram_imager_render_block (guint first, guint last, gpointer user_data)
+{
+    HistogramRender *render = (HistogramRender*) user_data;
+    guint i;
+
+    for (i=first; i<last; i++) {
+	gpointer dest = render->pixels + i * render->rowstride;
+
+	if (render->format == HISTOGRAM_IMAGER_FORMAT_RGBA8)
+	    histogram_imager_render_row_8 (render->self, render->first_row + i, (guint32*) dest);
+	else
+	    histogram_imager_render_row_deep (render->self, render->first_row + i, render->format, dest);
     }
 }
 
@@ -834,6 +1201,30 @@ histogram_imager_get_pixel_scale (HistogramImager *self)
     return fscale;
 }
 
+static void
+histogram_imager_count_to_color (HistogramImager *self, double count,
+				 float pixel_scale, double one_over_gamma, float *rgba)
+{
+    /* The color for one histogram count value, shared by all our color tables.
+     * Results are unclamped, with the same 0 to 65535 range as a GdkColor.
+     */
+    float luma;
+
+    /* Scale and gamma-correct */
+    luma = count * pixel_scale;
+    luma = pow(luma, one_over_gamma);
+
+    /* Optionally clamp before interpolating */
+    if (self->clamped && luma > 1)
+	luma = 1;
+
+    /* Linearly interpolate between fgcolor and bgcolor */
+    rgba[0] = self->bgcolor.red   * (1-luma) + self->fgcolor.red   * luma;
+    rgba[1] = self->bgcolor.green * (1-luma) + self->fgcolor.green * luma;
+    rgba[2] = self->bgcolor.blue  * (1-luma) + self->fgcolor.blue  * luma;
+    rgba[3] = self->bgalpha       * (1-luma) + self->fgalpha       * luma;
+}
+
 static void
 histogram_imager_generate_color_table (HistogramImager *self, gboolean force)
 {
@@ -843,7 +1234,7 @@ histogram_imager_generate_color_table (HistogramImager *self, gboolean force)
     guint count;
     float pixel_scale = histogram_imager_get_pixel_scale (self);
     gulong usable_density = histogram_imager_get_max_usable_density (self);
-    float luma;
+    float rgba[4];
     double one_over_gamma = 1/self->gamma;
     float distance = 0;
     gulong color_table_size;
@@ -873,19 +1264,11 @@ histogram_imager_generate_color_table (HistogramImager *self, gboolean force)
      */
     for (count=0; count < self->color_table.filled_size; count++) {
 
-	/* Scale and gamma-correct */
-	luma = count * pixel_scale;
-	luma = pow(luma, one_over_gamma);
-
-	/* Optionally clamp before interpolating */
-	if (self->clamped && luma > 1)
-	    luma = 1;
-
-	/* Linearly interpolate between fgcolor and bgcolor */
-	current.r = ((int)(self->bgcolor.red   * (1-luma) + self->fgcolor.red   * luma)) >> 8;
-	current.g = ((int)(self->bgcolor.green * (1-luma) + self->fgcolor.green * luma)) >> 8;
-	current.b = ((int)(self->bgcolor.blue  * (1-luma) + self->fgcolor.blue  * luma)) >> 8;
-	current.a = ((int)(self->bgalpha       * (1-luma) + self->fgalpha       * luma)) >> 8;
+	histogram_imager_count_to_color (self, count, pixel_scale, one_over_gamma, rgba);
+	current.r = ((int) rgba[0]) >> 8;
+	current.g = ((int) rgba[1]) >> 8;
+	current.b = ((int) rgba[2]) >> 8;
+	current.a = ((int) rgba[3]) >> 8;
 
 	/* Always clamp color components */
 	if (current.r<0) current.r = 0;  if (current.r>255) current.r = 255;
@@ -911,7 +1294,7 @@ histogram_imager_generate_color_table (HistogramImager *self, gboolean force)
 	 * the current count divided by its corresponding distance.
 	 */
 	if (distance > 0) {
-	    self->color_table.quality[count] = count / distance;
+	    self->color_table.quality[count] = count / self->decay.weight / distance;
 	}
 	else {
 	    /* We shouldn't ever use quality entries where the distance
@@ -922,6 +1305,56 @@ histogram_imager_generate_color_table (HistogramImager *self, gboolean force)
     }
 }
 
+static void
+histogram_imager_generate_deep_table (HistogramImager *self)
+{
+    /* Fill in the float color table, with the same entries as the 8-bit
+     * table generated above. This must run after histogram_imager_generate_color_table.
+     * When oversampling, colors are stored linearized so that the renderer
+     * can average them directly, and the table to undo that is kept
+     * up to date here too.
+     */
+    guint count, i;
+    int ch;
+    float pixel_scale = histogram_imager_get_pixel_scale (self);
+    double one_over_gamma = 1/self->gamma;
+    gboolean linearize = self->oversample > 1;
+    float rgba[4];
+    float *entry;
+
+    if (self->color_table.deep_allocated_size < self->color_table.allocated_size) {
+	if (self->color_table.deep_table)
+	    g_free (self->color_table.deep_table);
+	self->color_table.deep_allocated_size = self->color_table.allocated_size;
+	self->color_table.deep_table = g_new (float, 4 * self->color_table.deep_allocated_size);
+    }
+
+    entry = self->color_table.deep_table;
+    for (count=0; count < self->color_table.filled_size; count++) {
+	histogram_imager_count_to_color (self, count, pixel_scale, one_over_gamma, rgba);
+
+	for (ch=0; ch<4; ch++) {
+	    float c = rgba[ch] / 65535.0f;
+	    c = CLAMP(c, 0.0f, 1.0f);
+	    if (linearize)
+		c = pow(c, self->oversample_gamma);
+	    *(entry++) = c;
+	}
+    }
+
+    if (linearize && (!self->oversample_tables.deep_nonlinearize ||
+		      self->oversample_tables.deep_gamma != self->oversample_gamma)) {
+	/* One extra entry, so the renderer can always interpolate to i+1 */
+	double inv_gamma = 1/self->oversample_gamma;
+
+	if (!self->oversample_tables.deep_nonlinearize)
+	    self->oversample_tables.deep_nonlinearize = g_new (float, HISTOGRAM_IMAGER_DEEP_STEPS + 1);
+	for (i=0; i<=HISTOGRAM_IMAGER_DEEP_STEPS; i++)
+	    self->oversample_tables.deep_nonlinearize[i] = pow(i / (double) HISTOGRAM_IMAGER_DEEP_STEPS, inv_gamma);
+	self->oversample_tables.deep_gamma = self->oversample_gamma;
+    }
+}
+
 static gulong
 histogram_imager_get_max_usable_density (HistogramImager *self)
 {
@@ -1086,150 +1519,712 @@ histogram_imager_compute_quality (HistogramImager *self)
 /***************************************************************** Stream Buffering */
 /************************************************************************************/
 
+/* Stream VByte streams begin with a zero byte, then a version number */
+#define HISTOGRAM_STREAM_VBYTE_VERSION   2
+#define HISTOGRAM_STREAM_HEADER_SIZE     2
+
+/* Maximum number of tokens in each stream VByte block. Each block
+ * starts with its token count, as a 16-bit little-endian integer.
+ */
+#define HISTOGRAM_STREAM_BLOCK_TOKENS    2048
+#define HISTOGRAM_STREAM_BLOCK_HEADER    2
+
+typedef struct {
+    HistogramStreamFormat format;
+    guchar *output_p;
+    gssize output_remaining;
+
+    /* Tokens waiting to be encoded as a stream VByte block,
+     * and the exact size that block will have once it's written.
+     */
+    guint32 tokens[HISTOGRAM_STREAM_BLOCK_TOKENS];
+    guint n_tokens;
+    gsize block_size;
+} HistogramStreamWriter;
+
+static void
+histogram_stream_flush (HistogramStreamWriter *w)
+{
+    if (!w->n_tokens)
+	return;
+
+    w->output_p[0] = w->n_tokens & 0xFF;
+    w->output_p[1] = w->n_tokens >> 8;
+    stream_vbyte_encode (w->tokens, w->n_tokens, w->output_p + HISTOGRAM_STREAM_BLOCK_HEADER);
+
+    w->output_p += w->block_size;
+    w->output_remaining -= w->block_size;
+    w->n_tokens = 0;
+}
+
+static inline gboolean
+histogram_stream_put (HistogramStreamWriter *w, guint32 token)
+{
+    /* Add one token to the stream, returning FALSE if there's no room */
+
+    gsize size;
+
+    if (w->format == HISTOGRAM_STREAM_VAR_INT) {
+	/* output_remaining already has room for one
+	 * var-int held back, so we never overrun.
+	 */
+	if (w->output_remaining <= 0)
+	    return FALSE;
+	size = var_int_write (w->output_p, token);
+	w->output_p += size;
+	w->output_remaining -= size;
+	return TRUE;
+    }
+
+    if (w->n_tokens)
+	size = w->block_size;
+    else
+	size = HISTOGRAM_STREAM_BLOCK_HEADER;
+    size += stream_vbyte_length (token);
+    if (!(w->n_tokens & 3))
+	size++;
+
+    if ((gssize) size > w->output_remaining)
+	return FALSE;
+
+    w->tokens[w->n_tokens++] = token;
+    w->block_size = size;
+    if (w->n_tokens == HISTOGRAM_STREAM_BLOCK_TOKENS)
+	histogram_stream_flush (w);
+    return TRUE;
+}
+
+struct _HistogramExport {
+    guint *histogram;
+    guint hist_width, hist_height;
+    guint8 *dirty_tiles;
+    guint tiles_width, tiles_height;
+
+    /* The imager's clear_serial when these counts were detached */
+    guint clear_serial;
+
+    /* Set once every count has been exported, leaving only zeroes */
+    gboolean complete;
+
+    /* Set if the imager was resized while these counts were detached.
+     * Whatever is left of them no longer fits, so it's dropped.
+     */
+    gboolean resized;
+};
+
 gsize
 histogram_imager_export_stream (HistogramImager *self,
 				guchar          *buffer,
 				gsize            buffer_size)
+{
+    return histogram_imager_export_stream_format (self, HISTOGRAM_STREAM_VAR_INT,
+						  buffer, buffer_size);
+}
+
+gsize
+histogram_imager_export_stream_format (HistogramImager       *self,
+				       HistogramStreamFormat  format,
+				       guchar                *buffer,
+				       gsize                  buffer_size)
+{
+    /* Export straight from the live histogram */
+    HistogramExport pending;
+
+    histogram_imager_check_dirty_flags(self);
+    histogram_imager_require_histogram(self);
+
+    pending.histogram = self->histogram;
+    pending.hist_width = self->hist_width;
+    pending.hist_height = self->hist_height;
+    pending.dirty_tiles = self->dirty_tiles;
+    pending.tiles_width = self->tiles_width;
+    pending.tiles_height = self->tiles_height;
+
+    return histogram_export_stream (&pending, format, buffer, buffer_size);
+}
+
+gsize
+histogram_export_stream (HistogramExport       *pending,
+			 HistogramStreamFormat  format,
+			 guchar                *buffer,
+			 gsize                  buffer_size)
 {
     /* This encodes the contents of our histogram buffer
      * in a platform-independent and compact format suitable
      * for loading later with histogram_imager_merge_stream().
      *
-     * This format is a form of run-length encoding, using var-int
-     * to store our integers compactly. All numbers are left-shifted
+     * This format is a form of run-length encoding, storing
+     * our integers compactly. All numbers are left-shifted
      * one bit, and the least significant bit indicates meaning.
      * Values with an LSB of 0 indicate a number of buckets to skip,
      * and an LSB of 1 indicates a number of times to increment
-     * the current bucket before skipping it.
+     * the current bucket before skipping it. These tokens are
+     * written either as individual var-ints, or in stream VByte blocks.
+     *
+     * Buckets are still visited in order, but clean tiles are known to be
+     * empty and get skipped without looking at them. Tiles are marked clean
+     * once an entire band of them has been exported.
      */
 
-    guchar *output_p;
-    int output_remaining;
-    gint *hist_p;
-    int hist_remaining;
+    HistogramStreamWriter w;
+    guint *hist_p;
     guint skipped = 0;
-    int bucket;
-    int i;
-
-    histogram_imager_check_dirty_flags(self);
-    histogram_imager_require_histogram(self);
-
-    hist_p = self->histogram;
-    hist_remaining = self->width * self->height *
-	self->oversample * self->oversample;
-
-    output_p = buffer;
-    output_remaining = buffer_size - VAR_INT_MAX_SIZE;
-
-    while (hist_remaining > 0 && output_remaining > 0) {
-	bucket = *hist_p;
-	if (bucket) {
-	    /* We found a non-zero bucket */
-
-	    if (skipped) {
-		/* Output a skip value, if we skipped any
-		 * buckets prior to the current one.
-		 */
-		i = var_int_write (output_p, skipped << 1);
-		output_p += i;
-		output_remaining -= i;
-		if (output_remaining < 0)
-		    break;
-		skipped = 0;
-	    }
+    guint bucket;
+    guint8 *tile_row;
+    guint tile_y, tile_x, y, x, band_rows, tile_cols;
 
-	    /* Output this bucket's value, then clear it */
-	    i = var_int_write (output_p, (bucket << 1) | 1);
-	    output_p += i;
-	    output_remaining -= i;
-	    *hist_p = 0;
-	}
-	else {
-	    skipped++;
-	}
+    pending->complete = FALSE;
+    w.format = format;
+    w.output_p = buffer;
+    w.n_tokens = 0;
 
-	hist_p++;
-	hist_remaining--;
+    if (format == HISTOGRAM_STREAM_VAR_INT) {
+	w.output_remaining = buffer_size - VAR_INT_MAX_SIZE;
+    }
+    else {
+	if (buffer_size < HISTOGRAM_STREAM_HEADER_SIZE)
+	    return 0;
+	*(w.output_p++) = 0;
+	*(w.output_p++) = HISTOGRAM_STREAM_VBYTE_VERSION;
+	w.output_remaining = buffer_size - HISTOGRAM_STREAM_HEADER_SIZE;
     }
 
-    return output_p - buffer;
-}
-
-void
-histogram_imager_merge_stream (HistogramImager *self,
-			       const guchar    *buffer,
-			       gsize            buffer_size)
-{
+    for (tile_y=0; tile_y<pending->tiles_height; tile_y++) {
+	tile_row = pending->dirty_tiles + tile_y * pending->tiles_width;
+	band_rows = MIN(HISTOGRAM_IMAGER_TILE_SIZE,
+			pending->hist_height - (tile_y << HISTOGRAM_IMAGER_TILE_SHIFT));
 
-    /* The inverse of histogram_imager_export_stream(). This follows
-     * the skip/plot instructions in the given buffer, merging the
-     * results with whatever happens to be in the histogram buffer.
-     */
+	for (tile_x=0; tile_x<pending->tiles_width && !tile_row[tile_x]; tile_x++);
+	if (tile_x == pending->tiles_width) {
+	    /* Nothing in this whole band */
+	    skipped += band_rows * pending->hist_width;
+	    continue;
+	}
 
-    const guchar *input_p;
-    gsize input_remaining;
-    gint *hist_p;
-    gsize hist_remaining;
-    guint token, bucket;
-    HistogramPlot plot;
-    int i;
+	for (y=tile_y << HISTOGRAM_IMAGER_TILE_SHIFT; band_rows; y++, band_rows--) {
+	    hist_p = pending->histogram + (gsize) y * pending->hist_width;
 
-    histogram_imager_prepare_plots (self, &plot);
+	    for (tile_x=0; tile_x<pending->tiles_width; tile_x++) {
+		tile_cols = MIN(HISTOGRAM_IMAGER_TILE_SIZE,
+				pending->hist_width - (tile_x << HISTOGRAM_IMAGER_TILE_SHIFT));
 
-    hist_p = self->histogram;
-    hist_remaining = self->width * self->height *
-	self->oversample * self->oversample;
+		if (!tile_row[tile_x]) {
+		    skipped += tile_cols;
+		    hist_p += tile_cols;
+		    continue;
+		}
 
-    input_p = buffer;
-    input_remaining = buffer_size;
+		for (x=tile_cols; x; x--) {
+		    bucket = *hist_p;
+		    if (bucket) {
+			/* We found a non-zero bucket */
+
+			if (skipped) {
+			    /* Output a skip value, if we skipped any
+			     * buckets prior to the current one.
+			     */
+			    if (!histogram_stream_put (&w, skipped << 1))
+				goto out_of_space;
+			    skipped = 0;
+			}
 
-    while (hist_remaining > 0 && input_remaining > 0) {
-	i = var_int_read (input_p, &token);
-	input_p += i;
-	input_remaining -= i;
-
-	if (token & 1) {
-	    /* Plot into the current bucket */
-
-	    token >>= 1;
-	    plot.plot_count += token;
-	    bucket = *hist_p;
-	    bucket += token;
-	    *hist_p = bucket;
-	    if (bucket > plot.density)
-		plot.density = bucket;
-	    hist_p++;
+			/* Output this bucket's value, then clear it */
+			if (!histogram_stream_put (&w, (bucket << 1) | 1))
+			    goto out_of_space;
+			*hist_p = 0;
+		    }
+		    else {
+			skipped++;
+		    }
+		    hist_p++;
+		}
+	    }
 	}
-	else {
-	    /* Skip buckets */
 
-	    token >>= 1;
-	    hist_p += token;
-	}
+	/* Everything in this band has been exported */
+	memset (tile_row, 0, pending->tiles_width);
     }
+    pending->complete = TRUE;
 
-    histogram_imager_finish_plots (self, &plot);
+ out_of_space:
+    if (format != HISTOGRAM_STREAM_VAR_INT)
+	histogram_stream_flush (&w);
+    return w.output_p - buffer;
 }
 
 
 /************************************************************************************/
-/************************************************************************ Utilities */
+/***************************************************************** Export Buffering */
 /************************************************************************************/
 
 static void
-histogram_imager_check_dirty_flags (HistogramImager *self)
+histogram_export_free (HistogramExport *pending)
 {
-    /* Check dirty flags, invalidating stale data */
+    g_free (pending->histogram);
+    g_free (pending->dirty_tiles);
+    g_free (pending);
+}
 
-    if (self->size_dirty_flag) {
-	/* We've resized. Deallocate the histogram and image
-	 * if they've been allocated, and set the render and
-	 * calc dirty flags.
+HistogramExport*
+histogram_imager_detach_export (HistogramImager *self)
+{
+    HistogramExport *pending = self->export_spare;
+    guint *histogram;
+    guint8 *dirty_tiles;
+
+    g_return_val_if_fail (!self->export_detached, NULL);
+
+    histogram_imager_check_dirty_flags (self);
+    histogram_imager_require_histogram (self);
+    self->export_detached = TRUE;
+
+    if (pending && (pending->hist_width != self->hist_width ||
+		    pending->hist_height != self->hist_height)) {
+	histogram_export_free (pending);
+	pending = NULL;
+	self->export_spare = NULL;
+    }
+
+    /* Send what's left of the last export before starting on anything new */
+    if (pending && !pending->complete)
+	return pending;
+
+    if (!pending) {
+	/* Our first export at this size. A new buffer is empty, just like
+	 * one that's been completely exported.
 	 */
-	if (self->histogram) {
-	    g_free (self->histogram);
-	    self->histogram = NULL;
+	pending = g_new0 (HistogramExport, 1);
+	pending->hist_width = self->hist_width;
+	pending->hist_height = self->hist_height;
+	pending->tiles_width = self->tiles_width;
+	pending->tiles_height = self->tiles_height;
+	pending->histogram = g_malloc0 (sizeof (pending->histogram[0]) *
+					pending->hist_width * pending->hist_height);
+	pending->dirty_tiles = g_malloc0 (pending->tiles_width * pending->tiles_height);
+	self->export_spare = pending;
+    }
+
+    histogram = pending->histogram;
+    dirty_tiles = pending->dirty_tiles;
+    pending->histogram = self->histogram;
+    pending->dirty_tiles = self->dirty_tiles;
+    self->histogram = histogram;
+    self->dirty_tiles = dirty_tiles;
+
+    pending->clear_serial = self->clear_serial;
+    pending->complete = FALSE;
+    pending->resized = FALSE;
+    return pending;
+}
+
+void
+histogram_imager_attach_export (HistogramImager *self,
+				HistogramExport *pending)
+{
+    g_return_if_fail (self->export_detached && pending == self->export_spare);
+    self->export_detached = FALSE;
+
+    /* Anything that didn't fit belongs to a histogram we've since
+     * cleared or resized
+     */
+    if (pending->resized || (!pending->complete && pending->clear_serial != self->clear_serial)) {
+	histogram_export_free (pending);
+	self->export_spare = NULL;
+    }
+}
+
+void
+histogram_imager_drop_export (HistogramImager *self,
+			      HistogramExport *pending)
+{
+    /* Attach an export and throw away whatever is left in it */
+    g_return_if_fail (self->export_detached && pending == self->export_spare);
+    self->export_detached = FALSE;
+    histogram_export_free (pending);
+    self->export_spare = NULL;
+}
+
+gboolean
+histogram_export_add (HistogramExport *pending,
+		      HistogramBuffer *dest)
+{
+    /* Add every dirty tile of the export to 'dest', emptying it as we
+     * go. Each row of a tile is a short run of buckets with no branches,
+     * which the compiler can vectorize.
+     */
+    guint tile_y, tile_x, y, x, rows, cols;
+    guint *src_p, *dest_p;
+    gsize offset;
+
+    if (pending->hist_width != dest->hist_width || pending->hist_height != dest->hist_height)
+	return FALSE;
+
+    for (tile_y=0; tile_y<pending->tiles_height; tile_y++) {
+	rows = MIN(HISTOGRAM_IMAGER_TILE_SIZE,
+		   pending->hist_height - (tile_y << HISTOGRAM_IMAGER_TILE_SHIFT));
+
+	for (tile_x=0; tile_x<pending->tiles_width; tile_x++) {
+	    if (!pending->dirty_tiles[tile_y * pending->tiles_width + tile_x])
+		continue;
+	    cols = MIN(HISTOGRAM_IMAGER_TILE_SIZE,
+		       pending->hist_width - (tile_x << HISTOGRAM_IMAGER_TILE_SHIFT));
+
+	    for (y=0; y<rows; y++) {
+		offset = ((gsize) (tile_y << HISTOGRAM_IMAGER_TILE_SHIFT) + y) * pending->hist_width +
+		    (tile_x << HISTOGRAM_IMAGER_TILE_SHIFT);
+		src_p = pending->histogram + offset;
+		dest_p = dest->histogram + offset;
+		for (x=0; x<cols; x++) {
+		    dest_p[x] += src_p[x];
+		    src_p[x] = 0;
+		}
+	    }
+
+	    pending->dirty_tiles[tile_y * pending->tiles_width + tile_x] = 0;
+	    dest->dirty_tiles[tile_y * dest->tiles_width + tile_x] = 1;
+	}
+    }
+
+    pending->complete = TRUE;
+    return TRUE;
+}
+
+void
+histogram_imager_merge_buffer (HistogramImager *self,
+			       HistogramBuffer *source)
+{
+    /* The in-memory equivalent of histogram_imager_merge_stream(). Buffers
+     * of the wrong size belong to some other set of parameters, so their
+     * counts are just thrown away.
+     */
+    guint tile_y, tile_x, y, x, rows, cols;
+    guint *src_p, *dest_p;
+    guint value, bucket;
+    gulong count = 0;
+    gsize offset;
+    HistogramPlot plot;
+
+    histogram_imager_prepare_plots (self, &plot);
+
+    if (source->hist_width != self->hist_width || source->hist_height != self->hist_height) {
+	histogram_buffer_clear (source);
+	return;
+    }
+
+    for (tile_y=0; tile_y<source->tiles_height; tile_y++) {
+	rows = MIN(HISTOGRAM_IMAGER_TILE_SIZE,
+		   source->hist_height - (tile_y << HISTOGRAM_IMAGER_TILE_SHIFT));
+
+	for (tile_x=0; tile_x<source->tiles_width; tile_x++) {
+	    if (!source->dirty_tiles[tile_y * source->tiles_width + tile_x])
+		continue;
+	    cols = MIN(HISTOGRAM_IMAGER_TILE_SIZE,
+		       source->hist_width - (tile_x << HISTOGRAM_IMAGER_TILE_SHIFT));
+
+	    for (y=0; y<rows; y++) {
+		offset = ((gsize) (tile_y << HISTOGRAM_IMAGER_TILE_SHIFT) + y) * source->hist_width +
+		    (tile_x << HISTOGRAM_IMAGER_TILE_SHIFT);
+		src_p = source->histogram + offset;
+		dest_p = plot.histogram + offset;
+		for (x=0; x<cols; x++) {
+		    value = src_p[x];
+		    bucket = dest_p[x] + value * plot.weight;
+		    dest_p[x] = bucket;
+		    count += value;
+		    plot.density = MAX(plot.density, bucket);
+		    src_p[x] = 0;
+		}
+	    }
+
+	    source->dirty_tiles[tile_y * source->tiles_width + tile_x] = 0;
+	    plot.dirty_tiles[tile_y * plot.tiles_width + tile_x] = 1;
+	}
+    }
+
+    plot.plot_count = count;
+    histogram_imager_finish_plots (self, &plot);
+}
+
+static void
+histogram_buffer_add_preview (const HistogramBuffer *source,
+			      guint32               *preview,
+			      guint                  width,
+			      guint                  height)
+{
+    /* Block-sum a histogram down to a width x height preview, adding
+     * to whatever is there already. Clean tiles never hold any counts,
+     * so only the dirty ones need to be read.
+     */
+    guint tile_y, tile_x, y, x, rows, cols, hist_y, hist_x;
+    guint32 *preview_row;
+    guint *hist_row;
+    guint *column_map;
+
+    column_map = g_new (guint, source->hist_width);
+    for (x=0; x<source->hist_width; x++)
+	column_map[x] = (guint) (((guint64) x * width) / source->hist_width);
+
+    for (tile_y=0; tile_y<source->tiles_height; tile_y++) {
+	rows = MIN(HISTOGRAM_IMAGER_TILE_SIZE,
+		   source->hist_height - (tile_y << HISTOGRAM_IMAGER_TILE_SHIFT));
+
+	for (tile_x=0; tile_x<source->tiles_width; tile_x++) {
+	    if (!source->dirty_tiles[tile_y * source->tiles_width + tile_x])
+		continue;
+	    cols = MIN(HISTOGRAM_IMAGER_TILE_SIZE,
+		       source->hist_width - (tile_x << HISTOGRAM_IMAGER_TILE_SHIFT));
+
+	    for (y=0; y<rows; y++) {
+		hist_y = (tile_y << HISTOGRAM_IMAGER_TILE_SHIFT) + y;
+		hist_x = tile_x << HISTOGRAM_IMAGER_TILE_SHIFT;
+		hist_row = source->histogram + (gsize) hist_y * source->hist_width;
+		preview_row = preview + (gsize) (((guint64) hist_y * height) / source->hist_height) * width;
+		for (x=hist_x; x<hist_x + cols; x++)
+		    preview_row[column_map[x]] += hist_row[x];
+	    }
+	}
+    }
+
+    g_free (column_map);
+}
+
+void
+histogram_imager_add_preview (HistogramImager *self,
+			      guint32         *preview,
+			      guint            width,
+			      guint            height)
+{
+    HistogramExport *pending = self->export_spare;
+    HistogramBuffer source;
+
+    if (!self->histogram)
+	return;
+
+    source.histogram = self->histogram;
+    source.dirty_tiles = self->dirty_tiles;
+    source.hist_width = self->hist_width;
+    source.hist_height = self->hist_height;
+    source.tiles_width = self->tiles_width;
+    source.tiles_height = self->tiles_height;
+    histogram_buffer_add_preview (&source, preview, width, height);
+
+    /* Counts in the export spare haven't been sent yet either. If it's
+     * detached, it's being encoded while we read it, so each bucket may
+     * or may not have gone out already. That's close enough for a preview.
+     */
+    if (pending && !pending->complete && !pending->resized &&
+	pending->clear_serial == self->clear_serial &&
+	pending->hist_width == self->hist_width && pending->hist_height == self->hist_height) {
+	source.histogram = pending->histogram;
+	source.dirty_tiles = pending->dirty_tiles;
+	source.tiles_width = pending->tiles_width;
+	source.tiles_height = pending->tiles_height;
+	histogram_buffer_add_preview (&source, preview, width, height);
+    }
+}
+
+HistogramBuffer*
+histogram_buffer_new (guint hist_width,
+		      guint hist_height)
+{
+    HistogramBuffer *buffer = g_new0 (HistogramBuffer, 1);
+
+    buffer->hist_width = hist_width;
+    buffer->hist_height = hist_height;
+    buffer->tiles_width = (hist_width + HISTOGRAM_IMAGER_TILE_SIZE - 1) >> HISTOGRAM_IMAGER_TILE_SHIFT;
+    buffer->tiles_height = (hist_height + HISTOGRAM_IMAGER_TILE_SIZE - 1) >> HISTOGRAM_IMAGER_TILE_SHIFT;
+    buffer->histogram = g_new0 (guint, (gsize) hist_width * hist_height);
+    buffer->dirty_tiles = g_new0 (guint8, (gsize) buffer->tiles_width * buffer->tiles_height);
+
+    return buffer;
+}
+
+void
+histogram_buffer_free (HistogramBuffer *buffer)
+{
+    g_free (buffer->histogram);
+    g_free (buffer->dirty_tiles);
+    g_free (buffer);
+}
+
+void
+histogram_buffer_clear (HistogramBuffer *buffer)
+{
+    guint tile_y, tile_x, y, rows, cols;
+
+    for (tile_y=0; tile_y<buffer->tiles_height; tile_y++) {
+	rows = MIN(HISTOGRAM_IMAGER_TILE_SIZE,
+		   buffer->hist_height - (tile_y << HISTOGRAM_IMAGER_TILE_SHIFT));
+
+	for (tile_x=0; tile_x<buffer->tiles_width; tile_x++) {
+	    if (!buffer->dirty_tiles[tile_y * buffer->tiles_width + tile_x])
+		continue;
+	    cols = MIN(HISTOGRAM_IMAGER_TILE_SIZE,
+		       buffer->hist_width - (tile_x << HISTOGRAM_IMAGER_TILE_SHIFT));
+
+	    for (y=0; y<rows; y++)
+		memset (buffer->histogram +
+			((gsize) (tile_y << HISTOGRAM_IMAGER_TILE_SHIFT) + y) * buffer->hist_width +
+			(tile_x << HISTOGRAM_IMAGER_TILE_SHIFT),
+			0, cols * sizeof (buffer->histogram[0]));
+	    buffer->dirty_tiles[tile_y * buffer->tiles_width + tile_x] = 0;
 	}
+    }
+}
+
+static inline void
+histogram_stream_merge_token (HistogramPlot   *plot,
+			      gsize           *index,
+			      guint            token)
+{
+    guint bucket, y, x;
+
+    if (token & 1) {
+	/* Plot into the current bucket */
+
+	token >>= 1;
+	plot->plot_count += token;
+	bucket = plot->histogram[*index];
+	bucket += token * plot->weight;
+	plot->histogram[*index] = bucket;
+	if (bucket > plot->density)
+	    plot->density = bucket;
+
+	y = *index / plot->hist_width;
+	x = *index - (gsize) y * plot->hist_width;
+	plot->dirty_tiles[(y >> HISTOGRAM_IMAGER_TILE_SHIFT) * plot->tiles_width +
+			  (x >> HISTOGRAM_IMAGER_TILE_SHIFT)] = 1;
+	(*index)++;
+    }
+    else {
+	/* Skip buckets */
+
+	token >>= 1;
+	*index += token;
+    }
+}
+
+static void
+histogram_stream_merge (HistogramPlot   *plot,
+			gsize            n_buckets,
+			const guchar    *buffer,
+			gsize            buffer_size)
+{
+    /* Follow the skip/plot instructions in a stream, adding them to
+     * the plot's histogram. Stream VByte blocks are decoded a whole
+     * block at a time before their tokens are merged.
+     */
+
+    const guchar *input_p;
+    gsize input_remaining;
+    gsize index, size;
+    guint32 tokens[HISTOGRAM_STREAM_BLOCK_TOKENS];
+    guint token, n_tokens, t;
+    int i;
+
+    index = 0;
+
+    input_p = buffer;
+    input_remaining = buffer_size;
+
+    if (input_remaining >= HISTOGRAM_STREAM_HEADER_SIZE && input_p[0] == 0) {
+	/* Stream VByte blocks. Ignore versions we don't understand. */
+
+	if (input_p[1] == HISTOGRAM_STREAM_VBYTE_VERSION) {
+	    input_p += HISTOGRAM_STREAM_HEADER_SIZE;
+	    input_remaining -= HISTOGRAM_STREAM_HEADER_SIZE;
+	}
+	else {
+	    input_remaining = 0;
+	}
+
+	while (index < n_buckets && input_remaining > HISTOGRAM_STREAM_BLOCK_HEADER) {
+	    n_tokens = input_p[0] | (input_p[1] << 8);
+	    if (n_tokens > HISTOGRAM_STREAM_BLOCK_TOKENS)
+		break;
+
+	    size = stream_vbyte_decode (input_p + HISTOGRAM_STREAM_BLOCK_HEADER,
+					input_remaining - HISTOGRAM_STREAM_BLOCK_HEADER,
+					tokens, n_tokens);
+	    if (!size)
+		break;
+	    input_p += HISTOGRAM_STREAM_BLOCK_HEADER + size;
+	    input_remaining -= HISTOGRAM_STREAM_BLOCK_HEADER + size;
+
+	    for (t=0; t<n_tokens && index < n_buckets; t++)
+		histogram_stream_merge_token (plot, &index, tokens[t]);
+	}
+    }
+    else {
+	/* One var-int per token */
+
+	while (index < n_buckets && input_remaining > 0) {
+	    i = var_int_read (input_p, &token);
+	    input_p += i;
+	    input_remaining -= i;
+
+	    histogram_stream_merge_token (plot, &index, token);
+	}
+    }
+}
+
+void
+histogram_imager_merge_stream (HistogramImager *self,
+			       const guchar    *buffer,
+			       gsize            buffer_size)
+{
+    /* The inverse of histogram_imager_export_stream(). This follows
+     * the skip/plot instructions in the given buffer, merging the
+     * results with whatever happens to be in the histogram buffer.
+     */
+    HistogramPlot plot;
+
+    histogram_imager_prepare_plots (self, &plot);
+    histogram_stream_merge (&plot, (gsize) self->hist_width * self->hist_height,
+			    buffer, buffer_size);
+    histogram_imager_finish_plots (self, &plot);
+}
+
+gulong
+histogram_buffer_merge_stream (HistogramBuffer *dest,
+			       const guchar    *buffer,
+			       gsize            buffer_size)
+{
+    /* The same, for a bare buffer. It has no decay to apply, so
+     * every count is worth one sample.
+     */
+    HistogramPlot plot;
+
+    plot.histogram = dest->histogram;
+    plot.hist_width = dest->hist_width;
+    plot.dirty_tiles = dest->dirty_tiles;
+    plot.tiles_width = dest->tiles_width;
+    plot.density = 0;
+    plot.weight = 1;
+    plot.plot_count = 0;
+
+    histogram_stream_merge (&plot, (gsize) dest->hist_width * dest->hist_height,
+			    buffer, buffer_size);
+    return plot.plot_count;
+}
+
+
+/************************************************************************************/
+/************************************************************************ Utilities */
+/************************************************************************************/
+
+static void
+histogram_imager_check_dirty_flags (HistogramImager *self)
+{
+    /* Check dirty flags, invalidating stale data */
+
+    if (self->size_dirty_flag) {
+	/* We've resized. Resample the histogram into its new
+	 * size so we don't lose the work that went into it,
+	 * deallocate the image, and set the render dirty flag.
+	 */
+	if (self->histogram)
+	    histogram_imager_resample_histogram (self);
 	if (self->image) {
 	    gdk_pixbuf_unref (self->image);
 	    self->image = NULL;
@@ -1245,27 +2240,61 @@ histogram_imager_require_histogram (HistogramImager *self)
 {
     /* Allocate a histogram if we don't have one already */
     if (!self->histogram) {
+	self->hist_width = self->width * self->oversample;
+	self->hist_height = self->height * self->oversample;
 	self->histogram = g_malloc (sizeof (self->histogram[0]) *
-				    self->width * self->height *
-				    self->oversample * self->oversample);
+				    self->hist_width * self->hist_height);
 	histogram_imager_clear (self);
     }
 }
 
+static void
+histogram_imager_reset_dirty_tiles (HistogramImager *self, gboolean dirty)
+{
+    /* Size the dirty tile map to match the histogram, and mark every
+     * tile as either dirty or clean.
+     */
+    guint tiles_width = (self->hist_width + HISTOGRAM_IMAGER_TILE_SIZE - 1) >> HISTOGRAM_IMAGER_TILE_SHIFT;
+    guint tiles_height = (self->hist_height + HISTOGRAM_IMAGER_TILE_SIZE - 1) >> HISTOGRAM_IMAGER_TILE_SHIFT;
+
+    if (!self->dirty_tiles || tiles_width != self->tiles_width || tiles_height != self->tiles_height) {
+	g_free (self->dirty_tiles);
+	self->tiles_width = tiles_width;
+	self->tiles_height = tiles_height;
+	self->dirty_tiles = g_malloc (tiles_width * tiles_height);
+    }
+    memset (self->dirty_tiles, dirty ? 1 : 0, tiles_width * tiles_height);
+}
+
 void
 histogram_imager_clear (HistogramImager *self)
 {
+    /* No sense resampling a histogram we're about to clear */
+    if (self->size_dirty_flag && self->histogram) {
+	g_free (self->histogram);
+	self->histogram = NULL;
+    }
     histogram_imager_check_dirty_flags (self);
     if (self->histogram) {
 	memset (self->histogram, 0, sizeof (self->histogram[0]) *
 	        self->width * self->height *
 	        self->oversample * self->oversample);
+	histogram_imager_reset_dirty_tiles (self, FALSE);
     }
     self->histogram_clear_flag = TRUE;
     self->render_dirty_flag = TRUE;
+    self->clear_serial++;
+    if (self->export_spare && !self->export_detached && !self->export_spare->complete) {
+	histogram_export_free (self->export_spare);
+	self->export_spare = NULL;
+    }
     self->total_points_plotted = 0;
     self->peak_density = 0;
     g_get_current_time (&self->render_start_time);
+
+    /* With nothing left to decay, start over at the base weight */
+    self->decay.weight = self->decay_half_life > 0 ? HISTOGRAM_IMAGER_DECAY_BASE_WEIGHT : 1;
+    self->decay.last_time = self->render_start_time;
 }
 
 gdouble
@@ -1344,4 +2373,412 @@ histogram_imager_require_oversample_tables (HistogramImager *self)
     }
 }
 
+
+
+/************************************************************************************/
+/*********************************************************************** Resampling */
+/************************************************************************************/
+
+typedef struct {
+    const guint *src;
+    guint src_width, src_height;
+    guint *dest;
+    guint dest_width, dest_height;
+    guint *temp;
+
+    /* Block-sum reduction factor, or zero for general resampling */
+    guint factor;
+
+    /* For general resampling, destination bucket = source bucket * scale + offset */
+    double x_scale, x_offset;
+    double y_scale, y_offset;
+} HistogramResample;
+
+static void
+histogram_resample_line (const guint *src, gsize src_stride, guint src_len,
+			 guint *dest, gsize dest_stride, guint dest_len,
+			 double scale, double offset)
+{
+    /* Resample one row or column of counts. Each destination bucket gets the
+     * share of every source bucket proportional to how much they overlap.
+     * Since counts are integers, the rounding error is carried along the line
+     * and the remainder lands in the last bucket touched, so the total count
+     * is preserved exactly. Counts that fall outside the destination are lost.
+     */
+    double error = 0;
+    gboolean touched = FALSE;
+    guint i, last = 0;
+    int j;
+
+    for (i=0; i<dest_len; i++)
+	dest[i * dest_stride] = 0;
+
+    for (i=0; i<src_len; i++) {
+	guint count = src[i * src_stride];
+	double x0, x1;
+
+	if (!count)
+	    continue;
+
+	x0 = i * scale + offset;
+	x1 = x0 + scale;
+
+	for (j = MAX(0, (int) floor(x0)); j < (int) dest_len && j < x1; j++) {
+	    double exact = count * (MIN(x1, j + 1) - MAX(x0, j)) / scale + error;
+	    guint n = (guint) exact;
+	    error = exact - n;
+	    dest[j * dest_stride] += n;
+	    last = j;
+	    touched = TRUE;
+	}
+    }
+
+    if (touched)
+	dest[last * dest_stride] += (guint) (error + 0.5);
+}
+
+static void
+histogram_resample_rows (guint first, guint last, gpointer user_data)
+{
+    /* First pass: resample each source row horizontally into 'temp' */
+    HistogramResample *r = (HistogramResample*) user_data;
+    guint y;
+
+    for (y=first; y<last; y++)
+	histogram_resample_line (r->src + (gsize) y * r->src_width, 1, r->src_width,
+				 r->temp + (gsize) y * r->dest_width, 1, r->dest_width,
+				 r->x_scale, r->x_offset);
+}
+
+static void
+histogram_resample_columns (guint first, guint last, gpointer user_data)
+{
+    /* Second pass: resample each column of 'temp' vertically into the destination */
+    HistogramResample *r = (HistogramResample*) user_data;
+    guint x;
+
+    for (x=first; x<last; x++)
+	histogram_resample_line (r->temp + x, r->dest_width, r->src_height,
+				 r->dest + x, r->dest_width, r->dest_height,
+				 r->y_scale, r->y_offset);
+}
+
+static void
+histogram_block_sum_rows (guint first, guint last, gpointer user_data)
+{
+    /* Exact reduction by an integer factor: each destination
+     * bucket is the sum of a factor-by-factor block of sources.
+     */
+    HistogramResample *r = (HistogramResample*) user_data;
+    const guint factor = r->factor;
+    guint x, y, sample_x, sample_y;
+
+    for (y=first; y<last; y++) {
+	guint *dest_p = r->dest + (gsize) y * r->dest_width;
+	const guint *row = r->src + (gsize) y * factor * r->src_width;
+
+	for (x=r->dest_width; x; x--) {
+	    const guint *sample_p = row;
+	    guint sum = 0;
+
+	    for (sample_y=factor; sample_y; sample_y--) {
+		for (sample_x=0; sample_x<factor; sample_x++)
+		    sum += sample_p[sample_x];
+		sample_p += r->src_width;
+	    }
+	    *(dest_p++) = sum;
+	    row += factor;
+	}
+    }
+}
+
+static void
+histogram_resample (HistogramResample *r)
+{
+    /* Fill r->dest from r->src. When the destination is smaller by the same
+     * integer factor in both directions, this is an exact block sum and the
+     * scales and offsets are ignored. Anything else goes through both passes
+     * of the general resample, using a temporary buffer with the new width
+     * and the old height.
+     */
+    r->factor = r->src_width / r->dest_width;
+
+    if (r->factor > 1 &&
+	r->src_width == r->factor * r->dest_width &&
+	r->src_height == r->factor * r->dest_height) {
+
+	parallel_for (r->dest_height, parallel_block_size (r->dest_height, 8),
+		      histogram_block_sum_rows, r);
+    }
+    else {
+	r->temp = g_malloc (sizeof (r->temp[0]) * r->dest_width * r->src_height);
+	parallel_for (r->src_height, parallel_block_size (r->src_height, 8),
+		      histogram_resample_rows, r);
+	parallel_for (r->dest_width, parallel_block_size (r->dest_width, 8),
+		      histogram_resample_columns, r);
+	g_free (r->temp);
+    }
+}
+
+static void
+histogram_resample_set_geometry (HistogramResample *r, gboolean stretch)
+{
+    /* Scale to the new width. Stretched plots scale to the new height
+     * separately, anything else keeps its aspect ratio and stays centered.
+     */
+    r->x_scale = ((double) r->dest_width) / r->src_width;
+    r->x_offset = 0;
+    if (stretch) {
+	r->y_scale = ((double) r->dest_height) / r->src_height;
+	r->y_offset = 0;
+    }
+    else {
+	r->y_scale = r->x_scale;
+	r->y_offset = (r->dest_height - r->src_height * r->y_scale) / 2;
+    }
+}
+
+static void
+histogram_imager_update_totals (HistogramImager *self)
+{
+    /* Recount the total and peak after replacing the histogram wholesale */
+    guint *hist_p = self->histogram;
+    gsize i;
+    gdouble total = 0;
+    gulong peak = 0;
+
+    for (i=(gsize) self->hist_width * self->hist_height; i; i--) {
+	guint count = *(hist_p++);
+	total += count;
+	if (count > peak)
+	    peak = count;
+    }
+    self->total_points_plotted = total;
+    self->peak_density = peak;
+}
+
+static void
+histogram_imager_resample_histogram (HistogramImager *self)
+{
+    /* Replace our histogram with one resampled to the current size and
+     * oversampling. When the number of buckets goes down by an integer
+     * factor (lower oversampling at the same size, for example) this is an
+     * exact block sum. Anything else uses a count-preserving resample.
+     * Either way, calculation can continue right where it left off.
+     */
+    HistogramResample r;
+
+    r.src = self->histogram;
+    r.src_width = self->hist_width;
+    r.src_height = self->hist_height;
+    r.dest_width = self->width * self->oversample;
+    r.dest_height = self->height * self->oversample;
+
+    /* Different width, height, and oversample but the same buckets. Easy. */
+    if (r.src_width == r.dest_width && r.src_height == r.dest_height)
+	return;
+
+    /* Counts still waiting to be exported are at the old size too. If
+     * the spare is ours, fold them back in so they're resampled with
+     * everything else. If it's detached, it can't be touched until it's
+     * attached again, so what's left of it is dropped then.
+     */
+    if (self->export_spare) {
+	if (self->export_detached) {
+	    self->export_spare->resized = TRUE;
+	}
+	else {
+	    if (!self->export_spare->complete &&
+		self->export_spare->clear_serial == self->clear_serial) {
+		HistogramBuffer live;
+
+		live.histogram = self->histogram;
+		live.dirty_tiles = self->dirty_tiles;
+		live.hist_width = self->hist_width;
+		live.hist_height = self->hist_height;
+		live.tiles_width = self->tiles_width;
+		live.tiles_height = self->tiles_height;
+		histogram_export_add (self->export_spare, &live);
+	    }
+	    histogram_export_free (self->export_spare);
+	    self->export_spare = NULL;
+	}
+    }
+
+    r.dest = g_malloc (sizeof (r.dest[0]) * r.dest_width * r.dest_height);
+    histogram_resample_set_geometry (&r, HISTOGRAM_IMAGER_CLASS (G_OBJECT_GET_CLASS (self))->resize_stretches);
+    histogram_resample (&r);
+
+    g_free (self->histogram);
+    self->histogram = r.dest;
+    self->hist_width = r.dest_width;
+    self->hist_height = r.dest_height;
+
+    /* Counts may have been cropped off, and block sums raise the peak */
+    histogram_imager_update_totals (self);
+    histogram_imager_reset_dirty_tiles (self, TRUE);
+}
+
+void
+histogram_imager_load_histogram (HistogramImager *self, HistogramImager *source)
+{
+    /* Resample source's histogram into ours, the same way source would
+     * resample itself if it were resized to our size and oversampling.
+     */
+    HistogramResample r;
+
+    histogram_imager_check_dirty_flags (source);
+    histogram_imager_require_histogram (source);
+    histogram_imager_check_dirty_flags (self);
+    histogram_imager_require_histogram (self);
+
+    r.src = source->histogram;
+    r.src_width = source->hist_width;
+    r.src_height = source->hist_height;
+    r.dest = self->histogram;
+    r.dest_width = self->hist_width;
+    r.dest_height = self->hist_height;
+
+    if (r.src_width == r.dest_width && r.src_height == r.dest_height) {
+	memcpy (r.dest, r.src, sizeof (r.dest[0]) * r.dest_width * r.dest_height);
+    }
+    else {
+	histogram_resample_set_geometry (&r, HISTOGRAM_IMAGER_CLASS (G_OBJECT_GET_CLASS (source))->resize_stretches);
+	histogram_resample (&r);
+    }
+
+    self->decay.weight = source->decay.weight;
+    self->render_dirty_flag = TRUE;
+    histogram_imager_update_totals (self);
+    histogram_imager_reset_dirty_tiles (self, TRUE);
+}
+
+static guint*
+histogram_imager_reduce_histogram (HistogramImager *self, guint width, guint height)
+{
+    /* Return a newly allocated copy of the histogram, box-filtered down to
+     * the given size. Each new bucket holds the sum of the counts it covers.
+     */
+    HistogramResample r;
+
+    r.src = self->histogram;
+    r.src_width = self->hist_width;
+    r.src_height = self->hist_height;
+    r.dest_width = width;
+    r.dest_height = height;
+    r.dest = g_malloc (sizeof (r.dest[0]) * width * height);
+    histogram_resample_set_geometry (&r, TRUE);
+    histogram_resample (&r);
+    return r.dest;
+}
+
+/************************************************************************************/
+/**************************************************************************** Decay */
+/************************************************************************************/
+
+typedef struct {
+    guint  *histogram;
+    gdouble ratio;
+} HistogramRescale;
+
+static void
+histogram_imager_set_decay_half_life (HistogramImager *self, gdouble half_life)
+{
+    gdouble weight = half_life > 0 ? HISTOGRAM_IMAGER_DECAY_BASE_WEIGHT : 1;
+
+    /* Switching decay on or off changes the number of counts per point,
+     * so the existing histogram has to be brought to the new scale.
+     */
+    if (self->decay.weight && weight != self->decay.weight)
+	histogram_imager_rescale_counts (self, weight / self->decay.weight);
+
+    self->decay_half_life = half_life;
+    self->decay.weight = weight;
+    g_get_current_time (&self->decay.last_time);
+}
+
+static void
+histogram_imager_apply_decay (HistogramImager *self)
+{
+    /* Decay by however much time has passed since we last did */
+    GTimeVal now;
+    gdouble elapsed;
+
+    if (self->decay_half_life <= 0)
+	return;
+
+    g_get_current_time (&now);
+    elapsed = ((now.tv_usec - self->decay.last_time.tv_usec) / 1000000.0 +
+	       (now.tv_sec  - self->decay.last_time.tv_sec ));
+    self->decay.last_time = now;
+
+    if (elapsed > 0)
+	histogram_imager_decay (self, pow (0.5, elapsed / self->decay_half_life));
+}
+
+void
+histogram_imager_decay (HistogramImager *self, gdouble factor)
+{
+    /* Scaling down everything we have is the same as scaling up everything
+     * we'll plot from now on, since images only depend on the ratio between
+     * counts and the total. Only once the weight doubles do we pay for a pass
+     * over the histogram, which brings the weight back to its base value.
+     */
+    gdouble base = self->decay_half_life > 0 ? HISTOGRAM_IMAGER_DECAY_BASE_WEIGHT : 1;
+
+    if (factor >= 1)
+	return;
+    if (factor <= 0) {
+	histogram_imager_clear (self);
+	return;
+    }
+
+    self->decay.weight /= factor;
+    if (self->decay.weight >= base * 2) {
+	histogram_imager_rescale_counts (self, base / self->decay.weight);
+	self->decay.weight = base;
+	self->decay.epoch++;
+    }
+}
+
+static void
+histogram_rescale_block (guint first, guint last, gpointer user_data)
+{
+    /* A simple loop the compiler can vectorize. Rounding to nearest keeps
+     * isolated counts alive for a few epochs, but they drop to zero once
+     * they're less than half of one count. This is done in double
+     * precision, since a float can't hold counts past 2^24 exactly.
+     */
+    HistogramRescale *r = (HistogramRescale*) user_data;
+    guint *hist_p = r->histogram + first;
+    const double ratio = r->ratio;
+    double count;
+    guint i;
+
+    for (i=last-first; i; i--) {
+	count = *hist_p * ratio + 0.5;
+	*hist_p = (guint) MIN(count, (double) G_MAXUINT);
+	hist_p++;
+    }
+}
+
+static void
+histogram_imager_rescale_counts (HistogramImager *self, gdouble ratio)
+{
+    HistogramRescale r;
+    guint n_buckets;
+
+    if (self->histogram) {
+	n_buckets = self->hist_width * self->hist_height;
+	r.histogram = self->histogram;
+	r.ratio = ratio;
+	parallel_for (n_buckets, parallel_block_size (n_buckets, 65536),
+		      histogram_rescale_block, &r);
+    }
+
+    self->total_points_plotted *= ratio;
+    self->peak_density = self->peak_density * ratio + 0.5;
+    self->render_dirty_flag = TRUE;
+}
+
 /* The End */
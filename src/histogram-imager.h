@@ -40,6 +40,40 @@ G_BEGIN_DECLS
 typedef struct _HistogramImager          HistogramImager;
 typedef struct _HistogramImagerClass     HistogramImagerClass;
 
+#define HISTOGRAM_IMAGER_TILE_SHIFT      5
+#define HISTOGRAM_IMAGER_TILE_SIZE       (1 << HISTOGRAM_IMAGER_TILE_SHIFT)
+
+/* Pixel formats that histogram_imager_render_rows() can produce.
+ * All of them are RGBA, with non-premultiplied alpha.
+ */
+typedef enum {
+    HISTOGRAM_IMAGER_FORMAT_RGBA8,       /* 4 guint8s per pixel, the same layout as 'image' */
+    HISTOGRAM_IMAGER_FORMAT_RGBA16,      /* 4 guint16s per pixel, in native byte order */
+    HISTOGRAM_IMAGER_FORMAT_RGBA_FLOAT,  /* 4 floats per pixel, between 0 and 1 */
+} HistogramImagerFormat;
+
+/* Encodings that histogram_imager_export_stream_format() can produce.
+ * histogram_imager_merge_stream() accepts any of them.
+ */
+typedef enum {
+    HISTOGRAM_STREAM_VAR_INT,            /* One var-int per token, the original format */
+    HISTOGRAM_STREAM_VBYTE,              /* Blocks of tokens in stream VByte format */
+} HistogramStreamFormat;
+
+/* Counts handed off by histogram_imager_detach_export() */
+typedef struct _HistogramExport HistogramExport;
+
+/* A bare histogram and its dirty tiles, laid out just like an imager's
+ * own. This lets counts be shared without encoding them, for example
+ * through memory shared with another process.
+ */
+typedef struct {
+    guint   *histogram;
+    guint8  *dirty_tiles;
+    guint    hist_width, hist_height;
+    guint    tiles_width, tiles_height;
+} HistogramBuffer;
+
 
 struct _HistogramImager {
     ParameterHolder parent;
@@ -71,6 +105,43 @@ struct _HistogramImager {
     guint *histogram;
     gboolean histogram_clear_flag;
 
+    /* Decay mode. When decay_half_life is nonzero, counts fade away
+     * exponentially with time, so the image can follow parameters that
+     * change continuously instead of being reset. Rather than scaling
+     * every bucket at each step, new plots are weighted more heavily as
+     * time goes on, and the whole histogram is only rescaled once that
+     * weight has doubled. Each rescale starts a new epoch.
+     */
+    gdouble decay_half_life;
+    struct {
+	gdouble  weight;     /* Histogram counts per plotted point */
+	guint    epoch;
+	GTimeVal last_time;
+    } decay;
+
+    /* Dimensions of 'histogram', in buckets. After a resize these lag
+     * behind width, height, and oversample until the histogram has
+     * been resampled to fit.
+     */
+    guint hist_width, hist_height;
+
+    /* One byte for each square tile of HISTOGRAM_IMAGER_TILE_SIZE buckets,
+     * nonzero if anything in that tile may have been plotted since it was
+     * last exported. This lets histogram_imager_export_stream() skip the
+     * parts of the histogram that haven't changed.
+     */
+    guint8 *dirty_tiles;
+    guint tiles_width, tiles_height;
+
+    /* Double buffering for exports. While the spare is detached, it holds
+     * counts being encoded elsewhere and plots carry on into 'histogram'.
+     * clear_serial changes whenever we're cleared, so counts detached
+     * before then can be recognized as stale.
+     */
+    HistogramExport *export_spare;
+    gboolean export_detached;
+    guint clear_serial;
+
     GdkPixbuf *image;
 
     /* Color table, converts from histogram samples to RGB colors */
@@ -79,6 +150,13 @@ struct _HistogramImager {
 	guint filled_size;
 	guint32 *table;      /* RGBA colors */
 	float *quality;      /* Current quality parameters for every color entry */
+
+	/* The same colors at full precision, as 4 floats per entry. Only
+	 * generated for the deeper image formats. When oversampling, these
+	 * are already linearized with the oversample gamma.
+	 */
+	guint deep_allocated_size;
+	float *deep_table;
     } color_table;
 
     /* Oversampling gamma tables. For particular values of 'oversample',
@@ -86,23 +164,40 @@ struct _HistogramImager {
      * channel value to higher precision linear values that are then
      * summed and put through a second table for conversion back to
      * nonlinear 8-bit.
+     *
+     * The deeper image formats sum linear floats from the deep color table
+     * instead, and use deep_nonlinearize to convert the averages back.
      */
     struct {
 	gdouble   gamma;
 	guint     oversample;
 	guint*  linearize;
 	guint8*   nonlinearize;
+
+	gdouble   deep_gamma;
+	float*    deep_nonlinearize;
     } oversample_tables;
 };
 
 struct _HistogramImagerClass {
     ParameterHolderClass parent_class;
+
+    /* When the image size or oversampling changes, the existing histogram
+     * is resampled into the new geometry. By default its contents are scaled
+     * uniformly with the width and stay centered, which is how DeJong maps
+     * points. Subclasses that stretch their plots to fill the histogram
+     * in both directions should set this.
+     */
+    gboolean resize_stretches;
 };
 
 typedef struct {
     guint *histogram;
     guint hist_width;
+    guint8 *dirty_tiles;
+    guint tiles_width;
     guint density;
+    guint weight;
     gulong plot_count;
 } HistogramPlot;
 
@@ -115,6 +210,23 @@ GType            histogram_imager_get_type        ();
 HistogramImager* histogram_imager_new             ();
 
 void             histogram_imager_update_image    (HistogramImager *self);
+
+/* Render rows of the image directly from the histogram, in any of the
+ * HistogramImagerFormats, using all available CPUs. The destination holds
+ * n_rows rows starting at first_row, each 'rowstride' bytes apart.
+ * histogram_imager_prepare_render() must be called first to bring the color
+ * tables up to date. After that, render_rows may be called any number of
+ * times, for example to stream an image out in blocks.
+ */
+void             histogram_imager_prepare_render  (HistogramImager       *self,
+						   HistogramImagerFormat  format);
+void             histogram_imager_render_rows     (HistogramImager       *self,
+						   HistogramImagerFormat  format,
+						   gpointer               pixels,
+						   gsize                  rowstride,
+						   guint                  first_row,
+						   guint                  n_rows);
+
 GdkPixbuf*       histogram_imager_make_thumbnail  (HistogramImager *self,
 						   guint            max_width,
 						   guint            max_height);
@@ -125,8 +237,31 @@ void	         histogram_imager_load_image_file (HistogramImager *self,
 void             histogram_imager_save_image_file (HistogramImager *self,
 						   const gchar     *filename,
 						   GError          **error);
+void             histogram_imager_save_image_file_16bit (HistogramImager *self,
+							 const gchar     *filename,
+							 GError          **error);
+
+/* Save an 8-bit PNG file like histogram_imager_save_image_file, but do the
+ * slow part in a separate thread. The image is captured before this returns,
+ * and the callback runs from the main loop once the file has been written.
+ * Its 'error' is NULL on success, and is freed after the callback returns.
+ */
+typedef void     (*HistogramImagerSaveFunc)       (const gchar     *filename,
+						   GError          *error,
+						   gpointer         user_data);
+
+void             histogram_imager_save_image_file_async (HistogramImager         *self,
+							 const gchar             *filename,
+							 HistogramImagerSaveFunc  callback,
+							 gpointer                 user_data);
+
+/* Save an OpenEXR file, optionally with an extra 'density' channel holding
+ * the raw average histogram count for each pixel, so the image can be
+ * tone-mapped again later without rendering it again.
+ */
 void             exr_save_image_file              (HistogramImager *hi,
 						   const gchar     *filename,
+						   gboolean         with_density,
 						   GError          **error);
 
 void             histogram_imager_get_hist_size   (HistogramImager *self,
@@ -134,6 +269,20 @@ void             histogram_imager_get_hist_size   (HistogramImager *self,
 						   int             *hist_height);
 
 void             histogram_imager_clear           (HistogramImager *self);
+
+/* Replace this imager's histogram with the one from 'source', resampled
+ * to this imager's size and oversampling. Rendering parameters aren't
+ * copied, so one histogram can be rendered several different ways.
+ */
+void             histogram_imager_load_histogram  (HistogramImager *self,
+						   HistogramImager *source);
+
+/* Multiply every count in the histogram by 'factor', between 0 and 1.
+ * This normally just adjusts the weight given to future plots, and is
+ * called automatically when decay_half_life is set.
+ */
+void             histogram_imager_decay           (HistogramImager *self,
+						   gdouble          factor);
 gdouble          histogram_imager_get_elapsed_time (HistogramImager *self);
 
 /* Calculate a quantitative measure of the image's current rendering
@@ -163,15 +312,90 @@ gdouble          histogram_imager_compute_quality (HistogramImager *self);
  * histogram_imager_export_stream() returns the number of bytes saved
  * in the provided buffer. If it runs out of buffer space, it will leave
  * the remaining samples in HistogramImager's internal buffer. All
- * buckets successfully exported will be emptied.
+ * buckets successfully exported will be emptied. Only tiles that have
+ * been plotted to since they were last exported are examined, so this
+ * is cheap when little has changed.
+ *
+ * histogram_imager_export_stream() always uses the original var-int
+ * format. The stream VByte format is faster to decode, since its
+ * blocks can be unpacked several tokens at a time, but only newer
+ * versions of Fyre can merge it. Streams in that format start with
+ * a zero byte, which never begins a var-int stream.
  */
 gsize            histogram_imager_export_stream   (HistogramImager *self,
 						   guchar          *buffer,
 						   gsize            buffer_size);
+gsize            histogram_imager_export_stream_format (HistogramImager       *self,
+							HistogramStreamFormat  format,
+							guchar                *buffer,
+							gsize                  buffer_size);
 void             histogram_imager_merge_stream    (HistogramImager *self,
 						   const guchar    *buffer,
 						   gsize            buffer_size);
 
+/* Double-buffered export, so encoding a stream never holds up calculation.
+ *
+ * histogram_imager_detach_export() swaps the histogram for an empty one
+ * of the same size, and returns the counts plotted so far. Only the
+ * pointers change hands, so this is cheap. The HistogramExport may then
+ * be encoded with histogram_export_stream() on any thread, while the
+ * imager keeps plotting. Once that's done, it must be handed back with
+ * histogram_imager_attach_export() from the imager's own thread, before
+ * the imager is detached from again or destroyed.
+ *
+ * If the stream runs out of buffer space, the next detach returns the
+ * same export again so the remainder goes out first. Leftovers from
+ * before a histogram_imager_clear() are dropped when they're attached.
+ * A resize folds an attached leftover back into the histogram, to be
+ * resampled with it, and drops a detached one when it's attached.
+ * histogram_imager_drop_export() attaches an export and discards any
+ * counts left in it.
+ */
+HistogramExport* histogram_imager_detach_export   (HistogramImager       *self);
+void             histogram_imager_attach_export   (HistogramImager       *self,
+						   HistogramExport       *pending);
+void             histogram_imager_drop_export     (HistogramImager       *self,
+						   HistogramExport       *pending);
+gsize            histogram_export_stream          (HistogramExport       *pending,
+						   HistogramStreamFormat  format,
+						   guchar                *buffer,
+						   gsize                  buffer_size);
+
+/* The same thing without any encoding, for histograms that can be shared
+ * in memory. histogram_export_add() adds a detached export's counts to
+ * a HistogramBuffer of the same size, returning FALSE if the sizes don't
+ * match. histogram_imager_merge_buffer() merges a buffer's counts into the
+ * imager's histogram, like histogram_imager_merge_stream(). Both empty the
+ * buckets they read, so the same buffer can be used again and again.
+ * histogram_buffer_clear() empties a buffer without merging it.
+ *
+ * Buffers from histogram_buffer_new() live in ordinary memory. They
+ * can collect streams with histogram_buffer_merge_stream(), which
+ * returns the number of samples it added. Since that doesn't touch
+ * any imager, it can run on any thread.
+ */
+gboolean         histogram_export_add             (HistogramExport       *pending,
+						   HistogramBuffer       *dest);
+void             histogram_imager_merge_buffer    (HistogramImager       *self,
+						   HistogramBuffer       *source);
+void             histogram_buffer_clear           (HistogramBuffer       *buffer);
+HistogramBuffer* histogram_buffer_new             (guint                  hist_width,
+						   guint                  hist_height);
+void             histogram_buffer_free            (HistogramBuffer       *buffer);
+gulong           histogram_buffer_merge_stream    (HistogramBuffer       *dest,
+						   const guchar          *buffer,
+						   gsize                  buffer_size);
+
+/* Add the counts in the histogram, and any still waiting in a detached
+ * or partly sent export, to a width x height array of preview buckets,
+ * summing each block of histogram buckets into one. The histogram
+ * itself is left alone.
+ */
+void             histogram_imager_add_preview     (HistogramImager       *self,
+						   guint32               *preview,
+						   guint                  width,
+						   guint                  height);
+
 /* These must be called before and after making plots,
  * to initialize and save the HistogramPlot structure.
  */
@@ -191,7 +415,25 @@ void             histogram_imager_finish_plots    (HistogramImager *self,
 #define HISTOGRAM_IMAGER_PLOT(plot, x, y) do { \
     guint bucket; \
     (plot).plot_count++; \
-    bucket = ++(plot).histogram[(x) + (plot).hist_width * (y)]; \
+    bucket = ((plot).histogram[(x) + (plot).hist_width * (y)] += (plot).weight); \
+    (plot).dirty_tiles[((y) >> HISTOGRAM_IMAGER_TILE_SHIFT) * (plot).tiles_width + \
+                       ((x) >> HISTOGRAM_IMAGER_TILE_SHIFT)] = 1; \
+    if (bucket > (plot).density) { \
+      (plot).density = bucket; \
+    } \
+} while (0)
+
+/* The same, for several threads plotting into one histogram at once.
+ * Each thread needs its own copy of the HistogramPlot, and the copies'
+ * plot_count and density must be combined before finish_plots.
+ */
+#define HISTOGRAM_IMAGER_PLOT_ATOMIC(plot, x, y) do { \
+    guint bucket, *bucket_p; \
+    (plot).plot_count++; \
+    bucket_p = &(plot).histogram[(x) + (plot).hist_width * (y)]; \
+    bucket = g_atomic_int_exchange_and_add((gint*) bucket_p, (plot).weight) + (plot).weight; \
+    (plot).dirty_tiles[((y) >> HISTOGRAM_IMAGER_TILE_SHIFT) * (plot).tiles_width + \
+                       ((x) >> HISTOGRAM_IMAGER_TILE_SHIFT)] = 1; \
     if (bucket > (plot).density) { \
       (plot).density = bucket; \
     } \
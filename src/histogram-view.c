@@ -173,6 +173,18 @@ void histogram_view_update(HistogramView *self) {
     self->imager->render_dirty_flag = FALSE;
 }
 
+void histogram_view_draw_pixbuf(HistogramView *self, GdkPixbuf *pixbuf) {
+    if (!GTK_WIDGET_REALIZED(GTK_WIDGET(self)))
+	return;
+
+    gdk_draw_rgb_32_image(GTK_WIDGET(self)->window, GTK_WIDGET(self)->style->fg_gc[GTK_STATE_NORMAL],
+			  0, 0,
+			  gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf),
+			  GDK_RGB_DITHER_NORMAL,
+			  gdk_pixbuf_get_pixels(pixbuf),
+			  gdk_pixbuf_get_rowstride(pixbuf));
+}
+
 static void histogram_view_draw_image_region(HistogramView *self, GdkRegion *region) {
     GdkRectangle *rects;
     int n_rects, i;
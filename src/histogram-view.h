@@ -64,6 +64,12 @@ void       histogram_view_update     (HistogramView   *self);
 void       histogram_view_set_imager (HistogramView   *self,
 				      HistogramImager *imager);
 
+/* Draw some other image in place of the imager's, until the next update.
+ * It must be an RGBA pixbuf the same size as the imager's image.
+ */
+void       histogram_view_draw_pixbuf (HistogramView  *self,
+				       GdkPixbuf      *pixbuf);
+
 G_END_DECLS
 
 #endif /* __HISTOGRAM_VIEW_H__ */
@@ -47,6 +47,7 @@
 #include "remote-server.h"
 #include "batch-image-render.h"
 #include "gui-util.h"
+#include "parallel.h"
 
 #ifdef HAVE_GNET
 #include "cluster-model.h"
@@ -71,16 +72,23 @@ int main(int argc, char ** argv) {
     gboolean have_gtk;
     gboolean verbose = FALSE;
     gboolean hidden = FALSE;
-    enum {INTERACTIVE, RENDER, SCREENSAVER, REMOTE} mode = INTERACTIVE;
+    enum {INTERACTIVE, RENDER, SCREENSAVER, REMOTE, WORKER} mode = INTERACTIVE;
     const gchar *outputFile = NULL;
     const gchar *pidfile = NULL;
     int c, option_index=0;
     double quality = 1.0;
+    guint bit_depth = 8;
+    gboolean exr_density = FALSE;
+    GSList *output_specs = NULL;
 #ifdef HAVE_GNET
     int port_number = FYRE_DEFAULT_PORT;
+    const gchar *relay_nodes = NULL;
+    int local_workers = 0;
+    gdouble stream_overhead = -1;
 #endif
     GError *error = NULL;
 
+    parallel_init();
     math_init();
     g_type_init();
     have_gtk = gtk_init_check(&argc, &argv);
@@ -105,6 +113,7 @@ int main(int argc, char ** argv) {
 	    {"size",         1, NULL, 's'},
 	    {"oversample",   1, NULL, 'S'},
 	    {"quality",      1, NULL, 'q'},
+	    {"depth",        1, NULL, 'd'},
 	    {"remote",       0, NULL, 'r'},
 	    {"verbose",      0, NULL, 'v'},
 	    {"port",         1, NULL, 'P'},
@@ -115,9 +124,17 @@ int main(int argc, char ** argv) {
 	    {"chdir",        1, NULL, 1002},   /* Undocumented, used by win32 file associations */
 	    {"pidfile",      1, NULL, 1003},
 	    {"version",      0, NULL, 1004},
+	    {"threads",      1, NULL, 1005},
+	    {"exr-density",  0, NULL, 1006},
+	    {"decay",        1, NULL, 1007},
+	    {"also",         1, NULL, 1008},
+	    {"relay",        1, NULL, 1009},
+	    {"local-workers", 1, NULL, 1010},
+	    {"worker",       0, NULL, 1011},   /* Undocumented, used by --local-workers */
+	    {"stream-overhead", 1, NULL, 1012},
 	    {NULL},
 	};
-	c = getopt_long(argc, argv, "hi:n:o:p:s:S:q:rvP:c:C",
+	c = getopt_long(argc, argv, "hi:n:o:p:s:S:q:d:rvP:c:C",
 			long_options, &option_index);
 	if (c == -1)
 	    break;
@@ -162,6 +179,14 @@ int main(int argc, char ** argv) {
 	    quality = atof(optarg);
 	    break;
 
+	case 'd':
+	    bit_depth = atol(optarg);
+	    if (bit_depth != 8 && bit_depth != 16) {
+		fprintf(stderr, "Only 8 and 16 bit output is supported\n");
+		return 1;
+	    }
+	    break;
+
 	case 'v':
 	    verbose = TRUE;
 	    break;
@@ -185,15 +210,32 @@ int main(int argc, char ** argv) {
 	case 'P':
 	    port_number = atol(optarg);
 	    break;
+	case 1009: /* --relay */
+	    mode = REMOTE;
+	    relay_nodes = optarg;
+	    break;
+	case 1010: /* --local-workers */
+	    local_workers = atol(optarg);
+	    break;
+	case 1011: /* --worker */
+	    mode = WORKER;
+	    break;
+	case 1012: /* --stream-overhead */
+	    stream_overhead = atof(optarg) / 100.0;
+	    break;
 #else
 	case 'c':
 	case 'C':
 	case 'P':
+	case 1009:
+	case 1010:
+	case 1012:
 	    fprintf(stderr,
 		    "This Fyre binary was compiled without gnet support.\n"
 		    "Cluster support is not available.\n");
 	    break;
 	case 'r':
+	case 1011:
 	    fprintf(stderr,
 		    "This Fyre binary was compiled without gnet support.\n"
 		    "Cluster support is not available.\n");
@@ -221,6 +263,23 @@ int main(int argc, char ** argv) {
 	    printf("%s\n", VERSION);
 	    return 0;
 
+	case 1005: /* --threads */
+	    parallel_set_n_threads(atol(optarg));
+	    break;
+
+	case 1006: /* --exr-density */
+	    exr_density = TRUE;
+	    break;
+
+	case 1007: /* --decay */
+	    parameter_holder_set(PARAMETER_HOLDER(map), "decay_half_life", optarg);
+	    break;
+
+	case 1008: /* --also */
+	    mode = RENDER;
+	    output_specs = g_slist_append(output_specs, optarg);
+	    break;
+
 	case 'h':
 	default:
 	    usage(argv);
@@ -255,6 +314,26 @@ int main(int argc, char ** argv) {
 	}
     }
 
+#ifdef HAVE_GNET
+    /* Workers are started only once every option has been seen. As
+     * with --cluster, our reference to the ClusterModel is kept on
+     * purpose. The map doesn't own it, so this is what keeps the
+     * cluster, and its workers, around until we exit.
+     */
+    if (local_workers > 0) {
+	ClusterModel *cluster = cluster_model_get(map, TRUE);
+	cluster_model_add_local_workers(cluster, argv[0], local_workers);
+    }
+
+    if (stream_overhead >= 0) {
+	ClusterModel *cluster = cluster_model_get(map, FALSE);
+	if (cluster) {
+	    cluster_model_set_stream_overhead(cluster, stream_overhead);
+	    g_object_unref(cluster);
+	}
+    }
+#endif
+
     switch (mode) {
 
     case INTERACTIVE: {
@@ -290,10 +369,16 @@ int main(int argc, char ** argv) {
 	    g_print ("Error: %s\n", error->message);
 	    g_error_free (error);
 	}
-	if (animate)
+	if (animate) {
+	    if (!outputFile) {
+		fprintf(stderr, "Animations can only be rendered to a single output file, given with -o\n");
+		return 1;
+	    }
 	    animation_render_main (map, animation, outputFile, quality);
+	}
 	else
-	    batch_image_render (map, outputFile, quality);
+	    batch_image_render (map, outputFile, quality, bit_depth, exr_density, output_specs);
+	g_slist_free (output_specs);
 	break;
     }
 
@@ -306,8 +391,9 @@ int main(int argc, char ** argv) {
 	    daemonize_to_pidfile(pidfile);
 	}
 	if (!hidden)
-	    discovery_server_new(FYRE_DEFAULT_SERVICE, port_number);
-	remote_server_main_loop(port_number, have_gtk, verbose);
+	    discovery_server_new(FYRE_DEFAULT_SERVICE, port_number,
+				 remote_server_get_capabilities(relay_nodes));
+	remote_server_main_loop(port_number, have_gtk, verbose, relay_nodes);
 #else
 	fprintf(stderr,
 		"This Fyre binary was compiled without gnet support.\n"
@@ -316,6 +402,12 @@ int main(int argc, char ** argv) {
 	break;
     }
 
+    case WORKER:
+#ifdef HAVE_GNET
+	remote_server_worker_loop(have_gtk);
+#endif
+	break;
+
     case SCREENSAVER: {
 	ScreenSaver* screensaver;
 	GtkWidget* window;
@@ -367,6 +459,18 @@ static void usage(char **argv) {
 	    "                            port 7931 for commands, and can act as a rendering\n"
 	    "                            server in a cluster.\n"
 	    "  -P, --port N            Set the TCP port number used for remote control mode.\n"
+	    "  --local-workers N       Start N worker processes on this machine, and use\n"
+	    "                            them as cluster nodes. They share histograms with\n"
+	    "                            us through shared memory where it's available.\n"
+	    "  --relay LIST            Remote control mode, passing work on to a list of\n"
+	    "                            hosts in the same format as --cluster and merging\n"
+	    "                            their results. This appears to be one fast node,\n"
+	    "                            so large clusters can be arranged as a tree.\n"
+	    "  --stream-overhead PERCENT\n"
+	    "                          Space out each node's results so that merging them\n"
+	    "                            takes about this much of our time. The default is\n"
+	    "                            5. Zero asks every node for results as often as\n"
+	    "                            the cluster merge time allows.\n"
 	    "  -v, --verbose           In remote control mode, display status messages on the\n"
 	    "                            console and don't run as a daemon.\n"
 	    "  --hidden                In remote control mode, don't reply to broadcast\n"
@@ -378,6 +482,10 @@ static void usage(char **argv) {
 	    "  -p, --param KEY=VALUE   Set a calculation or rendering parameter, using the\n"
 	    "                            same key/value format used to store parameters in\n"
 	    "                            image metadata.\n"
+	    "  --decay SECONDS         Let the image fade out with the given half-life, so\n"
+	    "                            it follows parameter changes smoothly instead of\n"
+	    "                            starting over. The screensaver then animates in\n"
+	    "                            real time.\n"
 	    "\n"
 	    "Quality:\n"
 	    "  -s, --size X[xY]        Set the image size in pixels. If only one value is\n"
@@ -392,7 +500,24 @@ static void usage(char **argv) {
 	    "                            which we stop rendering. Larger numbers give\n"
 	    "                            smoother and more detailed results, but increase\n"
 	    "                            running time. The default of 1.0 gives roughly one\n"
-	    "                            histogram sample for every final image sample.\n",
+	    "                            histogram sample for every final image sample.\n"
+	    "  -d, --depth BITS        Bits per channel in rendered PNG images, either 8\n"
+	    "                            (the default) or 16.\n"
+	    "  --threads N             Use N threads for image generation. By default, one\n"
+	    "                            thread is used for every available CPU. In remote\n"
+	    "                            control mode, this is also the number of threads\n"
+	    "                            each job's calculation is split across.\n"
+	    "  --exr-density           When rendering to an OpenEXR file, include a 'density'\n"
+	    "                            channel with the raw histogram counts, for\n"
+	    "                            tone-mapping the image again later.\n"
+	    "  --also FILE[,KEY=VALUE...]\n"
+	    "                          Render another image from the same calculation.\n"
+	    "                            This may be given any number of times. Each image\n"
+	    "                            takes its rendering parameters, like size, exposure,\n"
+	    "                            gamma, fgcolor, and bgcolor, from the main image\n"
+	    "                            unless they're listed, and 'depth' sets its bits\n"
+	    "                            per channel. The main image's size and oversample\n"
+	    "                            should be at least as large as any of these.\n",
 	    argv[0]);
 }
 
@@ -25,21 +25,43 @@
 #include <glib.h>
 #include <math.h>
 
-/* It's much faster to use our own global g_rand, rather than
- * relying on the g_random_* family of functions. Those functions
- * are thread-safe, and the locking around that shared g_rand can
- * take a very significant amount of CPU. We don't need thread-safe
- * random variates yet.
+/* It's much faster to use our own g_rand, rather than relying on
+ * the g_random_* family of functions. Those functions are thread-safe,
+ * and the locking around that shared g_rand can take a very significant
+ * amount of CPU. Instead, each thread that needs random variates gets
+ * its own generator. The main thread's is kept in a plain global, so
+ * the common single-threaded case doesn't even need a lookup.
  */
 static GRand* global_random = NULL;
+static GThread* global_random_thread = NULL;
+static GStaticPrivate thread_random = G_STATIC_PRIVATE_INIT;
 
 void math_init() {
     global_random = g_rand_new_with_seed(time(NULL));
+    if (g_thread_supported())
+	global_random_thread = g_thread_self();
+}
+
+static GRand* math_get_random() {
+    GRand *random;
+
+    if (!global_random_thread || g_thread_self() == global_random_thread)
+	return global_random;
+
+    random = g_static_private_get(&thread_random);
+    if (!random) {
+	/* Seeding from the main generator would need a lock, so mix the
+	 * time with the thread's identity instead.
+	 */
+	random = g_rand_new_with_seed(time(NULL) ^ GPOINTER_TO_UINT(g_thread_self()));
+	g_static_private_set(&thread_random, random, (GDestroyNotify) g_rand_free);
+    }
+    return random;
 }
 
 double uniform_variate() {
     /* A uniform random variate between 0 and 1 */
-    return g_rand_double(global_random);
+    return g_rand_double(math_get_random());
 }
 
 void normal_variate_pair(double *a, double *b) {
@@ -67,7 +89,7 @@ void normal_variate_pair(double *a, double *b) {
 }
 
 int int_variate(int minimum, int maximum) {
-    return g_rand_int_range(global_random, minimum, maximum);
+    return g_rand_int_range(math_get_random(), minimum, maximum);
 }
 
 int find_upper_pow2(int x) {
@@ -0,0 +1,224 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * parallel.c - A small shared pool of worker threads, for splitting
+ *              loops over image rows or histogram blocks across
+ *              all available CPUs.
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include "platform.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "parallel.h"
+
+/* One call to parallel_for(). Blocks are handed out first-come first-served
+ * to the caller and to any pool threads that get around to it. The job is
+ * reference counted, since pool threads may only start running after the
+ * caller has already finished every block and returned.
+ */
+typedef struct {
+    ParallelFunc  func;
+    gpointer      user_data;
+    guint         n_items;
+    guint         block_size;
+
+    /* Protected by 'mutex' */
+    GMutex*       mutex;
+    GCond*        finished;
+    guint         next_item;
+    guint         blocks_remaining;
+    gint          ref_count;
+} ParallelJob;
+
+static void       parallel_job_run          (ParallelJob*  job);
+static void       parallel_job_unref        (ParallelJob*  job);
+static void       parallel_pool_func        (gpointer      data,
+					     gpointer      user_data);
+static guint      parallel_count_cpus       (void);
+
+static GStaticMutex  pool_mutex = G_STATIC_MUTEX_INIT;
+static GThreadPool*  pool = NULL;
+static guint         n_threads = 0;    /* Zero until we've counted CPUs */
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+void              parallel_init             (void)
+{
+    if (!g_thread_supported())
+	g_thread_init(NULL);
+}
+
+guint             parallel_get_n_threads    (void)
+{
+    if (!g_thread_supported())
+	return 1;
+    if (!n_threads)
+	n_threads = parallel_count_cpus();
+    return n_threads;
+}
+
+void              parallel_set_n_threads    (guint      n)
+{
+    g_static_mutex_lock(&pool_mutex);
+    n_threads = MAX(n, 1);
+    if (pool)
+	g_thread_pool_set_max_threads(pool, MAX(n_threads - 1, 1), NULL);
+    g_static_mutex_unlock(&pool_mutex);
+}
+
+guint             parallel_block_size       (guint      n_items,
+					     guint      min_block_size)
+{
+    /* A few blocks per thread keeps everyone busy even when
+     * some blocks are much cheaper than others.
+     */
+    guint n_blocks = parallel_get_n_threads() * 4;
+    guint size = (n_items + n_blocks - 1) / n_blocks;
+    return MAX(MAX(size, min_block_size), 1);
+}
+
+void              parallel_for              (guint        n_items,
+					     guint        block_size,
+					     ParallelFunc func,
+					     gpointer     user_data)
+{
+    ParallelJob *job;
+    guint n_blocks, n_helpers, i;
+
+    if (!n_items)
+	return;
+    block_size = MAX(block_size, 1);
+    n_blocks = (n_items + block_size - 1) / block_size;
+    n_helpers = MIN(n_blocks, parallel_get_n_threads()) - 1;
+
+    if (!n_helpers) {
+	/* Not worth waking anyone up, do it all ourselves */
+	for (i=0; i<n_items; i+=block_size)
+	    func(i, MIN(i + block_size, n_items), user_data);
+	return;
+    }
+
+    g_static_mutex_lock(&pool_mutex);
+    if (!pool)
+	pool = g_thread_pool_new(parallel_pool_func, NULL,
+				 MAX(parallel_get_n_threads() - 1, 1),
+				 FALSE, NULL);
+    g_static_mutex_unlock(&pool_mutex);
+
+    job = g_new0(ParallelJob, 1);
+    job->func = func;
+    job->user_data = user_data;
+    job->n_items = n_items;
+    job->block_size = block_size;
+    job->mutex = g_mutex_new();
+    job->finished = g_cond_new();
+    job->blocks_remaining = n_blocks;
+    job->ref_count = 1 + n_helpers;
+
+    for (i=0; i<n_helpers; i++)
+	g_thread_pool_push(pool, job, NULL);
+
+    /* Pitch in, then wait for any blocks still running in other threads.
+     * Note that we only wait for blocks, not for the helpers themselves.
+     * If the pool is busy running our own caller, helpers may not
+     * start until long after we're done.
+     */
+    parallel_job_run(job);
+
+    g_mutex_lock(job->mutex);
+    while (job->blocks_remaining)
+	g_cond_wait(job->finished, job->mutex);
+    g_mutex_unlock(job->mutex);
+
+    parallel_job_unref(job);
+}
+
+
+/************************************************************************************/
+/************************************************************************ Internals */
+/************************************************************************************/
+
+static void       parallel_job_run          (ParallelJob*  job)
+{
+    guint first, last;
+
+    g_mutex_lock(job->mutex);
+    while (job->next_item < job->n_items) {
+	first = job->next_item;
+	last = MIN(first + job->block_size, job->n_items);
+	job->next_item = last;
+	g_mutex_unlock(job->mutex);
+
+	job->func(first, last, job->user_data);
+
+	g_mutex_lock(job->mutex);
+	if (!--job->blocks_remaining)
+	    g_cond_broadcast(job->finished);
+    }
+    g_mutex_unlock(job->mutex);
+}
+
+static void       parallel_job_unref        (ParallelJob*  job)
+{
+    gboolean last_ref;
+
+    g_mutex_lock(job->mutex);
+    last_ref = (--job->ref_count == 0);
+    g_mutex_unlock(job->mutex);
+
+    if (last_ref) {
+	g_mutex_free(job->mutex);
+	g_cond_free(job->finished);
+	g_free(job);
+    }
+}
+
+static void       parallel_pool_func        (gpointer      data,
+					     gpointer      user_data)
+{
+    ParallelJob *job = (ParallelJob*) data;
+    parallel_job_run(job);
+    parallel_job_unref(job);
+}
+
+static guint      parallel_count_cpus       (void)
+{
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return MAX(info.dwNumberOfProcessors, 1);
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+#else
+    return 1;
+#endif
+}
+
+/* The End */
@@ -0,0 +1,73 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * parallel.h - A small shared pool of worker threads, for splitting
+ *              loops over image rows or histogram blocks across
+ *              all available CPUs.
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Process the items numbered 'first' through 'last'-1. This may be
+ * called from any thread, so it must only touch state that doesn't
+ * overlap with other blocks.
+ */
+typedef void      (*ParallelFunc)           (guint      first,
+					     guint      last,
+					     gpointer   user_data);
+
+/* Initialize threading. This must be called before any other glib
+ * function, as it's a thin wrapper around g_thread_init().
+ */
+void              parallel_init             (void);
+
+/* The number of threads, including the caller's, that parallel_for()
+ * will use. This defaults to the number of online CPUs, and setting
+ * it to 1 disables the worker pool entirely.
+ */
+guint             parallel_get_n_threads    (void);
+void              parallel_set_n_threads    (guint      n_threads);
+
+/* Split the range [0, n_items) into blocks of 'block_size' items each,
+ * and run 'func' on every block. The calling thread works on blocks too,
+ * and this returns only once every block has finished. It's safe to call
+ * this recursively from inside a ParallelFunc.
+ */
+void              parallel_for              (guint        n_items,
+					     guint        block_size,
+					     ParallelFunc func,
+					     gpointer     user_data);
+
+/* Pick a block size that divides n_items into a few blocks per thread,
+ * but never less than min_block_size items.
+ */
+guint             parallel_block_size       (guint      n_items,
+					     guint      min_block_size);
+
+G_END_DECLS
+
+#endif /* __PARALLEL_H__ */
+
+/* The End */
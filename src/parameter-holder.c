@@ -39,7 +39,7 @@ static void value_transform_string_enum    (const GValue *src_value, GValue *des
 
 static gchar**      parameter_line_parse           (const gchar* line);
 static GHashTable*  parameter_hash_from_string     (const gchar* params);
-static void         parameter_holder_set_with_spec (ParameterHolder *self, GParamSpec *spec, const gchar* value);
+static gboolean     parameter_holder_set_with_spec (ParameterHolder *self, GParamSpec *spec, const gchar* value);
 
 
 /************************************************************************************/
@@ -140,8 +140,10 @@ static void value_transform_string_enum(const GValue *src_value, GValue *dest_va
 /*********************************************************************** Properties */
 /************************************************************************************/
 
-void parameter_holder_set(ParameterHolder *self, const gchar* property, const gchar* value) {
-    /* Set a property, casting a string value to whatever type the property expects */
+gboolean parameter_holder_set(ParameterHolder *self, const gchar* property, const gchar* value) {
+    /* Set a property, casting a string value to whatever type the property expects.
+     * Returns TRUE if this changed the property's value.
+     */
     GParamSpec *spec;
 
     /* Look up the GParamSpec for this property */
@@ -150,24 +152,39 @@ void parameter_holder_set(ParameterHolder *self, const gchar* property, const gc
 	g_log(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
 	      "Ignoring attempt to set undefined property '%s' to '%s'",
 	      property, value);
-	return;
+	return FALSE;
     }
 
-    parameter_holder_set_with_spec(self, spec, value);
+    return parameter_holder_set_with_spec(self, spec, value);
 }
 
-static void parameter_holder_set_with_spec (ParameterHolder *self, GParamSpec *spec, const gchar* value)
+static gboolean parameter_holder_set_with_spec (ParameterHolder *self, GParamSpec *spec, const gchar* value)
 {
-    GValue strval, converted;
+    GValue strval, converted, previous;
+    gboolean changed = FALSE;
 
     memset(&strval, 0, sizeof(GValue));
     memset(&converted, 0, sizeof(GValue));
+    memset(&previous, 0, sizeof(GValue));
     g_value_init(&strval, G_TYPE_STRING);
     g_value_init(&converted, spec->value_type);
+    g_value_init(&previous, spec->value_type);
     g_value_set_string(&strval, value);
 
     if (g_value_transform(&strval, &converted)) {
-	g_object_set_property(G_OBJECT(self), spec->name, &converted);
+	if (spec->flags & G_PARAM_READABLE) {
+	    /* Compare against what the property actually holds afterwards,
+	     * since the setter may have clamped or rounded our value.
+	     */
+	    g_object_get_property(G_OBJECT(self), spec->name, &previous);
+	    g_object_set_property(G_OBJECT(self), spec->name, &converted);
+	    g_object_get_property(G_OBJECT(self), spec->name, &converted);
+	    changed = g_param_values_cmp(spec, &previous, &converted) != 0;
+	}
+	else {
+	    g_object_set_property(G_OBJECT(self), spec->name, &converted);
+	    changed = TRUE;
+	}
     }
     else {
 	g_log(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
@@ -177,6 +194,8 @@ static void parameter_holder_set_with_spec (ParameterHolder *self, GParamSpec *s
 
     g_value_unset(&strval);
     g_value_unset(&converted);
+    g_value_unset(&previous);
+    return changed;
 }
 
 static gchar**  parameter_line_parse(const gchar* line)
@@ -218,14 +237,18 @@ static GHashTable* parameter_hash_from_string (const gchar* params)
     return hash;
 }
 
-void parameter_holder_set_from_line(ParameterHolder *self,
-				    const gchar     *line)
+GParamSpec* parameter_holder_set_from_line(ParameterHolder *self,
+					   const gchar     *line)
 {
+    /* Returns the GParamSpec of the property we set, only if its value changed */
+    GParamSpec* changed = NULL;
     gchar** tokens = parameter_line_parse(line);
     if (tokens) {
-	parameter_holder_set(self, tokens[0], tokens[1]);
+	if (parameter_holder_set(self, tokens[0], tokens[1]))
+	    changed = g_object_class_find_property(G_OBJECT_GET_CLASS(self), tokens[0]);
 	g_strfreev(tokens);
     }
+    return changed;
 }
     
 void parameter_holder_reset_to_defaults(ParameterHolder *self) {
@@ -86,6 +86,7 @@ typedef struct {
 #define PARAM_SERIALIZED   (1 << (G_PARAM_USER_SHIFT + 0))    /* Parameters we're interested in serializing */
 #define PARAM_INTERPOLATE  (1 << (G_PARAM_USER_SHIFT + 1))    /* Parameters we're interested in interpolating */
 #define PARAM_IN_GUI       (1 << (G_PARAM_USER_SHIFT + 2))    /* Parameters that should be visible in the GUI */
+#define PARAM_CALCULATION  (1 << (G_PARAM_USER_SHIFT + 3))    /* Parameters that affect calculation, not just rendering */
 
 /* This is attached to the "increments" quark using param_spec_set_increments */
 typedef struct {
@@ -105,10 +106,14 @@ void              parameter_holder_pair_free          (ParameterHolderPair *self
 
 void              parameter_holder_reset_to_defaults  (ParameterHolder *self);
 
-void              parameter_holder_set                (ParameterHolder *self,
+/* Set one property from a string. parameter_holder_set() returns TRUE
+ * and parameter_holder_set_from_line() returns the property's GParamSpec
+ * only if this changed the property's value.
+ */
+gboolean          parameter_holder_set                (ParameterHolder *self,
 						       const gchar     *property,
 						       const gchar     *value);
-void              parameter_holder_set_from_line      (ParameterHolder *self,
+GParamSpec*       parameter_holder_set_from_line      (ParameterHolder *self,
 						       const gchar     *line);
 
 void              parameter_holder_load_string        (ParameterHolder *self,
@@ -0,0 +1,112 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * png-reader.c - Reads text metadata from PNG files without
+ *                decoding, or even reading, the image data.
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include <string.h>
+#include <errno.h>
+#include "png-reader.h"
+#include "chunked-file.h"
+
+#define PNG_SIGNATURE      "\x89PNG\r\n\x1a\n"
+
+/* Skip text chunks larger than this, they can't be ours */
+#define PNG_MAX_TEXT_SIZE  (1 << 20)
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+GHashTable*  png_read_text             (const gchar*   filename,
+					GError**       error)
+{
+    GHashTable *text;
+    FILE *file;
+    guint32 header[2];
+    ChunkType type;
+    gsize length;
+    guchar *data;
+    guint32 crc;
+
+    file = fopen(filename, "rb");
+    if (!file) {
+	g_set_error(error, FYRE_PNG_READER_ERROR, FYRE_PNG_READER_ERROR_IO,
+		    "Can't open '%s': %s", filename, g_strerror(errno));
+	return NULL;
+    }
+
+    if (!chunked_file_read_signature(file, PNG_SIGNATURE)) {
+	g_set_error(error, FYRE_PNG_READER_ERROR, FYRE_PNG_READER_ERROR_FORMAT,
+		    "'%s' is not a PNG file", filename);
+	fclose(file);
+	return NULL;
+    }
+
+    text = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    /* Read each chunk's length and type. Text chunks are read in full,
+     * and their CRC checked. Anything else is skipped without reading it,
+     * until we get to the image data.
+     */
+    while (fread(header, 1, sizeof(header), file) == sizeof(header)) {
+	length = GUINT32_FROM_BE(header[0]);
+	type = GUINT32_FROM_BE(header[1]);
+
+	if (type == CHUNK_TYPE('I','D','A','T') || type == CHUNK_TYPE('I','E','N','D'))
+	    break;
+
+	if (type == CHUNK_TYPE('t','E','X','t') && length <= PNG_MAX_TEXT_SIZE) {
+	    /* chunked_file_read_chunk() would carry on past a corrupt chunk,
+	     * reading the next one in full even if it's the image data.
+	     * A corrupt text chunk is just skipped.
+	     */
+	    data = g_malloc(length);
+	    if (fread(data, 1, length, file) != length ||
+		fread(&crc, 1, sizeof(crc), file) != sizeof(crc)) {
+		g_free(data);
+		break;
+	    }
+
+	    /* The keyword ends at a NUL, and the text runs to the end of the chunk */
+	    if (chunk_crc(type, length, data) == GUINT32_FROM_BE(crc)) {
+		guchar *separator = memchr(data, 0, length);
+		if (separator)
+		    g_hash_table_insert(text, g_strdup((gchar*) data),
+					g_strndup((gchar*) separator + 1, data + length - separator - 1));
+	    }
+	    else {
+		g_log(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+		      "Ignoring corrupted text chunk in '%s'", filename);
+	    }
+	    g_free(data);
+	}
+	else if (fseek(file, length + 4, SEEK_CUR) != 0) {
+	    break;
+	}
+    }
+
+    fclose(file);
+    return text;
+}
+
+/* The End */
@@ -0,0 +1,56 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * png-reader.h - Reads text metadata from PNG files without
+ *                decoding, or even reading, the image data.
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __PNG_READER_H__
+#define __PNG_READER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define FYRE_PNG_READER_ERROR (g_quark_from_string("FYRE_PNG_READER_ERROR"))
+typedef enum {
+    FYRE_PNG_READER_ERROR_IO,
+    FYRE_PNG_READER_ERROR_FORMAT,
+} FyrePngReaderError;
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+/* Collect every tEXt chunk that comes before the image data, returning a
+ * new hash table that maps keywords to text, or NULL on error. Reading stops
+ * at the first IDAT chunk, so this costs about the same no matter how large
+ * the image is. Text stored after the image data isn't seen, but both Fyre
+ * and GdkPixbuf always write it first.
+ */
+GHashTable*  png_read_text             (const gchar*   filename,
+					GError**       error);
+
+G_END_DECLS
+
+#endif /* __PNG_READER_H__ */
+
+/* The End */
@@ -0,0 +1,551 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * png-writer.c - A minimal streaming PNG encoder, for writing RGBA images
+ *                that are too deep for GdkPixbuf or too large to keep in
+ *                memory all at once. Filtering and compression are split
+ *                across all CPUs.
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <zlib.h>
+#include "png-writer.h"
+#include "chunked-file.h"
+#include "parallel.h"
+
+#define PNG_SIGNATURE      "\x89PNG\r\n\x1a\n"
+#define PNG_IDAT_SIZE      (256 * 1024)
+
+/* Filtered image data is compressed in independent segments of about
+ * this size, each primed with the window of data that came before it.
+ */
+#define PNG_SEGMENT_SIZE   (128 * 1024)
+#define PNG_WINDOW_SIZE    32768
+
+enum {
+    PNG_FILTER_NONE,
+    PNG_FILTER_SUB,
+    PNG_FILTER_UP,
+    PNG_FILTER_AVERAGE,
+    PNG_FILTER_PAETH,
+    PNG_N_FILTERS,
+};
+
+struct _PngWriter {
+    FILE*     file;
+    guint     width, height;
+    guint     bit_depth;
+    guint     bytes_per_pixel;
+    gsize     row_bytes;
+    guint     rows_written;
+
+    /* The last unfiltered row written, in PNG byte order */
+    guchar*   prev_row;
+
+    /* The end of the filtered data so far, used as the
+     * preset dictionary for the next segment we compress.
+     */
+    guchar    window[PNG_WINDOW_SIZE];
+    gsize     window_size;
+
+    /* Checksum of all filtered data, for the zlib trailer */
+    uLong     adler;
+
+    guchar*   idat;
+    gsize     idat_size;
+};
+
+/* One call to png_writer_write_rows, shared between threads */
+typedef struct {
+    PngWriter*     self;
+    const guchar*  pixels;
+    gsize          rowstride;
+    guchar*        filtered;
+    gsize          filtered_size;
+} PngBatch;
+
+/* One independently compressed piece of a PngBatch */
+typedef struct {
+    const guchar*  data;
+    gsize          size;
+    const guchar*  dictionary;
+    gsize          dictionary_size;
+    guchar*        output;
+    gsize          output_size;
+    uLong          adler;
+    int            status;
+} PngSegment;
+
+static void      png_writer_free          (PngWriter*     self);
+static gboolean  png_writer_write_idat    (PngWriter*     self,
+					   const guchar*  data,
+					   gsize          length,
+					   gboolean       flush,
+					   GError**       error);
+static void      png_writer_convert_row   (PngWriter*     self,
+					   const guchar*  src,
+					   guchar*        dest);
+static void      png_filter_rows          (guint          first,
+					   guint          last,
+					   gpointer       user_data);
+static void      png_compress_segments    (guint          first,
+					   guint          last,
+					   gpointer       user_data);
+static void      png_update_window        (PngWriter*     self,
+					   const guchar*  data,
+					   gsize          length);
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+PngWriter*  png_writer_new            (const gchar*   filename,
+				       guint          width,
+				       guint          height,
+				       guint          bit_depth,
+				       GError**       error)
+{
+    PngWriter *self;
+    guchar ihdr[13];
+    guint32 word;
+
+    g_return_val_if_fail(bit_depth == 8 || bit_depth == 16, NULL);
+
+    self = g_new0(PngWriter, 1);
+    self->width = width;
+    self->height = height;
+    self->bit_depth = bit_depth;
+    self->bytes_per_pixel = 4 * bit_depth / 8;
+    self->row_bytes = (gsize) width * self->bytes_per_pixel;
+
+    self->file = fopen(filename, "wb");
+    if (!self->file) {
+	g_set_error(error, FYRE_PNG_WRITER_ERROR, FYRE_PNG_WRITER_ERROR_IO,
+		    "Can't open '%s' for writing: %s", filename, g_strerror(errno));
+	png_writer_free(self);
+	return NULL;
+    }
+
+    /* The previous row starts out as all zeroes, as required for filtering the first row */
+    self->prev_row = g_malloc0(self->row_bytes);
+    self->idat = g_malloc(PNG_IDAT_SIZE);
+    self->adler = adler32(0, NULL, 0);
+
+    /* The zlib header: a 32k window, default compression, no dictionary */
+    self->idat[0] = 0x78;
+    self->idat[1] = 0x9C;
+    self->idat_size = 2;
+
+    word = GUINT32_TO_BE(width);
+    memcpy(ihdr, &word, 4);
+    word = GUINT32_TO_BE(height);
+    memcpy(ihdr + 4, &word, 4);
+    ihdr[8] = bit_depth;
+    ihdr[9] = 6;          /* RGBA */
+    ihdr[10] = 0;         /* Deflate */
+    ihdr[11] = 0;         /* Adaptive filtering */
+    ihdr[12] = 0;         /* No interlacing */
+
+    chunked_file_write_signature(self->file, PNG_SIGNATURE);
+    chunked_file_write_chunk(self->file, CHUNK_TYPE('I','H','D','R'), sizeof(ihdr), ihdr);
+
+    return self;
+}
+
+void        png_writer_add_text       (PngWriter*     self,
+				       const gchar*   keyword,
+				       const gchar*   text)
+{
+    /* A tEXt chunk is just the keyword and text separated by a NUL */
+    gsize keyword_len = strlen(keyword);
+    gsize text_len = strlen(text);
+    guchar *data;
+
+    g_return_if_fail(self->rows_written == 0);
+
+    data = g_malloc(keyword_len + 1 + text_len);
+    memcpy(data, keyword, keyword_len + 1);
+    memcpy(data + keyword_len + 1, text, text_len);
+    chunked_file_write_chunk(self->file, CHUNK_TYPE('t','E','X','t'),
+			     keyword_len + 1 + text_len, data);
+    g_free(data);
+}
+
+gboolean    png_writer_write_rows     (PngWriter*     self,
+				       gconstpointer  pixels,
+				       gsize          rowstride,
+				       guint          n_rows,
+				       GError**       error)
+{
+    /* Rows are filtered in parallel, since each one only depends on the
+     * unfiltered row above it. The filtered data is then cut into segments
+     * that are each deflated on their own, ending on a byte boundary with a
+     * sync flush. Raw deflate data can be concatenated like that, so writing
+     * the compressed segments in order gives one valid zlib stream. Giving
+     * each segment the 32k of data before it as a dictionary means this
+     * compresses nearly as well as a single deflate would.
+     */
+    PngBatch batch;
+    PngSegment *segments;
+    guint n_segments, i;
+    gboolean success = TRUE;
+
+    g_return_val_if_fail(self->rows_written + n_rows <= self->height, FALSE);
+    if (!n_rows)
+	return TRUE;
+
+    batch.self = self;
+    batch.pixels = pixels;
+    batch.rowstride = rowstride;
+    batch.filtered_size = (gsize) n_rows * (self->row_bytes + 1);
+    batch.filtered = g_malloc(batch.filtered_size);
+
+    parallel_for(n_rows, parallel_block_size(n_rows, 16), png_filter_rows, &batch);
+
+    n_segments = (batch.filtered_size + PNG_SEGMENT_SIZE - 1) / PNG_SEGMENT_SIZE;
+    segments = g_new0(PngSegment, n_segments);
+    for (i=0; i<n_segments; i++) {
+	gsize offset = (gsize) i * PNG_SEGMENT_SIZE;
+
+	segments[i].data = batch.filtered + offset;
+	segments[i].size = MIN(PNG_SEGMENT_SIZE, batch.filtered_size - offset);
+	if (i == 0) {
+	    segments[i].dictionary = self->window;
+	    segments[i].dictionary_size = self->window_size;
+	}
+	else {
+	    segments[i].dictionary = segments[i].data - PNG_WINDOW_SIZE;
+	    segments[i].dictionary_size = PNG_WINDOW_SIZE;
+	}
+    }
+
+    parallel_for(n_segments, 1, png_compress_segments, segments);
+
+    for (i=0; i<n_segments; i++) {
+	if (success && segments[i].status != Z_OK) {
+	    g_set_error(error, FYRE_PNG_WRITER_ERROR, FYRE_PNG_WRITER_ERROR_COMPRESSION,
+			"zlib error %d while compressing PNG data", segments[i].status);
+	    success = FALSE;
+	}
+	if (success) {
+	    self->adler = adler32_combine(self->adler, segments[i].adler, segments[i].size);
+	    success = png_writer_write_idat(self, segments[i].output, segments[i].output_size, FALSE, error);
+	}
+	g_free(segments[i].output);
+    }
+    g_free(segments);
+
+    /* Remember what we need for the next batch: the last unfiltered
+     * row, and the end of the filtered data.
+     */
+    png_writer_convert_row(self, batch.pixels + (gsize) (n_rows - 1) * rowstride, self->prev_row);
+    png_update_window(self, batch.filtered, batch.filtered_size);
+    g_free(batch.filtered);
+
+    self->rows_written += n_rows;
+    return success;
+}
+
+gboolean    png_writer_close          (PngWriter*     self,
+				       GError**       error)
+{
+    gboolean success = TRUE;
+    guchar trailer[6];
+    guint32 word;
+
+    if (self->rows_written != self->height) {
+	g_set_error(error, FYRE_PNG_WRITER_ERROR, FYRE_PNG_WRITER_ERROR_COMPRESSION,
+		    "Only %d of %d image rows were written", self->rows_written, self->height);
+	success = FALSE;
+    }
+
+    /* An empty final block with fixed codes, then the checksum */
+    trailer[0] = 0x03;
+    trailer[1] = 0x00;
+    word = GUINT32_TO_BE(self->adler);
+    memcpy(trailer + 2, &word, 4);
+
+    if (success)
+	success = png_writer_write_idat(self, trailer, sizeof(trailer), TRUE, error);
+
+    if (success) {
+	chunked_file_write_chunk(self->file, CHUNK_TYPE('I','E','N','D'), 0, NULL);
+	if (ferror(self->file)) {
+	    g_set_error(error, FYRE_PNG_WRITER_ERROR, FYRE_PNG_WRITER_ERROR_IO,
+			"Error writing PNG file: %s", g_strerror(errno));
+	    success = FALSE;
+	}
+    }
+
+    if (fclose(self->file) != 0 && success) {
+	g_set_error(error, FYRE_PNG_WRITER_ERROR, FYRE_PNG_WRITER_ERROR_IO,
+		    "Error closing PNG file: %s", g_strerror(errno));
+	success = FALSE;
+    }
+    self->file = NULL;
+
+    png_writer_free(self);
+    return success;
+}
+
+
+/************************************************************************************/
+/************************************************************************ Internals */
+/************************************************************************************/
+
+static void      png_writer_free          (PngWriter*     self)
+{
+    if (self->file)
+	fclose(self->file);
+
+    g_free(self->prev_row);
+    g_free(self->idat);
+    g_free(self);
+}
+
+static gboolean  png_writer_write_idat    (PngWriter*     self,
+					   const guchar*  data,
+					   gsize          length,
+					   gboolean       flush,
+					   GError**       error)
+{
+    /* Append compressed data, writing an IDAT chunk every time the
+     * buffer fills up. With 'flush' this also writes the last partial one.
+     */
+    while (length > 0 || (flush && self->idat_size > 0)) {
+	gsize n = MIN(length, PNG_IDAT_SIZE - self->idat_size);
+
+	memcpy(self->idat + self->idat_size, data, n);
+	self->idat_size += n;
+	data += n;
+	length -= n;
+
+	if (self->idat_size == PNG_IDAT_SIZE || (flush && length == 0)) {
+	    chunked_file_write_chunk(self->file, CHUNK_TYPE('I','D','A','T'),
+				     self->idat_size, self->idat);
+	    self->idat_size = 0;
+	}
+    }
+
+    if (ferror(self->file)) {
+	g_set_error(error, FYRE_PNG_WRITER_ERROR, FYRE_PNG_WRITER_ERROR_IO,
+		    "Error writing PNG file: %s", g_strerror(errno));
+	return FALSE;
+    }
+    return TRUE;
+}
+
+static void      png_writer_convert_row   (PngWriter*     self,
+					   const guchar*  src,
+					   guchar*        dest)
+{
+    /* Convert one row of pixels to PNG byte order */
+    guint i;
+
+    if (self->bit_depth == 16) {
+	const guint16 *src16 = (const guint16*) src;
+	guint16 *dest16 = (guint16*) dest;
+	for (i=self->width*4; i; i--)
+	    *(dest16++) = GUINT16_TO_BE(*(src16++));
+    }
+    else {
+	memcpy(dest, src, self->row_bytes);
+    }
+}
+
+static void      png_update_window        (PngWriter*     self,
+					   const guchar*  data,
+					   gsize          length)
+{
+    /* Keep the last PNG_WINDOW_SIZE bytes of filtered data */
+    if (length >= PNG_WINDOW_SIZE) {
+	memcpy(self->window, data + length - PNG_WINDOW_SIZE, PNG_WINDOW_SIZE);
+	self->window_size = PNG_WINDOW_SIZE;
+    }
+    else {
+	gsize keep = MIN(self->window_size, PNG_WINDOW_SIZE - length);
+	memmove(self->window, self->window + self->window_size - keep, keep);
+	memcpy(self->window + keep, data, length);
+	self->window_size = keep + length;
+    }
+}
+
+static int       png_paeth_predictor      (int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+	return a;
+    if (pb <= pc)
+	return b;
+    return c;
+}
+
+static void      png_filter_row           (const guchar*  cur,
+					   const guchar*  prev,
+					   guchar*        out,
+					   gsize          n,
+					   gsize          bpp,
+					   int            filter)
+{
+    gsize i;
+
+    switch (filter) {
+
+    case PNG_FILTER_NONE:
+	memcpy(out, cur, n);
+	break;
+
+    case PNG_FILTER_SUB:
+	for (i=0; i<bpp; i++)
+	    out[i] = cur[i];
+	for (; i<n; i++)
+	    out[i] = cur[i] - cur[i-bpp];
+	break;
+
+    case PNG_FILTER_UP:
+	for (i=0; i<n; i++)
+	    out[i] = cur[i] - prev[i];
+	break;
+
+    case PNG_FILTER_AVERAGE:
+	for (i=0; i<bpp; i++)
+	    out[i] = cur[i] - (prev[i] >> 1);
+	for (; i<n; i++)
+	    out[i] = cur[i] - ((cur[i-bpp] + prev[i]) >> 1);
+	break;
+
+    case PNG_FILTER_PAETH:
+	for (i=0; i<bpp; i++)
+	    out[i] = cur[i] - prev[i];
+	for (; i<n; i++)
+	    out[i] = cur[i] - png_paeth_predictor(cur[i-bpp], prev[i], prev[i-bpp]);
+	break;
+    }
+}
+
+static void      png_filter_rows          (guint          first,
+					   guint          last,
+					   gpointer       user_data)
+{
+    /* Filter a block of rows into the batch's output buffer. For each row
+     * we try every filter, and pick the one with the smallest sum of
+     * absolute values when its output is interpreted as signed bytes.
+     * This is the usual heuristic recommended by the PNG specification.
+     */
+    PngBatch *batch = (PngBatch*) user_data;
+    PngWriter *self = batch->self;
+    const gsize n = self->row_bytes;
+    guchar *prev = g_malloc(n);
+    guchar *cur = g_malloc(n);
+    guchar *candidates = g_malloc(PNG_N_FILTERS * n);
+    guchar *swap;
+    guint row;
+
+    if (first == 0)
+	memcpy(prev, self->prev_row, n);
+    else
+	png_writer_convert_row(self, batch->pixels + (gsize) (first - 1) * batch->rowstride, prev);
+
+    for (row=first; row<last; row++) {
+	guchar *out = batch->filtered + (gsize) row * (n + 1);
+	int filter, best_filter = PNG_FILTER_NONE;
+	gulong sum, best_sum = G_MAXULONG;
+	gsize i;
+
+	png_writer_convert_row(self, batch->pixels + (gsize) row * batch->rowstride, cur);
+
+	for (filter=0; filter<PNG_N_FILTERS; filter++) {
+	    const gint8 *p = (const gint8*) (candidates + filter * n);
+
+	    png_filter_row(cur, prev, candidates + filter * n, n, self->bytes_per_pixel, filter);
+
+	    sum = 0;
+	    for (i=n; i; i--) {
+		int v = *(p++);
+		sum += v < 0 ? -v : v;
+	    }
+	    if (sum < best_sum) {
+		best_sum = sum;
+		best_filter = filter;
+	    }
+	}
+
+	out[0] = best_filter;
+	memcpy(out + 1, candidates + best_filter * n, n);
+
+	swap = prev;
+	prev = cur;
+	cur = swap;
+    }
+
+    g_free(prev);
+    g_free(cur);
+    g_free(candidates);
+}
+
+static void      png_compress_segments    (guint          first,
+					   guint          last,
+					   gpointer       user_data)
+{
+    /* Deflate segments into raw (headerless) deflate data, ending each
+     * with a sync flush so the next segment starts on a byte boundary.
+     */
+    PngSegment *segments = (PngSegment*) user_data;
+    guint i;
+
+    for (i=first; i<last; i++) {
+	PngSegment *seg = &segments[i];
+	z_stream zs;
+	gsize bound;
+
+	memset(&zs, 0, sizeof(zs));
+	seg->status = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+	if (seg->status != Z_OK)
+	    continue;
+
+	if (seg->dictionary_size)
+	    deflateSetDictionary(&zs, seg->dictionary, seg->dictionary_size);
+
+	/* Room for the worst case, plus the empty block a sync flush adds */
+	bound = deflateBound(&zs, seg->size) + 16;
+	seg->output = g_malloc(bound);
+
+	zs.next_in = (Bytef*) seg->data;
+	zs.avail_in = seg->size;
+	zs.next_out = seg->output;
+	zs.avail_out = bound;
+
+	seg->status = deflate(&zs, Z_SYNC_FLUSH);
+	if (seg->status == Z_OK && zs.avail_in)
+	    seg->status = Z_BUF_ERROR;
+
+	seg->output_size = bound - zs.avail_out;
+	seg->adler = adler32(adler32(0, NULL, 0), seg->data, seg->size);
+	deflateEnd(&zs);
+    }
+}
+
+/* The End */
@@ -0,0 +1,82 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * png-writer.h - A minimal streaming PNG encoder, for writing RGBA images
+ *                that are too deep for GdkPixbuf or too large to keep in
+ *                memory all at once. Filtering and compression are split
+ *                across all CPUs.
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __PNG_WRITER_H__
+#define __PNG_WRITER_H__
+
+#include <stdio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PngWriter PngWriter;
+
+#define FYRE_PNG_WRITER_ERROR (g_quark_from_string("FYRE_PNG_WRITER_ERROR"))
+typedef enum {
+    FYRE_PNG_WRITER_ERROR_IO,
+    FYRE_PNG_WRITER_ERROR_COMPRESSION,
+} FyrePngWriterError;
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+/* Open 'filename' and write the PNG header for an RGBA image with
+ * either 8 or 16 bits per channel. Returns NULL on error.
+ */
+PngWriter*  png_writer_new            (const gchar*   filename,
+				       guint          width,
+				       guint          height,
+				       guint          bit_depth,
+				       GError**       error);
+
+/* Add a tEXt chunk. This must be called before the first row is written. */
+void        png_writer_add_text       (PngWriter*     self,
+				       const gchar*   keyword,
+				       const gchar*   text);
+
+/* Append 'n_rows' rows of RGBA pixels. With a bit depth of 16, each channel
+ * is a guint16 in the machine's native byte order. Each call is filtered and
+ * compressed on all CPUs, so it's best to pass many rows at once.
+ */
+gboolean    png_writer_write_rows     (PngWriter*     self,
+				       gconstpointer  pixels,
+				       gsize          rowstride,
+				       guint          n_rows,
+				       GError**       error);
+
+/* Finish the image, close the file, and free the writer. This fails if
+ * fewer rows were written than the image height given to png_writer_new.
+ */
+gboolean    png_writer_close          (PngWriter*     self,
+				       GError**       error);
+
+G_END_DECLS
+
+#endif /* __PNG_WRITER_H__ */
+
+/* The End */
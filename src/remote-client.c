@@ -31,7 +31,10 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <math.h>
+#include <zlib.h>
 #include "remote-client.h"
+#include "stream-vbyte.h"
 
 static void       remote_client_class_init    (RemoteClientClass*    klass);
 static void       remote_client_init          (RemoteClient*         self);
@@ -43,6 +46,12 @@ static void       remote_client_recv_binary   (RemoteClient*         self,
 					       GConnEvent*           event);
 static void       remote_client_recv_line     (RemoteClient*         self,
 					       GConnEvent*           event);
+static void       remote_client_recv_frame    (RemoteClient*         self,
+					       GConnEvent*           event);
+static void       remote_client_read_next     (RemoteClient*         self);
+static void       remote_client_dispatch      (RemoteClient*         self,
+					       RemoteResponse*       response,
+					       RemoteClosure*        closure);
 static void       remote_client_update_status (RemoteClient*         self,
 					       const gchar*          fmt,
 					       ...);
@@ -53,10 +62,70 @@ static void       remote_client_start_retry   (RemoteClient*         self);
 static void       remote_client_stop_retry    (RemoteClient*         self);
 static gboolean   remote_client_retry_callback(gpointer              user_data);
 static void       remote_client_empty_queue   (RemoteClient*         self);
+static void       remote_client_negotiate     (RemoteClient*         self);
+static void       remote_client_notify        (RemoteClient*         self,
+					       const gchar*          format,
+					       ...);
+static void       histogram_push_callback     (RemoteClient*         self,
+					       RemoteResponse*       response,
+					       gpointer              user_data);
+static void       remote_client_clear_params  (RemoteClient*         self);
+static gboolean   param_timer_callback        (gpointer              user_data);
+static const gchar* find_capability           (const gchar*          info,
+					       const gchar*          key);
+static gboolean   parse_epoch                 (const gchar*          message,
+					       guint32*              epoch);
+
+/* Histogram streams are uncompressed and decoded on a worker thread,
+ * into a staging histogram shared by every client merging into the same
+ * map. The main loop only has to fold that into the map itself, at safe
+ * points of its choosing, so the cost of merging doesn't grow with the
+ * amount of cluster traffic. Jobs run one at a time, in order.
+ */
+typedef struct {
+    GMutex*            lock;
+    HistogramBuffer*   buffer;
+    guint              clear_serial;
+} StreamStaging;
+
+typedef struct {
+    RemoteClient*      client;
+    GConn*             gconn;
+    HistogramImager*   dest;
+    StreamStaging*     staging;
+    gboolean           is_push;
+    gboolean           is_compressed;
+    guchar*            data;
+    gsize              data_length;
+    guint              hist_width, hist_height;
+    guint              clear_serial;
+
+    /* Results, for updating our statistics afterwards */
+    gsize              raw_length;
+    double             encode_time;
+    double             decode_time;
+    double             merge_time;
+} MergeJob;
+
+static GThreadPool*    merge_pool = NULL;
 
 /* Smallest time interval, in seconds, to allow in speed calculations */
 #define MINIMUM_SPEED_WINDOW 1.0
 
+/* Histogram push settings. The server may have this many pushes waiting
+ * for us to merge them, and pushes early once this much data is ready.
+ */
+#define PUSH_WINDOW          2
+#define PUSH_BYTES           (256 * 1024)
+
+/* Render times closer than this fraction to the current one aren't sent */
+#define RENDER_TIME_HYSTERESIS 0.2
+
+/* No histogram stream needs more than this many bytes per bucket. Every
+ * bucket takes at most a skip and a count, of up to five bytes each.
+ */
+#define MAX_STREAM_BYTES_PER_BUCKET 12
+
 
 /************************************************************************************/
 /**************************************************** Initialization / Finalization */
@@ -122,6 +191,44 @@ static void remote_client_dispose(GObject *gobject)
 	g_timer_destroy(self->stream_request_timer);
 	self->stream_request_timer = NULL;
     }
+
+    if (self->shared) {
+	shared_histogram_free(self->shared);
+	self->shared = NULL;
+    }
+
+    if (self->command_buffer) {
+	g_free(self->command_buffer);
+	self->command_buffer = NULL;
+    }
+
+    if (self->stream_encodings) {
+	g_free(self->stream_encodings);
+	self->stream_encodings = NULL;
+    }
+
+    if (self->session) {
+	g_free(self->session);
+	self->session = NULL;
+    }
+    if (self->offered_session) {
+	g_free(self->offered_session);
+	self->offered_session = NULL;
+    }
+
+    if (self->queued_params) {
+	remote_client_clear_params(self);
+	g_ptr_array_free(self->queued_params, TRUE);
+	self->queued_params = NULL;
+    }
+    if (self->param_source) {
+	g_object_unref(self->param_source);
+	self->param_source = NULL;
+    }
+    if (self->param_send_timer) {
+	g_timer_destroy(self->param_send_timer);
+	self->param_send_timer = NULL;
+    }
 }
 
 static
@@ -139,13 +246,24 @@ static void remote_client_init(RemoteClient *self)
     self->status_speed_timer = g_timer_new();
     self->stream_speed_timer = g_timer_new();
     self->stream_request_timer = g_timer_new();
+    self->param_send_timer = g_timer_new();
+    self->queued_params = g_ptr_array_new();
 
     /* Default stream interval: every second */
     self->min_stream_interval = 1.0;
 
+    /* Send queued parameter changes at most ten times a second */
+    self->min_param_interval = 0.1;
+
     /* By default, retry connections every minute */
     self->retry_timeout = 60.0;
     self->is_retry_enabled = TRUE;
+
+    /* Compress histogram streams whenever the server supports it,
+     * and let it push them to us instead of polling.
+     */
+    self->is_compression_enabled = TRUE;
+    self->is_push_enabled = TRUE;
 }
 
 RemoteClient*  remote_client_new              (const gchar*          hostname,
@@ -183,13 +301,59 @@ void           remote_client_connect          (RemoteClient*         self)
 	self->gconn = NULL;
     }
     remote_client_empty_queue(self);
+    remote_client_cancel_preview(self);
+    self->current_binary_response = NULL;
+
+    /* Every connection starts out with the original text protocol */
+    self->protocol = 1;
+    self->reading_frame_body = FALSE;
+    self->next_request_id = 0;
+    self->subscription_id = 0;
+    self->is_subscribing = FALSE;
+    self->subscription_failed = FALSE;
+    self->shared_failed = FALSE;
+    if (self->shared) {
+	shared_histogram_free(self->shared);
+	self->shared = NULL;
+    }
+
+    /* Replies to parameter changes on the old connection will never
+     * arrive. Whoever is using us sends all parameters again once
+     * we're ready, so there's no point keeping queued ones either.
+     */
+    remote_client_clear_params(self);
+    self->pending_param_changes = 0;
+    self->pending_calc_changes = 0;
+    self->pending_stream_requests = 0;
+    self->no_set_params = FALSE;
+    self->quota_remaining = 0;
+    self->quota_pending = FALSE;
+    self->no_quota = FALSE;
+    self->render_time = 0;
+    self->no_preview = FALSE;
+
+    /* calc_epoch, status_epoch and prev_iterations are left alone, as
+     * they still describe our session. They're kept if the server
+     * resumes it, and reset by remote_client_new_session() if not.
+     */
 
     /* Reset our speed counters and rate limiting timers */
     self->iter_accumulator = 0;
     self->byte_accumulator = 0;
     self->iters_per_sec = 0;
     self->bytes_per_sec = 0;
+    self->stream_compression = FALSE;
+    self->raw_byte_accumulator = 0;
+    self->encode_time_accumulator = 0;
+    self->decode_time_accumulator = 0;
+    self->merge_time_accumulator = 0;
+    self->stream_accumulator = 0;
+    self->compression_ratio = 0;
+    self->encode_time = 0;
+    self->decode_time = 0;
+    self->merge_time = 0;
     g_timer_start(self->stream_request_timer);
+    g_timer_start(self->param_send_timer);
     g_timer_start(self->status_speed_timer);
     g_timer_start(self->stream_speed_timer);
 
@@ -197,7 +361,7 @@ void           remote_client_connect          (RemoteClient*         self)
     self->gconn = gnet_conn_new(self->host, self->port, remote_client_callback, self);
     gnet_conn_set_watch_error(self->gconn, TRUE);
     gnet_conn_connect(self->gconn);
-    gnet_conn_readline(self->gconn);
+    remote_client_read_next(self);
 
     remote_client_update_status(self, "Connecting...");
 }
@@ -205,6 +369,9 @@ void           remote_client_connect          (RemoteClient*         self)
 static
 void       remote_client_start_retry   (RemoteClient*         self)
 {
+    /* We've lost the connection, and any answer we were waiting for with it */
+    remote_client_cancel_preview(self);
+
     remote_client_stop_retry(self);
     if (self->is_retry_enabled)
 	self->retry_timer = g_timeout_add(self->retry_timeout * 1000,
@@ -260,6 +427,56 @@ static void       remote_client_update_status (RemoteClient*         self,
     g_free(msg);
 }
 
+static void       remote_client_vsend         (RemoteClient*         self,
+					       guint32               id,
+					       const gchar*          format,
+					       va_list               ap)
+{
+    gchar* full_message;
+    gchar* line;
+    va_list ap_copy;
+    gsize available;
+    int length;
+    guint32 header[2];
+
+    if (self->protocol >= 2) {
+	/* Format the command right after the frame header. If it doesn't
+	 * fit in our buffer, grow the buffer and try again.
+	 */
+	while (1) {
+	    available = self->command_buffer_size - FYRE_FRAME_HEADER_SIZE;
+	    G_VA_COPY(ap_copy, ap);
+	    length = self->command_buffer ?
+		g_vsnprintf(self->command_buffer + FYRE_FRAME_HEADER_SIZE, available, format, ap_copy) : -1;
+	    va_end(ap_copy);
+
+	    if (length >= 0 && (gsize) length < available)
+		break;
+	    g_free(self->command_buffer);
+	    self->command_buffer_size = MAX(self->command_buffer_size * 2, 256);
+	    if (length >= 0)
+		self->command_buffer_size = MAX(self->command_buffer_size,
+						length + 1 + FYRE_FRAME_HEADER_SIZE);
+	    self->command_buffer = g_malloc(self->command_buffer_size);
+	}
+
+	header[0] = GUINT32_TO_BE(length);
+	header[1] = GUINT32_TO_BE(id);
+	memcpy(self->command_buffer, header, FYRE_FRAME_HEADER_SIZE);
+	gnet_conn_write(self->gconn, self->command_buffer, FYRE_FRAME_HEADER_SIZE + length);
+	return;
+    }
+
+    /* Assemble the caller's formatted string */
+    full_message = g_strdup_vprintf(format, ap);
+
+    /* Send a one-line command */
+    line = g_strdup_printf("%s\n", full_message);
+    gnet_conn_write(self->gconn, line, strlen(line));
+    g_free(full_message);
+    g_free(line);
+}
+
 void           remote_client_command          (RemoteClient*     self,
 					       RemoteCallback    callback,
 					       gpointer          user_data,
@@ -267,25 +484,37 @@ void           remote_client_command          (RemoteClient*     self,
 					       ...)
 {
     RemoteClosure *closure = g_new0(RemoteClosure, 1);
-    gchar* full_message;
-    gchar* line;
     va_list ap;
 
-    /* Add the response callback to our queue */
+    /* Add the response callback to our queue. ID zero is reserved
+     * for commands that don't get a response.
+     */
+    if (!++self->next_request_id)
+	self->next_request_id++;
     closure->callback = callback;
     closure->user_data = user_data;
+    closure->id = self->next_request_id;
     g_queue_push_head(self->response_queue, closure);
 
-    /* Assemble the caller's formatted string */
     va_start(ap, format);
-    full_message = g_strdup_vprintf(format, ap);
+    remote_client_vsend(self, closure->id, format, ap);
     va_end(ap);
+}
 
-    /* Send a one-line command */
-    line = g_strdup_printf("%s\n", full_message);
-    gnet_conn_write(self->gconn, line, strlen(line));
-    g_free(full_message);
-    g_free(line);
+static void       remote_client_notify        (RemoteClient*         self,
+					       const gchar*          format,
+					       ...)
+{
+    /* Send a command with request ID zero, which the server never
+     * answers. This is only possible with protocol version 2.
+     */
+    va_list ap;
+
+    g_assert(self->protocol >= 2);
+
+    va_start(ap, format);
+    remote_client_vsend(self, 0, format, ap);
+    va_end(ap);
 }
 
 static void       remote_client_callback      (GConn*                gconn,
@@ -296,7 +525,9 @@ static void       remote_client_callback      (GConn*                gconn,
     switch (event->type) {
 
     case GNET_CONN_READ:
-	if (self->current_binary_response)
+	if (self->protocol >= 2)
+	    remote_client_recv_frame(self, event);
+	else if (self->current_binary_response)
 	    remote_client_recv_binary(self, event);
 	else
 	    remote_client_recv_line(self, event);
@@ -346,7 +577,7 @@ static void       remote_client_recv_binary   (RemoteClient*         self,
     g_free(response->message);
     g_free(response);
 
-    gnet_conn_readline(self->gconn);
+    remote_client_read_next(self);
 }
 
 static void       remote_client_recv_line     (RemoteClient*         self,
@@ -376,10 +607,97 @@ static void       remote_client_recv_line     (RemoteClient*         self,
     }
 
     /* We're done, signal the callback and start waiting
-     * for another normal response line.
+     * for another normal response line. Text responses always
+     * arrive in the same order as their requests.
      */
     closure = g_queue_pop_tail(self->response_queue);
+    remote_client_dispatch(self, response, closure);
 
+    g_free(response->message);
+    g_free(response);
+
+    remote_client_read_next(self);
+}
+
+static void       remote_client_recv_frame    (RemoteClient*         self,
+					       GConnEvent*           event)
+{
+    /* Handle either a frame header or the response it introduces */
+    RemoteResponse response;
+    RemoteClosure *closure = NULL;
+    GList *link;
+    guint32 length;
+    guint16 code, message_length;
+
+    if (!self->reading_frame_body) {
+	memcpy(&length, event->buffer, sizeof(length));
+	memcpy(&self->frame_request_id, event->buffer + sizeof(length), sizeof(guint32));
+	length = GUINT32_FROM_BE(length);
+	self->frame_request_id = GUINT32_FROM_BE(self->frame_request_id);
+
+	if (length < FYRE_FRAME_RESPONSE_SIZE || length > FYRE_FRAME_MAX_LENGTH) {
+	    self->is_ready = FALSE;
+	    remote_client_update_status(self, "Protocol error");
+	    gnet_conn_disconnect(self->gconn);
+	    remote_client_start_retry(self);
+	    return;
+	}
+
+	self->reading_frame_body = TRUE;
+	gnet_conn_readn(self->gconn, length);
+	return;
+    }
+    self->reading_frame_body = FALSE;
+
+    memcpy(&code, event->buffer, sizeof(code));
+    memcpy(&message_length, event->buffer + sizeof(code), sizeof(message_length));
+    code = GUINT16_FROM_BE(code);
+    message_length = MIN(GUINT16_FROM_BE(message_length),
+			 event->length - FYRE_FRAME_RESPONSE_SIZE);
+
+    response.code = code;
+    response.message = g_strndup(event->buffer + FYRE_FRAME_RESPONSE_SIZE, message_length);
+    response.data = (guchar*) event->buffer + FYRE_FRAME_RESPONSE_SIZE + message_length;
+    response.data_length = event->length - FYRE_FRAME_RESPONSE_SIZE - message_length;
+
+    /* Pushed histograms all carry the ID of our subscription */
+    if (self->subscription_id && self->frame_request_id == self->subscription_id) {
+	histogram_push_callback(self, &response, self->subscription_dest);
+	g_free(response.message);
+	remote_client_read_next(self);
+	return;
+    }
+
+    /* Responses can arrive in any order, find the matching request */
+    if (self->frame_request_id) {
+	for (link=self->response_queue->head; link; link=link->next)
+	    if (((RemoteClosure*) link->data)->id == self->frame_request_id) {
+		closure = link->data;
+		g_queue_remove(self->response_queue, closure);
+		break;
+	    }
+    }
+    remote_client_dispatch(self, &response, closure);
+
+    g_free(response.message);
+    remote_client_read_next(self);
+}
+
+static void       remote_client_read_next     (RemoteClient*         self)
+{
+    /* Wait for the next response line, or the next part of a frame */
+    if (!self->gconn)
+	return;
+    if (self->protocol < 2)
+	gnet_conn_readline(self->gconn);
+    else if (!self->reading_frame_body)
+	gnet_conn_readn(self->gconn, FYRE_FRAME_HEADER_SIZE);
+}
+
+static void       remote_client_dispatch      (RemoteClient*         self,
+					       RemoteResponse*       response,
+					       RemoteClosure*        closure)
+{
     if (closure) {
 	/* This was an answer to some request. Invoke the callback
 	 * if one was specified.
@@ -391,18 +709,17 @@ static void       remote_client_recv_line     (RemoteClient*         self,
     else {
 	/* This was unsolicited- should only occur for the server ready message */
 	if (response->code == FYRE_RESPONSE_READY) {
-	    self->is_ready = TRUE;
-	    remote_client_update_status(self, "Ready");
+	    const gchar* session = find_capability(response->message, "session");
+
+	    g_free(self->offered_session);
+	    self->offered_session = session ? g_strndup(session, strcspn(session, " ")) : NULL;
+
+	    remote_client_set_capabilities(self, response->message);
+	    remote_client_negotiate(self);
 	}
-	else {
+	else
 	    remote_client_update_status(self, "Protocol error");
-	}
     }
-
-    g_free(response->message);
-    g_free(response);
-
-    gnet_conn_readline(self->gconn);
 }
 
 
@@ -410,46 +727,291 @@ static void       remote_client_recv_line     (RemoteClient*         self,
 /************************************************************* High-level Interface */
 /************************************************************************************/
 
+static void    stream_compression_callback    (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    /* Older servers won't recognize the command, and keep sending
+     * uncompressed streams. The server applies this to every stream
+     * request after it, and answers it before any of them, so we're
+     * never confused about which streams are compressed.
+     */
+    self->stream_compression = (response->code == FYRE_RESPONSE_OK);
+}
+
+static void    remote_client_new_session      (RemoteClient*     self)
+{
+    /* We're starting over with the new connection's own session. Its
+     * epochs and iteration counts have nothing to do with the old ones.
+     */
+    g_free(self->session);
+    self->session = self->offered_session;
+    self->offered_session = NULL;
+
+    self->calc_epoch = 0;
+    self->status_epoch = 0;
+    self->prev_iterations = 0;
+}
+
+static void    resume_session_callback        (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    /* If our old session is still there, the server picks up where it
+     * left off, counts and all. Our parameters normally haven't changed,
+     * so sending them all again leaves its epoch alone. Otherwise the
+     * new connection's own session is the one to remember.
+     */
+    if (response->code == FYRE_RESPONSE_OK) {
+	parse_epoch(response->message, &self->calc_epoch);
+	g_free(self->offered_session);
+	self->offered_session = NULL;
+    }
+    else
+	remote_client_new_session(self);
+}
+
+static void    protocol_callback              (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    /* Older servers won't recognize set_protocol. In that case we
+     * keep using text, otherwise our next command will be a frame.
+     */
+    if (response->code == FYRE_RESPONSE_OK)
+	self->protocol = FYRE_PROTOCOL_VERSION;
+
+    if (self->is_compression_enabled)
+	remote_client_command(self, stream_compression_callback, NULL,
+			      "set_stream_compression zlib");
+
+    if (self->session && self->offered_session)
+	remote_client_command(self, resume_session_callback, NULL,
+			      "resume_session %s", self->session);
+    else
+	remote_client_new_session(self);
+
+    /* Only now are we ready for other commands */
+    self->is_ready = TRUE;
+    remote_client_update_status(self, "Ready");
+}
+
+static void    remote_client_negotiate        (RemoteClient*     self)
+{
+    /* Set up optional protocol features once the server has greeted us.
+     * The server switches framing right after its response, so nothing
+     * else can be sent until protocol_callback runs.
+     */
+    remote_client_command(self, protocol_callback, NULL,
+			  "set_protocol %d", FYRE_PROTOCOL_VERSION);
+}
+
+static gboolean parse_epoch                    (const gchar*      message,
+					       guint32*          epoch)
+{
+    /* Servers that know about parameter epochs tag their responses
+     * with "epoch=N". Returns FALSE for older servers.
+     */
+    const gchar* tag;
+
+    if (!message)
+	return FALSE;
+    tag = strstr(message, "epoch=");
+    if (!tag)
+	return FALSE;
+    *epoch = strtoul(tag + 6, NULL, 10);
+    return TRUE;
+}
+
+static gboolean remote_client_is_current      (RemoteClient*     self,
+					       const gchar*      message)
+{
+    /* Decide whether results tagged with 'message' belong to our current
+     * parameters. With epochs, only calculation parameters matter. Without
+     * them, any outstanding parameter change makes the results suspect.
+     */
+    guint32 epoch;
+
+    if (parse_epoch(message, &epoch))
+	return !self->pending_calc_changes && !self->queued_calc_params &&
+	    epoch == self->calc_epoch;
+    return !self->pending_param_changes && !self->queued_params->len;
+}
+
 static void    set_param_callback             (RemoteClient*     self,
 					       RemoteResponse*   response,
 					       gpointer          user_data)
 {
+    /* Answers both set_param and set_params. 'user_data' is nonzero
+     * if the change included any parameters that affect calculation.
+     */
     self->pending_param_changes--;
+    if (user_data)
+	self->pending_calc_changes--;
+
+    if (response->code == FYRE_RESPONSE_UNRECOGNIZED && !self->no_set_params) {
+	/* This server is too old for set_params. Send everything again,
+	 * one parameter at a time.
+	 */
+	self->no_set_params = TRUE;
+	remote_client_send_all_params(self, self->param_source);
+	return;
+    }
+
+    /* Replies arrive in order, so the last one has the newest epoch */
+    parse_epoch(response->message, &self->calc_epoch);
 }
 
-void           remote_client_send_param       (RemoteClient*     self,
-					       ParameterHolder*  ph,
-					       const gchar*      name)
+static gchar*  serialize_param                (ParameterHolder*  ph,
+					       GParamSpec*       spec)
 {
-    /* Serialize one parameter value, and send it to the server */
+    /* Returns a newly allocated string representation of one parameter value */
 
     GValue val, strval;
-    const gchar* string;
-    GParamSpec *spec = g_object_class_find_property(G_OBJECT_GET_CLASS(ph), name);
-    g_assert(spec != NULL);
+    gchar* string;
 
     memset(&val, 0, sizeof(val));
     g_value_init(&val, spec->value_type);
-    g_object_get_property(G_OBJECT(ph), name, &val);
+    g_object_get_property(G_OBJECT(ph), spec->name, &val);
 
     memset(&strval, 0, sizeof(strval));
     g_value_init(&strval, G_TYPE_STRING);
     g_value_transform(&val, &strval);
-    string = g_value_get_string(&strval);
+    string = g_value_dup_string(&strval);
+
+    g_value_unset(&strval);
+    g_value_unset(&val);
+    return string;
+}
+
+static void    remote_client_clear_params     (RemoteClient*     self)
+{
+    if (self->param_timer) {
+	g_source_remove(self->param_timer);
+	self->param_timer = 0;
+    }
+    g_ptr_array_set_size(self->queued_params, 0);
+    self->queued_calc_params = FALSE;
+}
+
+static void    remote_client_queue_one        (RemoteClient*     self,
+					       ParameterHolder*  ph,
+					       const gchar*      name)
+{
+    GParamSpec *spec = g_object_class_find_property(G_OBJECT_GET_CLASS(ph), name);
+    int i;
+    g_assert(spec != NULL);
 
-    /* 'string' will be NULL if the value couldn't be serialized- currently
-     * this happens for colors, since we get the GdkColor property rather than
-     * the corresponding string property. Currently this isn't a problem since
-     * render nodes don't deal with colors, but it's something to be aware of.
+    if (ph != self->param_source) {
+	g_object_ref(ph);
+	if (self->param_source)
+	    g_object_unref(self->param_source);
+	self->param_source = ph;
+    }
+
+    /* We only keep track of which parameters changed. Their values
+     * are read when we send them, so they're always the newest.
      */
-    if (string) {
+    for (i=0; i<self->queued_params->len; i++)
+	if (g_ptr_array_index(self->queued_params, i) == spec)
+	    return;
+    g_ptr_array_add(self->queued_params, spec);
+
+    if (spec->flags & PARAM_CALCULATION)
+	self->queued_calc_params = TRUE;
+}
+
+void           remote_client_flush_params     (RemoteClient*     self)
+{
+    /* Send every queued parameter change now. Servers that support it
+     * get them all in one set_params transaction.
+     */
+    GString* command;
+    GParamSpec* spec;
+    gchar* string;
+    gboolean calc;
+    int i;
+
+    if (!self->queued_params->len)
+	return;
+
+    command = g_string_new("set_params");
+    calc = self->queued_calc_params;
+
+    for (i=0; i<self->queued_params->len; i++) {
+	spec = g_ptr_array_index(self->queued_params, i);
+	string = serialize_param(self->param_source, spec);
+
+	/* 'string' will be NULL if the value couldn't be serialized- currently
+	 * this happens for colors, since we get the GdkColor property rather than
+	 * the corresponding string property. Currently this isn't a problem since
+	 * render nodes don't deal with colors, but it's something to be aware of.
+	 */
+	if (!string)
+	    continue;
+
+	if (self->no_set_params) {
+	    self->pending_param_changes++;
+	    if (spec->flags & PARAM_CALCULATION)
+		self->pending_calc_changes++;
+	    remote_client_command(self, set_param_callback,
+				  GINT_TO_POINTER(spec->flags & PARAM_CALCULATION),
+				  "set_param %s = %s", spec->name, string);
+	}
+	else {
+	    g_string_append_printf(command, "%s %s = %s",
+				   command->len > 10 ? ";" : "", spec->name, string);
+	}
+	g_free(string);
+    }
+
+    if (command->len > 10) {
 	self->pending_param_changes++;
-	remote_client_command(self, set_param_callback, NULL, "set_param %s = %s",
-			      name, string);
+	if (calc)
+	    self->pending_calc_changes++;
+	remote_client_command(self, set_param_callback, GINT_TO_POINTER(calc), "%s", command->str);
     }
 
-    g_value_unset(&strval);
-    g_value_unset(&val);
+    g_string_free(command, TRUE);
+    remote_client_clear_params(self);
+    g_timer_start(self->param_send_timer);
+}
+
+static gboolean param_timer_callback          (gpointer          user_data)
+{
+    RemoteClient* self = REMOTE_CLIENT(user_data);
+    self->param_timer = 0;
+    remote_client_flush_params(self);
+    return FALSE;
+}
+
+void           remote_client_queue_param      (RemoteClient*     self,
+					       ParameterHolder*  ph,
+					       const gchar*      name)
+{
+    /* Queue a parameter change, sending it along with any others once
+     * min_param_interval has passed since the last time we sent any.
+     * Even if it already has, wait for the main loop, since changes
+     * tend to come in bursts like the ones from set_params.
+     */
+    double elapsed;
+
+    remote_client_queue_one(self, ph, name);
+    if (self->param_timer)
+	return;
+
+    elapsed = g_timer_elapsed(self->param_send_timer, NULL);
+    self->param_timer = g_timeout_add(MAX(0, self->min_param_interval - elapsed) * 1000,
+				      param_timer_callback, self);
+}
+
+void           remote_client_send_param       (RemoteClient*     self,
+					       ParameterHolder*  ph,
+					       const gchar*      name)
+{
+    /* Send one parameter value to the server right away, along with any queued ones */
+    remote_client_queue_one(self, ph, name);
+    remote_client_flush_params(self);
 }
 
 void           remote_client_send_all_params  (RemoteClient*     self,
@@ -465,69 +1027,288 @@ void           remote_client_send_all_params  (RemoteClient*     self,
 
     for (i=0; i<n_properties; i++)
 	if (properties[i]->flags & PARAM_SERIALIZED)
-	    remote_client_send_param(self, ph, properties[i]->name);
+	    remote_client_queue_one(self, ph, properties[i]->name);
 
     g_free(properties);
+    remote_client_flush_params(self);
 }
 
-static void    histogram_merge_callback       (RemoteClient*     self,
-					       RemoteResponse*   response,
-					       gpointer          user_data)
+static void    decode_merge_job               (MergeJob*         job)
 {
-    HistogramImager *dest = HISTOGRAM_IMAGER(user_data);
-    double elapsed;
+    /* Uncompress the stream if necessary, and add it to the staging
+     * histogram. This only touches the job and its staging histogram,
+     * so it may run on any thread. Only one job runs at a time, so
+     * they can all share one inflate buffer. The whole job is timed,
+     * since that's what each stream costs us.
+     */
+    static guchar *inflate_buffer = NULL;
+    static gsize inflate_buffer_size = 0;
+    StreamStaging *staging = job->staging;
+    const guchar *data;
+    uLongf raw_length;
+    gsize data_length;
+    GTimer *timer;
+
+    data = job->data;
+    data_length = job->data_length;
+    timer = g_timer_new();
+
+    if (job->is_compressed) {
+	/* Unpack the header described in remote-server.h, then the stream */
+	if (data_length < FYRE_STREAM_COMPRESSION_HEADER) {
+	    g_timer_destroy(timer);
+	    return;
+	}
+	raw_length = ((uLongf) data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+	job->encode_time = ((data[4] << 24) | (data[5] << 16) |
+			    (data[6] << 8) | data[7]) / 1000000.0;
 
-    self->pending_stream_requests--;
+	/* Don't let a bad header make us allocate more than any stream needs */
+	if (raw_length > (gsize) job->hist_width * job->hist_height * MAX_STREAM_BYTES_PER_BUCKET) {
+	    g_timer_destroy(timer);
+	    return;
+	}
 
-    if (self->pending_param_changes) {
-	/* This data is for an old parameter set, ignore it.
-	 * FIXME: This doesn't distinguish between parameters that
-	 *        actaully affect calculation and those that don't.
-	 */
-	return;
+	if (inflate_buffer_size < raw_length) {
+	    g_free(inflate_buffer);
+	    inflate_buffer_size = raw_length;
+	    inflate_buffer = g_malloc(inflate_buffer_size);
+	}
+
+	g_timer_start(timer);
+	if (uncompress(inflate_buffer, &raw_length,
+		       data + FYRE_STREAM_COMPRESSION_HEADER,
+		       data_length - FYRE_STREAM_COMPRESSION_HEADER) != Z_OK) {
+	    g_timer_destroy(timer);
+	    return;
+	}
+	job->decode_time = g_timer_elapsed(timer, NULL);
+
+	data = inflate_buffer;
+	data_length = raw_length;
     }
 
-    if (!response->data_length)
-	return;
+    /* Counts from before the map was last cleared or resized are stale */
+    g_mutex_lock(staging->lock);
+    if (staging->buffer && (staging->buffer->hist_width != job->hist_width ||
+			    staging->buffer->hist_height != job->hist_height)) {
+	histogram_buffer_free(staging->buffer);
+	staging->buffer = NULL;
+    }
+    if (!staging->buffer)
+	staging->buffer = histogram_buffer_new(job->hist_width, job->hist_height);
+    else if (staging->clear_serial != job->clear_serial)
+	histogram_buffer_clear(staging->buffer);
+    staging->clear_serial = job->clear_serial;
+
+    histogram_buffer_merge_stream(staging->buffer, data, data_length);
+    g_mutex_unlock(staging->lock);
+
+    job->raw_length = data_length;
+    job->merge_time = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+}
 
-    histogram_imager_merge_stream(dest, response->data, response->data_length);
+static void    remote_client_add_stream_stats (RemoteClient*     self,
+					       gsize             data_length,
+					       gsize             raw_length,
+					       double            encode_time,
+					       double            decode_time,
+					       double            merge_time)
+{
+    /* Add one merged stream, or one shared histogram, to our averages */
+    double elapsed;
+
+    self->byte_accumulator += data_length;
+    self->raw_byte_accumulator += raw_length;
+    self->encode_time_accumulator += encode_time;
+    self->decode_time_accumulator += decode_time;
+    self->merge_time_accumulator += merge_time;
+    self->stream_accumulator++;
 
-    /* Update our download speed */
-    self->byte_accumulator += response->data_length;
     elapsed = g_timer_elapsed(self->stream_speed_timer, NULL);
     if (elapsed > MINIMUM_SPEED_WINDOW) {
 	g_timer_start(self->stream_speed_timer);
 	self->bytes_per_sec = self->byte_accumulator / elapsed;
+	if (self->byte_accumulator > 0)
+	    self->compression_ratio = self->raw_byte_accumulator / self->byte_accumulator;
+	self->encode_time = self->encode_time_accumulator / self->stream_accumulator;
+	self->decode_time = self->decode_time_accumulator / self->stream_accumulator;
+	self->merge_time = self->merge_time_accumulator / self->stream_accumulator;
 	self->byte_accumulator = 0;
+	self->raw_byte_accumulator = 0;
+	self->encode_time_accumulator = 0;
+	self->decode_time_accumulator = 0;
+	self->merge_time_accumulator = 0;
+	self->stream_accumulator = 0;
     }
 }
 
-static void    status_merge_callback          (RemoteClient*     self,
-					       RemoteResponse*   response,
+static void    finish_merge_job               (MergeJob*         job)
+{
+    /* Back on the main loop. Let the server know it can send more,
+     * and update our download speed and compression statistics.
+     */
+    RemoteClient* self = job->client;
+
+    if (job->is_push) {
+	if (self->gconn == job->gconn)
+	    remote_client_notify(self, "histogram_ack");
+    }
+    else if (self->gconn == job->gconn) {
+	self->pending_stream_requests--;
+    }
+
+    if (job->raw_length)
+	remote_client_add_stream_stats(self, job->data_length, job->raw_length,
+				       job->encode_time, job->decode_time, job->merge_time);
+
+    g_object_unref(job->client);
+    g_object_unref(job->dest);
+    g_free(job->data);
+    g_free(job);
+}
+
+static gboolean merge_job_finished            (gpointer          user_data)
+{
+    finish_merge_job((MergeJob*) user_data);
+    return FALSE;
+}
+
+static void    merge_job_thread               (gpointer          data,
 					       gpointer          user_data)
 {
-    IterativeMap *dest = ITERATIVE_MAP(user_data);
+    decode_merge_job((MergeJob*) data);
+    g_idle_add_full(G_PRIORITY_DEFAULT, merge_job_finished, data, NULL);
+}
+
+static void    stream_staging_free            (gpointer          data)
+{
+    StreamStaging* staging = (StreamStaging*) data;
+
+    if (staging->buffer)
+	histogram_buffer_free(staging->buffer);
+    if (staging->lock)
+	g_mutex_free(staging->lock);
+    g_free(staging);
+}
+
+static StreamStaging* stream_staging_get      (HistogramImager*  dest)
+{
+    StreamStaging* staging = g_object_get_data(G_OBJECT(dest), "remote-client-staging");
+
+    if (!staging) {
+	staging = g_new0(StreamStaging, 1);
+	if (g_thread_supported())
+	    staging->lock = g_mutex_new();
+	g_object_set_data_full(G_OBJECT(dest), "remote-client-staging",
+			       staging, stream_staging_free);
+    }
+    return staging;
+}
+
+static gboolean remote_client_merge_stream    (RemoteClient*     self,
+					       HistogramImager*  dest,
+					       RemoteResponse*   response,
+					       gboolean          is_push)
+{
+    /* Queue a stream to be merged into dest's staging histogram. Returns
+     * FALSE if there was nothing worth merging, in which case nothing
+     * will be acknowledged for it later.
+     */
+    MergeJob* job;
+    int hist_width, hist_height;
+
+    if (!remote_client_is_current(self, response->message)) {
+	/* This data is for an old parameter set, ignore it */
+	return FALSE;
+    }
+
+    if (!response->data_length)
+	return FALSE;
+
+    histogram_imager_get_hist_size(dest, &hist_width, &hist_height);
+
+    job = g_new0(MergeJob, 1);
+    job->client = g_object_ref(self);
+    job->gconn = self->gconn;
+    job->dest = g_object_ref(dest);
+    job->staging = stream_staging_get(dest);
+    job->is_push = is_push;
+    job->is_compressed = self->stream_compression;
+    job->data = g_memdup(response->data, response->data_length);
+    job->data_length = response->data_length;
+    job->hist_width = hist_width;
+    job->hist_height = hist_height;
+    job->clear_serial = dest->clear_serial;
+
+    if (!merge_pool && g_thread_supported())
+	merge_pool = g_thread_pool_new(merge_job_thread, NULL, 1, FALSE, NULL);
+
+    if (merge_pool) {
+	g_thread_pool_push(merge_pool, job, NULL);
+    }
+    else {
+	decode_merge_job(job);
+	finish_merge_job(job);
+    }
+    return TRUE;
+}
+
+static void    remote_client_merge_status     (RemoteClient*     self,
+					       IterativeMap*     dest,
+					       const gchar*      status)
+{
     double iters, iter_delta;
     long density;
     double elapsed;
+    guint32 epoch;
+    const gchar* epoch_iters;
+    const gchar* quota;
 
-    sscanf(response->message, "iterations=%lf density=%ld", &iters, &density);
+    sscanf(status, "iterations=%lf density=%ld", &iters, &density);
 
-    /* FIXME: Since we don't know which parameters affect calculation, we don't
-     *        know when the node's iteration counter gets reset. We currently
-     *        assume that if it's value decreases, it's been reset.
+    /* Once the server has our latest quota, keep track of what's left.
+     * It stops reporting a quota when there's nothing left of it.
      */
-    if (iters >= self->prev_iterations) {
-	iter_delta = iters - self->prev_iterations;
+    if (!self->quota_pending) {
+	quota = strstr(status, "quota=");
+	self->quota_remaining = quota ? strtod(quota + 6, NULL) : 0;
+    }
+
+    epoch_iters = strstr(status, "epoch_iterations=");
+    if (epoch_iters && parse_epoch(status, &epoch)) {
+	/* The server counts iterations since the start of each epoch,
+	 * so we know exactly which ones belong to our parameters.
+	 */
+	if (!remote_client_is_current(self, status))
+	    return;
+	iters = strtod(epoch_iters + 17, NULL);
+
+	if (epoch != self->status_epoch) {
+	    self->status_epoch = epoch;
+	    self->prev_iterations = 0;
+	}
+	iter_delta = MAX(0, iters - self->prev_iterations);
+	self->prev_iterations = MAX(iters, self->prev_iterations);
     }
     else {
-	/* Assume it started at zero */
-	iter_delta = iters;
+	/* Older servers don't tell us when their iteration counter gets
+	 * reset. Assume that if its value decreases, it's been reset.
+	 */
+	if (iters >= self->prev_iterations) {
+	    iter_delta = iters - self->prev_iterations;
+	}
+	else {
+	    /* Assume it started at zero */
+	    iter_delta = iters;
+	}
+	self->prev_iterations = iters;
+
+	if (!remote_client_is_current(self, NULL))
+	    return;
     }
-    self->prev_iterations = iters;
 
-    if (self->pending_param_changes)
-	return;
     if (!iter_delta)
 	return;
 
@@ -547,11 +1328,159 @@ static void    status_merge_callback          (RemoteClient*     self,
     }
 }
 
+static void    histogram_merge_callback       (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    /* The request stays pending until its stream has been merged */
+    if (!remote_client_merge_stream(self, HISTOGRAM_IMAGER(user_data), response, FALSE))
+	self->pending_stream_requests--;
+}
+
+static void    shared_merge_callback          (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    /* The server has added its counts to a shared histogram, which we
+     * map the first time we hear of it. Servers too old for this, or
+     * without shared memory, get asked for streams from now on.
+     */
+    const gchar *name, *size;
+    gchar *name_copy;
+    GTimer *timer;
+
+    self->pending_stream_requests--;
+
+    name = response->code == FYRE_RESPONSE_OK ? strstr(response->message, "shm=") : NULL;
+    size = name ? strstr(response->message, "size=") : NULL;
+    if (!size) {
+	self->shared_failed = TRUE;
+	return;
+    }
+
+    name += 4;
+    name_copy = g_strndup(name, strcspn(name, " "));
+    if (!self->shared || strcmp(self->shared->name, name_copy)) {
+	if (self->shared)
+	    shared_histogram_free(self->shared);
+	self->shared = shared_histogram_open(name_copy, strtoul(size + 5, NULL, 10));
+    }
+    g_free(name_copy);
+
+    if (!self->shared) {
+	self->shared_failed = TRUE;
+	return;
+    }
+
+    if (remote_client_is_current(self, response->message)) {
+	/* This happens on the main loop, so it costs us just like a stream */
+	timer = g_timer_new();
+	histogram_imager_merge_buffer(HISTOGRAM_IMAGER(user_data), &self->shared->buffer);
+	remote_client_add_stream_stats(self, 0, 0, 0, 0, g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+    }
+    else
+	histogram_buffer_clear(&self->shared->buffer);
+}
+
+static void    status_merge_callback          (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    remote_client_merge_status(self, ITERATIVE_MAP(user_data), response->message);
+}
+
+static void    histogram_push_callback        (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    /* One histogram delta pushed by the server, with its status. Let
+     * it know once we're done with this one, so it can push another.
+     */
+    remote_client_merge_status(self, ITERATIVE_MAP(user_data), response->message);
+    if (!remote_client_merge_stream(self, HISTOGRAM_IMAGER(user_data), response, TRUE))
+	remote_client_notify(self, "histogram_ack");
+}
+
+static void    subscribe_callback             (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    /* From now on, pushes arrive with this request's ID. If the server
+     * can't push, go back to polling it.
+     */
+    self->is_subscribing = FALSE;
+
+    if (response->code == FYRE_RESPONSE_OK) {
+	self->subscription_id = self->frame_request_id;
+	self->subscription_dest = ITERATIVE_MAP(user_data);
+    }
+    else {
+	self->subscription_failed = TRUE;
+    }
+}
+
+void           remote_client_fold_results     (IterativeMap*     dest)
+{
+    /* Add everything staged so far to the map itself. If a stream is
+     * being merged into the staging histogram right now, we don't wait
+     * for it, the next safe point will pick it up.
+     */
+    StreamStaging* staging = g_object_get_data(G_OBJECT(dest), "remote-client-staging");
+
+    if (!staging || !g_mutex_trylock(staging->lock))
+	return;
+
+    if (staging->buffer) {
+	if (staging->clear_serial == HISTOGRAM_IMAGER(dest)->clear_serial)
+	    histogram_imager_merge_buffer(HISTOGRAM_IMAGER(dest), staging->buffer);
+	else
+	    histogram_buffer_clear(staging->buffer);
+    }
+    g_mutex_unlock(staging->lock);
+}
+
 void           remote_client_merge_results    (RemoteClient*     self,
 					       IterativeMap*     dest)
 {
     double elapsed;
 
+    if (self->is_local && !self->shared_failed) {
+	/* The server is on this machine, so it can share its histogram
+	 * with us in memory. Only one request can be outstanding, since
+	 * the server can't touch that histogram until we've emptied it.
+	 */
+	if (self->pending_stream_requests)
+	    return;
+	remote_client_command(self, status_merge_callback, dest,
+			      "calc_status");
+
+	elapsed = g_timer_elapsed(self->stream_request_timer, NULL);
+	if (elapsed < self->min_stream_interval)
+	    return;
+	g_timer_start(self->stream_request_timer);
+
+	self->pending_stream_requests++;
+	remote_client_command(self, shared_merge_callback, dest,
+			      "get_histogram_shm");
+	return;
+    }
+
+    if (self->protocol >= 2 && self->is_push_enabled && !self->subscription_failed) {
+	/* The server pushes results to us, we only need to (re)subscribe
+	 * when our stream interval changes.
+	 */
+	if (!self->is_subscribing &&
+	    (!self->subscription_id || self->subscribed_interval != self->min_stream_interval)) {
+	    self->is_subscribing = TRUE;
+	    self->subscribed_interval = self->min_stream_interval;
+	    remote_client_command(self, subscribe_callback, dest,
+				  "subscribe_histogram interval=%f bytes=%d window=%d format=vbyte",
+				  self->min_stream_interval, PUSH_BYTES, PUSH_WINDOW);
+	}
+	return;
+    }
+
     /* Don't let our stream requests get too backed up */
     if (self->pending_stream_requests >= 4)
 	return;
@@ -568,7 +1497,157 @@ void           remote_client_merge_results    (RemoteClient*     self,
 
     self->pending_stream_requests++;
     remote_client_command(self, histogram_merge_callback, dest,
-			  "get_histogram_stream");
+			  "get_histogram_stream vbyte");
+}
+
+static void    quota_callback                 (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    self->quota_pending = FALSE;
+
+    if (response->code == FYRE_RESPONSE_UNRECOGNIZED) {
+	/* This server is too old for quotas, let it run until it's stopped */
+	self->no_quota = TRUE;
+	self->quota_remaining = 0;
+	remote_client_command(self, NULL, NULL, "calc_start");
+    }
+}
+
+void           remote_client_set_quota        (RemoteClient*     self,
+					       double            iterations)
+{
+    /* Have the server calculate this many more iterations, then pause.
+     * Until it answers, status messages still describe the old quota.
+     */
+    self->quota_pending = TRUE;
+    self->quota_remaining = iterations;
+    remote_client_command(self, quota_callback, NULL, "calc_quota %.0f", iterations);
+}
+
+static void    histogram_preview_callback     (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    /* Every request gets exactly one callback, with a NULL preview if
+     * we didn't get a usable one, unless a newer request replaced it.
+     */
+    const gchar *width_str, *height_str;
+    guint width = 0, height = 0;
+    guint32 *preview = NULL;
+    RemotePreviewCallback callback = self->preview_callback;
+
+    if (GPOINTER_TO_UINT(user_data) != self->preview_serial || !callback)
+	return;
+    self->preview_callback = NULL;
+
+    /* Servers too old for previews don't get asked again */
+    if (response->code == FYRE_RESPONSE_UNRECOGNIZED)
+	self->no_preview = TRUE;
+
+    if (response->code == FYRE_RESPONSE_BINARY &&
+	remote_client_is_current(self, response->message)) {
+
+	width_str = strstr(response->message, "width=");
+	height_str = strstr(response->message, "height=");
+	if (width_str && height_str) {
+	    width = strtoul(width_str + 6, NULL, 10);
+	    height = strtoul(height_str + 7, NULL, 10);
+	}
+
+	/* Every bucket takes at least one byte */
+	if (width && height && (gsize) width * height <= response->data_length) {
+	    preview = g_new(guint32, width * height);
+	    if (!stream_vbyte_decode(response->data, response->data_length, preview, width * height)) {
+		g_free(preview);
+		preview = NULL;
+	    }
+	}
+    }
+
+    callback(self, preview, width, height, self->preview_user_data);
+    g_free(preview);
+}
+
+void           remote_client_cancel_preview   (RemoteClient*         self)
+{
+    RemotePreviewCallback callback = self->preview_callback;
+
+    if (!callback)
+	return;
+    self->preview_callback = NULL;
+    self->preview_serial++;
+    callback(self, NULL, 0, 0, self->preview_user_data);
+}
+
+void           remote_client_get_preview      (RemoteClient*         self,
+					       guint                 width,
+					       guint                 height,
+					       RemotePreviewCallback callback,
+					       gpointer              user_data)
+{
+    self->preview_serial++;
+
+    if (self->no_preview) {
+	self->preview_callback = NULL;
+	callback(self, NULL, 0, 0, user_data);
+	return;
+    }
+
+    self->preview_callback = callback;
+    self->preview_user_data = user_data;
+    remote_client_command(self, histogram_preview_callback, GUINT_TO_POINTER(self->preview_serial),
+			  "get_histogram_preview %u %u", width, height);
+}
+
+static const gchar* find_capability           (const gchar*      info,
+					       const gchar*      key)
+{
+    /* Find the value of "key=value" in a space-separated list */
+    const gchar* p = info;
+    gsize key_length = strlen(key);
+
+    while ((p = strstr(p, key))) {
+	if ((p == info || p[-1] == ' ') && p[key_length] == '=')
+	    return p + key_length + 1;
+	p += key_length;
+    }
+    return NULL;
+}
+
+void           remote_client_set_capabilities (RemoteClient*     self,
+					       const gchar*      info)
+{
+    /* Anything the server doesn't mention stays as it was, since its
+     * discovery reply may have told us more than an older ready message.
+     */
+    const gchar* value;
+
+    if ((value = find_capability(info, "cores")))
+	self->n_cores = strtoul(value, NULL, 10);
+    if ((value = find_capability(info, "memory")))
+	self->memory_mb = strtoul(value, NULL, 10);
+    if ((value = find_capability(info, "benchmark")))
+	self->benchmark_speed = g_ascii_strtod(value, NULL);
+    if ((value = find_capability(info, "streams"))) {
+	g_free(self->stream_encodings);
+	self->stream_encodings = g_strndup(value, strcspn(value, " "));
+
+	/* Don't bother asking for shared memory if it isn't there */
+	if (!strstr(self->stream_encodings, "shm"))
+	    self->shared_failed = TRUE;
+    }
+}
+
+void           remote_client_set_render_time  (RemoteClient*     self,
+					       double            seconds)
+{
+    if (self->render_time > 0 &&
+	fabs(seconds - self->render_time) < self->render_time * RENDER_TIME_HYSTERESIS)
+	return;
+
+    self->render_time = seconds;
+    remote_client_command(self, NULL, NULL, "set_render_time %f", seconds);
 }
 
 /* The End */
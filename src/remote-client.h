@@ -37,6 +37,7 @@
 #include "animation.h"
 #include "iterative-map.h"
 #include "remote-server.h"
+#include "shared-histogram.h"
 
 G_BEGIN_DECLS
 
@@ -64,17 +65,28 @@ typedef void   (*RemoteSpeedCallback)         (RemoteClient*     self,
 					       double            bytes_per_sec,
 					       gpointer          user_data);
 
+typedef void   (*RemotePreviewCallback)       (RemoteClient*     self,
+					       const guint32*    preview,
+					       guint             width,
+					       guint             height,
+					       gpointer          user_data);
+
 struct _RemoteClosure {
     RemoteCallback callback;
     gpointer       user_data;
+    guint32        id;
 };
 
 struct _RemoteClient {
     GObject               object;
 
     double                min_stream_interval;
+    double                min_param_interval;
     double                retry_timeout;
     gboolean              is_retry_enabled;
+    gboolean              is_compression_enabled;
+    gboolean              is_push_enabled;
+    gboolean              is_local;
 
     /* Private */
 
@@ -93,6 +105,55 @@ struct _RemoteClient {
     int                   pending_param_changes;
     int                   pending_stream_requests;
 
+    /* Parameter epochs, if the server tags its results with them.
+     * Only results from calc_epoch are merged, and only once all
+     * calculation parameter changes have been acknowledged.
+     */
+    int                   pending_calc_changes;
+    guint32               calc_epoch;
+    guint32               status_epoch;
+
+    /* Parameter changes waiting to be sent. Only the newest values
+     * are sent, and no more often than min_param_interval.
+     */
+    ParameterHolder*      param_source;
+    GPtrArray*            queued_params;
+    gboolean              queued_calc_params;
+    guint                 param_timer;
+    GTimer*               param_send_timer;
+    gboolean              no_set_params;
+
+    /* Iterations left in the quota we gave the server. quota_pending
+     * is set until it has acknowledged the latest one.
+     */
+    double                quota_remaining;
+    gboolean              quota_pending;
+    gboolean              no_quota;
+
+    /* The render time we last asked the server for, zero for its default */
+    double                render_time;
+
+    /* What the server told us about itself, in its ready message or its
+     * discovery reply. Zero or NULL for anything it didn't mention.
+     */
+    guint                 n_cores;
+    gulong                memory_mb;
+    double                benchmark_speed;
+    gchar*                stream_encodings;
+
+    /* The server keeps our session for a while if we're disconnected.
+     * 'session' is the one holding our work, and 'offered_session' is
+     * the new connection's own, until we know if we can resume.
+     */
+    gchar*                session;
+    gchar*                offered_session;
+
+    /* Only the answer to our newest preview request is passed on */
+    RemotePreviewCallback preview_callback;
+    gpointer              preview_user_data;
+    guint                 preview_serial;
+    gboolean              no_preview;
+
     GTimer*               stream_request_timer;
     double                prev_iterations;
     GTimer*               status_speed_timer;
@@ -102,8 +163,45 @@ struct _RemoteClient {
     double                iters_per_sec;
     double                bytes_per_sec;
 
+    /* Stream compression, if the server agreed to it. The ratio and
+     * per-stream times are averaged over the same window as our speeds.
+     * decode_time only covers decompression, while merge_time is all
+     * the time we spend on each stream or shared histogram.
+     */
+    gboolean              stream_compression;
+    double                raw_byte_accumulator;
+    double                encode_time_accumulator;
+    double                decode_time_accumulator;
+    double                merge_time_accumulator;
+    guint                 stream_accumulator;
+    double                compression_ratio;
+    double                encode_time;
+    double                decode_time;
+    double                merge_time;
+
     GQueue*               response_queue;
     RemoteResponse*       current_binary_response;
+
+    /* Protocol version 2 framing. Commands are formatted directly
+     * into command_buffer, after room for the frame header.
+     */
+    int                   protocol;
+    gboolean              reading_frame_body;
+    guint32               next_request_id;
+    guint32               frame_request_id;
+    gchar*                command_buffer;
+    gsize                 command_buffer_size;
+
+    /* Histograms shared in memory, if the server is on this machine */
+    SharedHistogram*      shared;
+    gboolean              shared_failed;
+
+    /* Server-pushed histograms, with protocol version 2 */
+    guint32               subscription_id;
+    gboolean              is_subscribing;
+    gboolean              subscription_failed;
+    double                subscribed_interval;
+    IterativeMap*         subscription_dest;
 };
 
 struct _RemoteClientClass {
@@ -149,11 +247,50 @@ void           remote_client_command          (RemoteClient*     self,
 void           remote_client_send_param       (RemoteClient*     self,
 					       ParameterHolder*  ph,
 					       const gchar*      name);
+void           remote_client_queue_param      (RemoteClient*     self,
+					       ParameterHolder*  ph,
+					       const gchar*      name);
+void           remote_client_flush_params     (RemoteClient*     self);
 void           remote_client_send_all_params  (RemoteClient*     self,
 					       ParameterHolder*  ph);
 void           remote_client_merge_results    (RemoteClient*     self,
 					       IterativeMap*     dest);
 
+/* Streams are merged into a staging histogram in the background.
+ * This adds whatever has arrived to the map itself, and must be
+ * called from the main loop while the map isn't calculating.
+ */
+void           remote_client_fold_results     (IterativeMap*     dest);
+void           remote_client_set_quota        (RemoteClient*     self,
+					       double            iterations);
+
+/* Ask for a coarse preview of the counts the server hasn't sent us yet.
+ * The callback gets width x height buckets in row order, or a NULL
+ * preview if the server doesn't support previews, the answer was for
+ * old parameters, it couldn't be decoded, or the connection was lost.
+ * It runs once per request, unless a newer request replaces it.
+ * remote_client_cancel_preview() answers an outstanding request with
+ * a NULL preview right away. Previews are already included in the
+ * results we merge later, so they're only good for showing something
+ * sooner.
+ */
+void           remote_client_get_preview      (RemoteClient*         self,
+					       guint                 width,
+					       guint                 height,
+					       RemotePreviewCallback callback,
+					       gpointer              user_data);
+void           remote_client_cancel_preview   (RemoteClient*         self);
+
+/* Take note of a server's capabilities, as described in remote-server.h */
+void           remote_client_set_capabilities (RemoteClient*     self,
+					       const gchar*      info);
+
+/* Change how long the server calculates between servicing its clients.
+ * Small changes aren't worth a command, so they're ignored.
+ */
+void           remote_client_set_render_time  (RemoteClient*     self,
+					       double            seconds);
+
 G_END_DECLS
 
 #endif /* __REMOTE_CLIENT_H__ */
@@ -40,14 +40,21 @@
 #include <gtk/gtk.h>
 #include <string.h>
 #include <stdlib.h>
+#include <zlib.h>
 #include "iterative-map.h"
 #include "gui-util.h"
 #include "histogram-view.h"
 #include "remote-server.h"
 #include "de-jong.h"
+#include "parallel.h"
+#include "cluster-model.h"
+#include "shared-histogram.h"
+#include "stream-vbyte.h"
 
 typedef struct _RemoteServer      RemoteServer;
 typedef struct _RemoteServerConn  RemoteServerConn;
+typedef struct _StreamJob         StreamJob;
+typedef struct _RetainedSession   RetainedSession;
 
 struct _RemoteServer {
     GServer*             gserver;
@@ -55,6 +62,22 @@ struct _RemoteServer {
     GHashTable*          gui_hash;
     gboolean             have_gtk;
     gboolean             verbose;
+
+    /* In relay mode, every connection's map farms out its work to these
+     * downstream nodes and merges their results, so we look like one
+     * node with all their speed combined.
+     */
+    const gchar*         relay_nodes;
+
+    /* Threads for encoding histogram streams, if we have threads at all */
+    GThreadPool*         stream_pool;
+
+    /* Sessions left behind by closed connections, by token, and
+     * oldest first along with the memory their histograms hold.
+     */
+    GHashTable*          sessions;
+    GQueue*              session_queue;
+    gsize                session_bytes;
 };
 
 struct _RemoteServerConn {
@@ -64,15 +87,148 @@ struct _RemoteServerConn {
     /* State we maintain on behalf of the client */
     IterativeMap*        map;
     ParameterHolderPair  frame;
+    ClusterModel*        relay;
+
+    /* Token a later connection can use to take over our map, along
+     * with its epoch, if this one closes. See retain_session().
+     */
+    gchar*               session;
 
     /* Temporary buffer for sending back histogram streams */
     guchar*              buffer;
     gsize                buffer_size;
 
+    /* The histogram stream currently being encoded, if any. Only one
+     * is encoded at a time. Commands that can't be reordered with
+     * streams wait in deferred_commands until it's been sent.
+     */
+    StreamJob*           stream_job;
+    GQueue*              deferred_commands;
+
+    /* Shared memory for get_histogram_shm, with clients on the same machine */
+    SharedHistogram*     shared;
+
+    /* Optional zlib compression for histogram streams, enabled with
+     * set_stream_compression. Compressed streams are assembled here.
+     */
+    int                  compression_level;
+    guchar*              zbuffer;
+    gsize                zbuffer_size;
+
     /* Optional GUI, enabled with set_gui_style */
     GtkWidget*           gui;
+
+    /* Framing state, once the client switches to protocol version 2.
+     * request_id is the ID our next response will be sent with.
+     */
+    int                  protocol;
+    gboolean             reading_frame_body;
+    guint32              request_id;
+    gchar*               command_buffer;
+    gsize                command_buffer_size;
+
+    /* Parameter epochs. The epoch advances whenever a parameter that
+     * affects calculation changes, and everything we report is tagged
+     * with it. epoch_iterations only counts iterations since then, as
+     * seen by update_epoch_iterations().
+     */
+    guint32              epoch;
+    gdouble              epoch_iterations;
+    gdouble              seen_iterations;
+    guint                seen_clear_serial;
+
+    /* Iteration quota. Calculation stops by itself once quota_remaining
+     * iterations have been done, so the client decides how much work
+     * we do without having to stop us in time.
+     */
+    gboolean             has_quota;
+    gdouble              quota_remaining;
+
+    /* Histogram push subscription. Nothing is pushed while 'push_window'
+     * pushes are waiting to be acknowledged.
+     */
+    guint32              subscription_id;
+    HistogramStreamFormat push_format;
+    gdouble              push_interval;
+    gulong               push_bytes;
+    int                  push_window;
+    int                  pushes_in_flight;
+    gdouble              push_points;
+    GTimer*              push_timer;
+    guint                push_timeout;
+};
+
+/* One histogram stream on its way to the client. The counts are
+ * detached from the map, so calculation carries on while they're
+ * encoded and compressed, normally on one of the server's stream
+ * threads. The job borrows the connection's buffers meanwhile,
+ * and outlives the connection if the client goes away first.
+ */
+struct _StreamJob {
+    RemoteServerConn*    conn;
+    RetainedSession*     session;
+    gboolean             is_orphaned;
+    IterativeMap*        map;
+    HistogramExport*     pending;
+    guint                clear_serial;
+    HistogramStreamFormat format;
+    int                  compression_level;
+    guint32              request_id;
+    guint32              epoch;
+    gchar*               push_status;
+
+    guchar*              buffer;
+    gsize                buffer_size;
+    guchar*              zbuffer;
+    gsize                zbuffer_size;
+
+    /* Results, pointing into one of the buffers above */
+    gsize                stream_size;
+    const guchar*        data;
+    gsize                data_size;
+};
+
+typedef struct {
+    guint32              request_id;
+    gchar*               line;
+} DeferredCommand;
+
+/* A connection's map, kept after the connection closes in case its
+ * client comes back for the counts we hadn't sent yet. If a stream
+ * was still being encoded, the map's export is tied up until it's
+ * done, so whoever resumes the session has to wait for it.
+ */
+struct _RetainedSession {
+    RemoteServer*        server;
+    gchar*               token;
+    IterativeMap*        map;
+    ClusterModel*        relay;
+    StreamJob*           stream_job;
+    guint                timeout;
+    gsize                bytes;
+
+    guint32              epoch;
+    gdouble              epoch_iterations;
+    gdouble              seen_iterations;
+    guint                seen_clear_serial;
 };
 
+/* How long our startup benchmark runs for, in seconds */
+#define BENCHMARK_SECONDS    0.25
+
+/* How long a relay waits at startup to hear from its downstream nodes */
+#define RELAY_PROBE_SECONDS  5.0
+
+/* Largest width or height get_histogram_preview will produce */
+#define MAX_PREVIEW_SIZE     1024
+
+/* How long a closed connection's session waits to be resumed, in
+ * seconds, and how much histogram memory all of them can hold at once,
+ * in megabytes. The oldest sessions are given up first to make room.
+ */
+#define SESSION_TIMEOUT      600
+#define MAX_SESSION_MEGABYTES 256
+
 typedef void      (*RemoteServerCallback)     (RemoteServerConn*     self,
 					       const char*           command,
 					       const char*           parameters);
@@ -85,6 +241,18 @@ static void       remote_server_callback      (GConn*                gconn,
 					       GConnEvent*           event,
 					       gpointer              user_data);
 static void       remote_server_disconnect    (RemoteServerConn*     self);
+static gboolean   retain_session              (RemoteServerConn*     self);
+static void       forget_session              (RetainedSession*      session);
+static void       retained_session_free       (RetainedSession*      session);
+static void       remote_server_read_next     (RemoteServerConn*     self);
+static gboolean   remote_server_recv_frame    (RemoteServerConn*     self,
+					       GConnEvent*           event);
+static void       remote_server_send_frame    (RemoteServerConn*     self,
+					       guint32               request_id,
+					       int                   response_code,
+					       const char*           message,
+					       const unsigned char*  data,
+					       unsigned long         length);
 static void       remote_server_dispatch_line (RemoteServerConn*     self,
 					       char*                 line);
 static void       remote_server_send_response (RemoteServerConn*     self,
@@ -92,6 +260,7 @@ static void       remote_server_send_response (RemoteServerConn*     self,
 					       const char*           response_message,
 					       ...);
 static void       remote_server_send_binary   (RemoteServerConn*     self,
+					       const char*           message,
 					       unsigned char*        data,
 					       unsigned long         length);
 static void       remote_server_add_command   (RemoteServer*         self,
@@ -103,21 +272,37 @@ static void       remote_server_add_gui       (RemoteServer*         self,
 static void       remote_server_init_commands (RemoteServer*         self);
 
 static void       gui_init_none               (RemoteServerConn*     self);
+static void       unsubscribe                 (RemoteServerConn*     self);
+static void       clear_quota                 (RemoteServerConn*     self);
+static void       start_stream_job            (RemoteServerConn*     self,
+					       guint32               request_id,
+					       HistogramStreamFormat format,
+					       const char*           push_status);
+static void       stream_job_thread           (gpointer              data,
+					       gpointer              user_data);
 static void       release_privileges          (RemoteServer*         self);
+static void       remote_server_run           (RemoteServer*         self);
 
 
 /************************************************************************************/
 /***************************************************************** I/O Layer ********/
 /************************************************************************************/
 
-void              remote_server_main_loop     (int        port_number,
-					       gboolean   have_gtk,
-					       gboolean   verbose)
+void              remote_server_main_loop     (int          port_number,
+					       gboolean     have_gtk,
+					       gboolean     verbose,
+					       const gchar* relay_nodes)
 {
     RemoteServer self;
 
     self.have_gtk = have_gtk;
     self.verbose = verbose;
+    self.relay_nodes = relay_nodes;
+
+    /* A relay has to wait for its nodes to find out what it can do. Do
+     * that now, rather than with the main loop running for a client.
+     */
+    remote_server_get_capabilities(relay_nodes);
 
     self.gserver = gnet_server_new(NULL, port_number,
 				   remote_server_connect, &self);
@@ -126,30 +311,209 @@ void              remote_server_main_loop     (int        port_number,
 	exit(1);
     }
 
-    self.command_hash = g_hash_table_new(g_str_hash, g_str_equal);
-    self.gui_hash = g_hash_table_new(g_str_hash, g_str_equal);
-    remote_server_init_commands(&self);
-
     if (self.verbose)
-	printf("Fyre server listening on port %d\n", port_number);
+	printf("Fyre server listening on port %d, using %d calculation threads\n",
+	       port_number, parallel_get_n_threads());
+    if (self.verbose && relay_nodes)
+	printf("Relaying work to %s\n", relay_nodes);
+
+    remote_server_run(&self);
+}
+
+static double     run_benchmark               (void)
+{
+    /* A short calculation with default parameters, using as many threads
+     * as our connections will, gives clients a rough idea of our speed
+     * before they've had a chance to measure it.
+     */
+    IterativeMap* map = ITERATIVE_MAP(de_jong_new());
+    GTimer* timer = g_timer_new();
+    double speed;
+
+    de_jong_set_calc_threads(DE_JONG(map), parallel_get_n_threads());
+    while (g_timer_elapsed(timer, NULL) < BENCHMARK_SECONDS)
+	iterative_map_calculate_timed(map, BENCHMARK_SECONDS / 4);
+    speed = map->iterations / g_timer_elapsed(timer, NULL);
+
+    g_timer_destroy(timer);
+    g_object_unref(map);
+    return speed;
+}
+
+static gboolean   sum_relay_nodes             (ClusterModel*  cluster,
+					       guint*         n_cores,
+					       gulong*        memory_mb,
+					       double*        speed)
+{
+    /* Add up what our downstream nodes have told us about themselves.
+     * Returns FALSE if any of them hasn't greeted us yet.
+     */
+    GtkTreeIter iter;
+    RemoteClient* client;
+    gboolean complete = TRUE;
+
+    *n_cores = 0;
+    *memory_mb = 0;
+    *speed = 0;
+
+    if (!gtk_tree_model_get_iter_first(GTK_TREE_MODEL(cluster), &iter))
+	return TRUE;
+    do {
+	gtk_tree_model_get(GTK_TREE_MODEL(cluster), &iter,
+			   CLUSTER_MODEL_CLIENT, &client,
+			   -1);
+	if (!client)
+	    continue;
+
+	if (client->benchmark_speed > 0) {
+	    *n_cores += client->n_cores;
+	    *memory_mb += client->memory_mb;
+	    *speed += client->benchmark_speed;
+	}
+	else
+	    complete = FALSE;
+	g_object_unref(client);
+    } while (gtk_tree_model_iter_next(GTK_TREE_MODEL(cluster), &iter));
+
+    return complete;
+}
+
+static void       probe_relay_nodes           (const gchar*   relay_nodes,
+					       guint*         n_cores,
+					       gulong*        memory_mb,
+					       double*        speed)
+{
+    /* As a relay, we look like one node with all our downstream nodes'
+     * resources, so clients give us enough work for all of them. Wait a
+     * little while for them to greet us. Any that don't answer in time
+     * aren't counted, and still get work once they come up.
+     */
+    IterativeMap* map = ITERATIVE_MAP(de_jong_new());
+    ClusterModel* cluster = cluster_model_get(map, TRUE);
+    GTimer* timer = g_timer_new();
+    guint relay_cores;
+    gulong relay_memory;
+    double relay_speed;
+
+    cluster_model_add_nodes(cluster, relay_nodes);
+    while (!sum_relay_nodes(cluster, &relay_cores, &relay_memory, &relay_speed) &&
+	   g_timer_elapsed(timer, NULL) < RELAY_PROBE_SECONDS) {
+	if (!g_main_context_iteration(NULL, FALSE))
+	    g_usleep(10000);
+    }
+
+    *n_cores += relay_cores;
+    *memory_mb += relay_memory;
+    *speed += relay_speed;
+
+    g_timer_destroy(timer);
+    g_object_unref(cluster);
+    g_object_unref(map);
+}
+
+const gchar*      remote_server_get_capabilities (const gchar* relay_nodes)
+{
+    static gchar* capabilities = NULL;
+    GString* str;
+    guint n_cores;
+    gulong memory_mb = 0;
+    double speed;
+
+    if (capabilities)
+	return capabilities;
+
+    n_cores = parallel_get_n_threads();
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    memory_mb = (double) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / (1 << 20);
+#endif
+    speed = run_benchmark();
+    if (relay_nodes)
+	probe_relay_nodes(relay_nodes, &n_cores, &memory_mb, &speed);
+
+    str = g_string_new(NULL);
+    g_string_append_printf(str, "cores=%u", n_cores);
+    if (memory_mb)
+	g_string_append_printf(str, " memory=%lu", memory_mb);
+    g_string_append(str, " maps=de-jong streams=var-int,vbyte,zlib");
+#ifdef HAVE_SHM_OPEN
+    g_string_append(str, ",shm");
+#endif
+    g_string_append_printf(str, " benchmark=%.3e", speed);
+
+    capabilities = g_string_free(str, FALSE);
+    return capabilities;
+}
+
+static gboolean   parent_watch_callback       (GIOChannel*    source,
+					       GIOCondition   condition,
+					       gpointer       data)
+{
+    /* Our parent never writes to us, so this means it's gone */
+    exit(0);
+    return FALSE;
+}
+
+void              remote_server_worker_loop   (gboolean     have_gtk)
+{
+    RemoteServer self;
+    GInetAddr* loopback;
+
+    self.have_gtk = have_gtk;
+    self.verbose = FALSE;
+    self.relay_nodes = NULL;
+
+    /* Only processes on this machine can reach us, on any free port */
+    loopback = gnet_inetaddr_new("127.0.0.1", 0);
+    self.gserver = gnet_server_new(loopback, 0, remote_server_connect, &self);
+    gnet_inetaddr_delete(loopback);
+    if (!self.gserver) {
+	fprintf(stderr, "Local worker unable to listen on the loopback interface!\n");
+	exit(1);
+    }
+
+    printf("port %d\n", gnet_tcp_socket_get_port(self.gserver->socket));
+    fflush(stdout);
+
+    g_io_add_watch(g_io_channel_unix_new(0), G_IO_IN | G_IO_HUP | G_IO_ERR,
+		   parent_watch_callback, NULL);
+
+    remote_server_run(&self);
+}
+
+static void       remote_server_run           (RemoteServer*  self)
+{
+    self->command_hash = g_hash_table_new(g_str_hash, g_str_equal);
+    self->gui_hash = g_hash_table_new(g_str_hash, g_str_equal);
+    self->sessions = g_hash_table_new(g_str_hash, g_str_equal);
+    self->session_queue = g_queue_new();
+    self->session_bytes = 0;
+    remote_server_init_commands(self);
+
+    self->stream_pool = NULL;
+    if (g_thread_supported())
+	self->stream_pool = g_thread_pool_new(stream_job_thread, NULL, -1, FALSE, NULL);
 
     /* At this point, now that we've bound to the port and such,
      * make sure we aren't running as a privileged user. If so,
      * ditch all privileges permanently.
      */
-    release_privileges(&self);
+    release_privileges(self);
 
-    if (have_gtk)
+    if (self->have_gtk)
 	gtk_main();
     else
 	g_main_loop_run(g_main_loop_new(NULL, FALSE));
 
-    if (self.verbose)
+    if (self->verbose)
 	printf("Fyre server shutting down.\n");
 
-    gnet_server_delete(self.gserver);
-    g_hash_table_destroy(self.command_hash);
-    g_hash_table_destroy(self.gui_hash);
+    gnet_server_delete(self->gserver);
+    if (self->stream_pool)
+	g_thread_pool_free(self->stream_pool, FALSE, TRUE);
+    g_hash_table_destroy(self->command_hash);
+    g_hash_table_destroy(self->gui_hash);
+    g_hash_table_destroy(self->sessions);
+    g_queue_free(self->session_queue);
 }
 
 
@@ -188,13 +552,37 @@ static void       remote_server_connect       (GServer*              gserver,
     self->server = (RemoteServer*) user_data;
     self->gconn = gconn;
     self->map = ITERATIVE_MAP(de_jong_new());
+    self->protocol = 1;
+    self->deferred_commands = g_queue_new();
+
+    /* Session tokens only need to be hard to guess */
+    self->session = g_strdup_printf("%08x%08x%08x%08x", g_random_int(), g_random_int(),
+				    g_random_int(), g_random_int());
+
+    /* Calculation runs on the whole thread pool by default. The
+     * threads only exist for the duration of each calculate call,
+     * so network I/O stays on the main loop in between.
+     */
+    de_jong_set_calc_threads(DE_JONG(self->map), parallel_get_n_threads());
+
+    /* As a relay, our map follows this connection's parameters and
+     * calculation state, passing them on to our own cluster. Their
+     * results get merged into our map as it calculates, so they flow
+     * upstream with our own.
+     */
+    if (self->server->relay_nodes) {
+	self->relay = cluster_model_get(self->map, TRUE);
+	cluster_model_add_nodes(self->relay, self->server->relay_nodes);
+    }
 
     gnet_conn_set_callback(gconn, remote_server_callback, self);
     gnet_conn_set_watch_error(gconn, TRUE);
-    gnet_conn_readline(gconn);
+    remote_server_read_next(self);
 
     remote_server_send_response(self, FYRE_RESPONSE_READY,
-				"Fyre rendering server ready");
+				"Fyre rendering server ready %s session=%s",
+				remote_server_get_capabilities(self->server->relay_nodes),
+				self->session);
 
     if (self->server->verbose)
 	printf("[%s:%d] Connected\n", gconn->hostname, gconn->port);
@@ -209,8 +597,11 @@ static void       remote_server_callback      (GConn*                gconn,
     switch (event->type) {
 
     case GNET_CONN_READ:
-	remote_server_dispatch_line(self, event->buffer);
-	gnet_conn_readline(gconn);
+	if (self->protocol < 2)
+	    remote_server_dispatch_line(self, event->buffer);
+	else if (!remote_server_recv_frame(self, event))
+	    break;
+	remote_server_read_next(self);
 	break;
 
     case GNET_CONN_CLOSE:
@@ -226,24 +617,207 @@ static void       remote_server_callback      (GConn*                gconn,
 
 static void       remote_server_disconnect    (RemoteServerConn*     self)
 {
+    DeferredCommand* deferred;
+
     if (self->server->verbose)
 	printf("[%s:%d] Disconnected\n", self->gconn->hostname, self->gconn->port);
 
     gnet_conn_delete(self->gconn);
     iterative_map_stop_calculation(self->map);
     gui_init_none(self);
+    unsubscribe(self);
+    clear_quota(self);
+    if (self->shared)
+	shared_histogram_free(self->shared);
+
+    while (!g_queue_is_empty(self->deferred_commands)) {
+	deferred = g_queue_pop_head(self->deferred_commands);
+	g_free(deferred->line);
+	g_free(deferred);
+    }
+    g_queue_free(self->deferred_commands);
+
+    if (!retain_session(self)) {
+	/* A stream still being encoded cleans up after itself */
+	if (self->stream_job)
+	    self->stream_job->conn = NULL;
+	if (self->relay)
+	    g_object_unref(self->relay);
+	g_object_unref(self->map);
+	g_free(self->session);
+    }
 
-    g_object_unref(self->map);
     if (self->buffer)
 	g_free(self->buffer);
+    if (self->zbuffer)
+	g_free(self->zbuffer);
+    if (self->command_buffer)
+	g_free(self->command_buffer);
     g_free(self);
 }
 
+static gboolean   session_timeout_callback    (gpointer              user_data)
+{
+    RetainedSession* session = (RetainedSession*) user_data;
+
+    if (session->server->verbose)
+	printf("Session %s expired\n", session->token);
+
+    session->timeout = 0;
+    forget_session(session);
+    retained_session_free(session);
+    return FALSE;
+}
+
+static gboolean   retain_session              (RemoteServerConn*     self)
+{
+    /* Keep a closed connection's map, with the counts it hasn't sent
+     * yet, until its client comes back with resume_session or we give
+     * up on it. Returns FALSE if it wasn't worth keeping.
+     */
+    RetainedSession* session;
+    HistogramImager* hi = HISTOGRAM_IMAGER(self->map);
+    gsize bytes, max_bytes = (gsize) MAX_SESSION_MEGABYTES << 20;
+
+    /* The histogram, and an export spare just as big */
+    bytes = sizeof(guint) * 2 * hi->hist_width * hi->hist_height;
+
+    if (self->map->iterations <= 0 || bytes > max_bytes)
+	return FALSE;
+
+    while (self->server->session_bytes + bytes > max_bytes) {
+	session = g_queue_peek_head(self->server->session_queue);
+	if (self->server->verbose)
+	    printf("Giving up session %s to make room\n", session->token);
+	forget_session(session);
+	retained_session_free(session);
+    }
+
+    session = g_new0(RetainedSession, 1);
+    session->server = self->server;
+    session->token = self->session;
+    session->map = self->map;
+    session->relay = self->relay;
+    session->epoch = self->epoch;
+    session->epoch_iterations = self->epoch_iterations;
+    session->seen_iterations = self->seen_iterations;
+    session->seen_clear_serial = self->seen_clear_serial;
+
+    session->stream_job = self->stream_job;
+    if (self->stream_job) {
+	self->stream_job->conn = NULL;
+	self->stream_job->session = session;
+    }
+
+    session->timeout = g_timeout_add(SESSION_TIMEOUT * 1000, session_timeout_callback, session);
+    session->bytes = bytes;
+    g_hash_table_insert(self->server->sessions, session->token, session);
+    g_queue_push_tail(self->server->session_queue, session);
+    self->server->session_bytes += bytes;
+
+    if (self->server->verbose)
+	printf("Keeping session %s for %d seconds\n", session->token, SESSION_TIMEOUT);
+    return TRUE;
+}
+
+static void       forget_session              (RetainedSession*      session)
+{
+    /* Take a session out of the server's lists, so it can be freed or resumed */
+    g_hash_table_remove(session->server->sessions, session->token);
+    g_queue_remove(session->server->session_queue, session);
+    session->server->session_bytes -= session->bytes;
+}
+
+static void       retained_session_free       (RetainedSession*      session)
+{
+    if (session->timeout)
+	g_source_remove(session->timeout);
+    if (session->stream_job)
+	session->stream_job->session = NULL;
+    if (session->relay)
+	g_object_unref(session->relay);
+    g_object_unref(session->map);
+    g_free(session->token);
+    g_free(session);
+}
+
+static void       remote_server_read_next     (RemoteServerConn*     self)
+{
+    /* Wait for the next command line, or the next part of a frame */
+    if (self->protocol < 2)
+	gnet_conn_readline(self->gconn);
+    else if (!self->reading_frame_body)
+	gnet_conn_readn(self->gconn, FYRE_FRAME_HEADER_SIZE);
+}
+
+static gboolean   remote_server_recv_frame    (RemoteServerConn*     self,
+					       GConnEvent*           event)
+{
+    /* Handle either a frame header or the command it introduces. Returns
+     * FALSE if the connection was closed because of a bad frame.
+     */
+    gsize command_length = event->length;
+    guint32 length;
+
+    if (!self->reading_frame_body) {
+	memcpy(&length, event->buffer, sizeof(length));
+	memcpy(&self->request_id, event->buffer + sizeof(length), sizeof(self->request_id));
+	length = GUINT32_FROM_BE(length);
+	self->request_id = GUINT32_FROM_BE(self->request_id);
+
+	if (length > FYRE_FRAME_MAX_LENGTH) {
+	    if (self->server->verbose)
+		printf("[%s:%d] Frame too large\n", self->gconn->hostname, self->gconn->port);
+	    remote_server_disconnect(self);
+	    return FALSE;
+	}
+	if (length > 0) {
+	    self->reading_frame_body = TRUE;
+	    gnet_conn_readn(self->gconn, length);
+	    return TRUE;
+	}
+
+	/* An empty frame has no command, only the header we just read */
+	command_length = 0;
+    }
+    self->reading_frame_body = FALSE;
+
+    /* Commands are still text, but we know exactly how long they are.
+     * Give them a terminator in a buffer we reuse for every frame.
+     */
+    if (self->command_buffer_size <= command_length) {
+	g_free(self->command_buffer);
+	self->command_buffer_size = MAX(command_length + 1, 256);
+	self->command_buffer = g_malloc(self->command_buffer_size);
+    }
+    memcpy(self->command_buffer, event->buffer, command_length);
+    self->command_buffer[command_length] = '\0';
+
+    remote_server_dispatch_line(self, self->command_buffer);
+    return TRUE;
+}
+
 static void       remote_server_dispatch_line (RemoteServerConn*     self,
 					       char*                line)
 {
     char* args;
     RemoteServerCallback callback;
+    DeferredCommand* deferred;
+
+    /* Parameter changes and stream requests must be answered in order
+     * with a stream that's still being encoded, or the client could
+     * mistake the old stream for results from the new parameters.
+     */
+    if (self->stream_job && (!strncmp(line, "set_param", 9) ||
+			     !strncmp(line, "get_histogram_stream", 20) ||
+			     !strncmp(line, "get_histogram_shm", 17) ||
+			     !strncmp(line, "resume_session", 14))) {
+	deferred = g_new(DeferredCommand, 1);
+	deferred->request_id = self->request_id;
+	deferred->line = g_strdup(line);
+	g_queue_push_head(self->deferred_commands, deferred);
+	return;
+    }
 
     args = strchr(line, ' ');
     if (args) {
@@ -276,21 +850,73 @@ static void       remote_server_send_response (RemoteServerConn*  self,
     full_message = g_strdup_vprintf(response_message, ap);
     va_end(ap);
 
-    line = g_strdup_printf("%d %s\n", response_code, full_message);
-
-    gnet_conn_write(self->gconn, line, strlen(line));
+    if (self->protocol >= 2) {
+	remote_server_send_frame(self, self->request_id, response_code, full_message, NULL, 0);
+    }
+    else {
+	line = g_strdup_printf("%d %s\n", response_code, full_message);
+	gnet_conn_write(self->gconn, line, strlen(line));
+	g_free(line);
+    }
 
     g_free(full_message);
-    g_free(line);
+}
+
+static void       remote_server_send_frame    (RemoteServerConn*     self,
+					       guint32               request_id,
+					       int                   response_code,
+					       const char*           message,
+					       const unsigned char*  data,
+					       unsigned long         length)
+{
+    /* Send one protocol version 2 response, tagged with the ID of
+     * the request it answers. Responses to requests with ID zero
+     * aren't sent at all.
+     */
+    guchar header[FYRE_FRAME_HEADER_SIZE + FYRE_FRAME_RESPONSE_SIZE];
+    guint32 frame_length, id;
+    guint16 code, message_length;
+    int write_size;
+
+    if (!request_id)
+	return;
+
+    message_length = MIN(strlen(message), G_MAXUINT16);
+    frame_length = GUINT32_TO_BE(FYRE_FRAME_RESPONSE_SIZE + message_length + length);
+    id = GUINT32_TO_BE(request_id);
+    code = GUINT16_TO_BE(response_code);
+    message_length = GUINT16_TO_BE(message_length);
+
+    memcpy(header,      &frame_length,   4);
+    memcpy(header + 4,  &id,             4);
+    memcpy(header + 8,  &code,           2);
+    memcpy(header + 10, &message_length, 2);
+    gnet_conn_write(self->gconn, header, sizeof(header));
+    gnet_conn_write(self->gconn, (gchar*) message, GUINT16_FROM_BE(message_length));
+
+    while (length > 0) {
+	write_size = MIN(length, 4096);
+	gnet_conn_write(self->gconn, (gchar*) data, write_size);
+	length -= write_size;
+	data += write_size;
+    }
 }
 
 static void       remote_server_send_binary   (RemoteServerConn*  self,
+					       const char*        message,
 					       unsigned char*     data,
 					       unsigned long      length)
 {
     int write_size;
+
+    if (self->protocol >= 2) {
+	/* Frames already know their length, no need for a separate line */
+	remote_server_send_frame(self, self->request_id, FYRE_RESPONSE_BINARY, message, data, length);
+	return;
+    }
+
     remote_server_send_response(self, FYRE_RESPONSE_BINARY,
-				"%d byte binary response", length);
+				"%d byte binary response %s", length, message);
     while (length > 0) {
 	write_size = MIN(length, 4096);
 	gnet_conn_write(self->gconn, data, write_size);
@@ -346,12 +972,156 @@ static void connect_map_to_view(IterativeMap *map, HistogramView *view)
 /******************************************************** Command Implementations ***/
 /************************************************************************************/
 
+static void       update_epoch_iterations (RemoteServerConn*  self)
+{
+    /* Add up the iterations since we last looked. If the map has been
+     * cleared, its iteration count started over from zero.
+     */
+    HistogramImager* hi = HISTOGRAM_IMAGER(self->map);
+    gdouble iterations = self->map->iterations;
+    gdouble delta;
+
+    if (hi->clear_serial != self->seen_clear_serial || iterations < self->seen_iterations)
+	delta = iterations;
+    else
+	delta = iterations - self->seen_iterations;
+
+    self->epoch_iterations += delta;
+    if (self->has_quota)
+	self->quota_remaining -= delta;
+
+    self->seen_iterations = iterations;
+    self->seen_clear_serial = hi->clear_serial;
+}
+
+static void       advance_epoch        (RemoteServerConn*  self)
+{
+    /* Everything so far belongs to the old epoch. If the map is going
+     * to start over, it would normally wait until its next calculation
+     * step. Start over right away instead, so nothing calculated with
+     * the old parameters can be reported under the new epoch.
+     */
+    update_epoch_iterations(self);
+
+    if (DE_JONG(self->map)->calc_dirty_flag && HISTOGRAM_IMAGER(self->map)->decay_half_life <= 0) {
+	histogram_imager_clear(HISTOGRAM_IMAGER(self->map));
+	self->map->iterations = 0;
+    }
+
+    self->epoch++;
+    self->epoch_iterations = 0;
+    update_epoch_iterations(self);
+}
+
+static gchar*     calc_status_message  (RemoteServerConn*  self)
+{
+    update_epoch_iterations(self);
+    if (self->has_quota)
+	return g_strdup_printf("iterations=%.20e density=%ld epoch=%u epoch_iterations=%.20e quota=%.20e",
+			       self->map->iterations, HISTOGRAM_IMAGER(self->map)->peak_density,
+			       self->epoch, self->epoch_iterations, MAX(0, self->quota_remaining));
+    return g_strdup_printf("iterations=%.20e density=%ld epoch=%u epoch_iterations=%.20e",
+			   self->map->iterations, HISTOGRAM_IMAGER(self->map)->peak_density,
+			   self->epoch, self->epoch_iterations);
+}
+
 static void       cmd_set_param        (RemoteServerConn*  self,
 					const char*        command,
 					const char*        parameters)
 {
-    parameter_holder_set_from_line(PARAMETER_HOLDER(self->map), parameters);
-    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
+    GParamSpec* changed = parameter_holder_set_from_line(PARAMETER_HOLDER(self->map), parameters);
+
+    /* Render-only parameters, like colors, don't change the epoch */
+    if (changed && (changed->flags & PARAM_CALCULATION))
+	advance_epoch(self);
+
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok epoch=%u", self->epoch);
+}
+
+static void       cmd_set_params       (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Set any number of parameters, separated by semicolons, as one
+     * transaction. The map only starts over once, no matter how many
+     * of them affect calculation.
+     */
+    gchar** lines = g_strsplit(parameters, ";", 0);
+    gchar** line;
+    GParamSpec* changed;
+    gboolean calc_changed = FALSE;
+
+    g_object_freeze_notify(G_OBJECT(self->map));
+    for (line=lines; *line; line++) {
+	changed = parameter_holder_set_from_line(PARAMETER_HOLDER(self->map), *line);
+	if (changed && (changed->flags & PARAM_CALCULATION))
+	    calc_changed = TRUE;
+    }
+    g_object_thaw_notify(G_OBJECT(self->map));
+    g_strfreev(lines);
+
+    if (calc_changed)
+	advance_epoch(self);
+
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok epoch=%u", self->epoch);
+}
+
+static void       cmd_resume_session   (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Take over a session left behind by a closed connection, in place
+     * of the one we started with. Our own map hasn't had a chance to do
+     * anything worth keeping, since this comes right after negotiation.
+     */
+    RetainedSession* session = g_hash_table_lookup(self->server->sessions, parameters);
+
+    if (!session) {
+	remote_server_send_response(self, FYRE_RESPONSE_FALSE, "No such session");
+	return;
+    }
+    forget_session(session);
+    g_source_remove(session->timeout);
+
+    gui_init_none(self);
+    unsubscribe(self);
+    clear_quota(self);
+    iterative_map_stop_calculation(self->map);
+    if (self->relay)
+	g_object_unref(self->relay);
+    g_object_unref(self->map);
+    g_free(self->session);
+
+    self->session = session->token;
+    self->map = session->map;
+    self->relay = session->relay;
+    self->epoch = session->epoch;
+    self->epoch_iterations = session->epoch_iterations;
+    self->seen_iterations = session->seen_iterations;
+    self->seen_clear_serial = session->seen_clear_serial;
+
+    /* A stream from the old connection is still being encoded. Nobody
+     * gets it, but it holds the map's export until it's done, so it
+     * stands in for one of ours until then.
+     */
+    if (session->stream_job) {
+	g_free(self->buffer);
+	g_free(self->zbuffer);
+	self->buffer = NULL;
+	self->zbuffer = NULL;
+	self->zbuffer_size = 0;
+
+	self->stream_job = session->stream_job;
+	self->stream_job->conn = self;
+	self->stream_job->session = NULL;
+	self->stream_job->is_orphaned = TRUE;
+    }
+    g_free(session);
+
+    if (self->server->verbose)
+	printf("[%s:%d] Resumed session %s\n", self->gconn->hostname, self->gconn->port, self->session);
+
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok epoch=%u", self->epoch);
 }
 
 static void       cmd_set_render_time  (RemoteServerConn*  self,
@@ -362,6 +1132,24 @@ static void       cmd_set_render_time  (RemoteServerConn*  self,
     remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
 }
 
+static void       cmd_set_calc_threads (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    int n_threads = atoi(parameters);
+    guint available = parallel_get_n_threads();
+
+    if (n_threads < 1) {
+	remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "thread count must be positive");
+	return;
+    }
+
+    /* Silently clamp to the pool size, and tell the client what it got */
+    de_jong_set_calc_threads(DE_JONG(self->map), MIN((guint) n_threads, available));
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "calc_threads=%d available=%d",
+				DE_JONG(self->map)->calc_threads, available);
+}
+
 static void       cmd_calc_start       (RemoteServerConn*  self,
 					const char*        command,
 					const char*        parameters)
@@ -369,6 +1157,55 @@ static void       cmd_calc_start       (RemoteServerConn*  self,
     if (self->server->verbose)
 	printf("[%s:%d] Starting calculation\n", self->gconn->hostname, self->gconn->port);
 
+    clear_quota(self);
+    iterative_map_start_calculation(self->map);
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
+}
+
+static void       on_quota_calc_finished (IterativeMap*      map,
+					  RemoteServerConn*  self)
+{
+    update_epoch_iterations(self);
+    if (self->quota_remaining > 0)
+	return;
+
+    if (self->server->verbose)
+	printf("[%s:%d] Quota finished, pausing calculation\n",
+	       self->gconn->hostname, self->gconn->port);
+
+    clear_quota(self);
+    iterative_map_stop_calculation(self->map);
+}
+
+static void       clear_quota          (RemoteServerConn*  self)
+{
+    if (!self->has_quota)
+	return;
+
+    g_signal_handlers_disconnect_by_func(self->map, G_CALLBACK(on_quota_calc_finished), self);
+    self->has_quota = FALSE;
+}
+
+static void       cmd_calc_quota       (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Calculate this many more iterations, then pause. This replaces any
+     * quota we already had, rather than adding to it.
+     */
+    gdouble quota = g_ascii_strtod(parameters, NULL);
+
+    if (quota <= 0) {
+	remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "Quota must be positive");
+	return;
+    }
+
+    update_epoch_iterations(self);
+    if (!self->has_quota)
+	g_signal_connect(self->map, "calculation-finished", G_CALLBACK(on_quota_calc_finished), self);
+    self->has_quota = TRUE;
+    self->quota_remaining = quota;
+
     iterative_map_start_calculation(self->map);
     remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
 }
@@ -380,6 +1217,7 @@ static void       cmd_calc_stop        (RemoteServerConn*  self,
     if (self->server->verbose)
 	printf("[%s:%d] Pausing calculation\n", self->gconn->hostname, self->gconn->port);
 
+    clear_quota(self);
     iterative_map_stop_calculation(self->map);
     remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
 }
@@ -401,20 +1239,177 @@ static void       cmd_calc_status      (RemoteServerConn*  self,
 					const char*        command,
 					const char*        parameters)
 {
+    gchar* status;
+
     if (self->server->verbose)
-	printf("[%s:%d]  iterations: %.5e  density: %ld\n",
+	printf("[%s:%d]  iterations: %.5e  density: %ld  epoch: %u\n",
 	       self->gconn->hostname, self->gconn->port,
-	       self->map->iterations, HISTOGRAM_IMAGER(self->map)->peak_density);
+	       self->map->iterations, HISTOGRAM_IMAGER(self->map)->peak_density, self->epoch);
 
-    remote_server_send_response(self, FYRE_RESPONSE_PROGRESS, "iterations=%.20e density=%ld",
-				self->map->iterations, HISTOGRAM_IMAGER(self->map)->peak_density);
+    status = calc_status_message(self);
+    remote_server_send_response(self, FYRE_RESPONSE_PROGRESS, "%s", status);
+    g_free(status);
 }
 
-static void       cmd_get_histogram_stream (RemoteServerConn*  self,
-					    const char*        command,
-					    const char*        parameters)
+static void       encode_stream_job        (StreamJob*         job)
 {
-    gsize size;
+    /* Encode, and optionally compress, the counts this job detached.
+     * This only touches the job itself, so it may run on any thread.
+     * Compressed streams start with the header described in
+     * remote-server.h.
+     */
+    GTimer* timer;
+    uLongf zsize;
+    gulong usec;
+    guchar* header;
+
+    job->stream_size = histogram_export_stream(job->pending, job->format,
+					       job->buffer, job->buffer_size);
+    job->data = job->buffer;
+    job->data_size = job->stream_size;
+
+    if (!job->compression_level || !job->stream_size)
+	return;
+
+    timer = g_timer_new();
+    zsize = compressBound(job->stream_size);
+    if (job->zbuffer_size < zsize + FYRE_STREAM_COMPRESSION_HEADER) {
+	g_free(job->zbuffer);
+	job->zbuffer_size = zsize + FYRE_STREAM_COMPRESSION_HEADER;
+	job->zbuffer = g_malloc(job->zbuffer_size);
+    }
+
+    if (compress2(job->zbuffer + FYRE_STREAM_COMPRESSION_HEADER, &zsize,
+		  job->buffer, job->stream_size, job->compression_level) != Z_OK) {
+	/* This can only fail if we run out of memory,
+	 * in which case this batch of samples is lost.
+	 */
+	job->data = NULL;
+	job->data_size = 0;
+	g_timer_destroy(timer);
+	return;
+    }
+
+    usec = g_timer_elapsed(timer, NULL) * 1000000;
+    g_timer_destroy(timer);
+
+    header = job->zbuffer;
+    header[0] = job->stream_size >> 24;
+    header[1] = job->stream_size >> 16;
+    header[2] = job->stream_size >> 8;
+    header[3] = job->stream_size;
+    header[4] = usec >> 24;
+    header[5] = usec >> 16;
+    header[6] = usec >> 8;
+    header[7] = usec;
+
+    job->data = job->zbuffer;
+    job->data_size = zsize + FYRE_STREAM_COMPRESSION_HEADER;
+}
+
+static void       finish_stream_job        (StreamJob*         job)
+{
+    /* Back on the main loop. Return the counts to the map, then send
+     * the stream and catch up on any commands that were waiting for it,
+     * if anyone's still there.
+     */
+    RemoteServerConn* self = job->conn;
+    HistogramImager* hi = HISTOGRAM_IMAGER(job->map);
+    DeferredCommand* deferred;
+    guint32 request_id;
+    gchar* message;
+    gdouble points;
+
+    /* If the connection closed first, but its session lives on, put the
+     * counts back for whoever resumes it. They were already counted as
+     * plotted, and they're only worth keeping if the map hasn't since
+     * been cleared.
+     */
+    if ((job->session || job->is_orphaned) && job->stream_size &&
+	job->clear_serial == hi->clear_serial) {
+	points = hi->total_points_plotted;
+	histogram_imager_merge_stream(hi, job->buffer, job->stream_size);
+	hi->total_points_plotted = points;
+    }
+
+    histogram_imager_attach_export(hi, job->pending);
+    if (job->session)
+	job->session->stream_job = NULL;
+
+    if (self && !job->is_orphaned) {
+	if (job->push_status)
+	    remote_server_send_frame(self, self->subscription_id, FYRE_RESPONSE_BINARY,
+				     job->push_status, job->data, job->data_size);
+	else {
+	    message = g_strdup_printf("epoch=%u", job->epoch);
+	    if (self->protocol >= 2)
+		remote_server_send_frame(self, job->request_id, FYRE_RESPONSE_BINARY,
+					 message, job->data, job->data_size);
+	    else
+		remote_server_send_binary(self, message, (unsigned char*) job->data, job->data_size);
+	    g_free(message);
+	}
+    }
+
+    if (self) {
+	/* If we used more than half the buffer, double its size.
+	 * This ensures that if we do run out of room, we'll have plenty
+	 * of space to send the remainder of the buffer next time.
+	 */
+	if (job->stream_size > (job->buffer_size / 2)) {
+	    g_free(job->buffer);
+	    job->buffer_size *= 2;
+	    job->buffer = g_malloc(job->buffer_size);
+	}
+
+	self->buffer = job->buffer;
+	self->buffer_size = job->buffer_size;
+	self->zbuffer = job->zbuffer;
+	self->zbuffer_size = job->zbuffer_size;
+	self->stream_job = NULL;
+    }
+    else {
+	g_free(job->buffer);
+	g_free(job->zbuffer);
+    }
+
+    g_object_unref(job->map);
+    g_free(job->push_status);
+    g_free(job);
+
+    if (!self)
+	return;
+
+    request_id = self->request_id;
+    while (!self->stream_job && !g_queue_is_empty(self->deferred_commands)) {
+	deferred = g_queue_pop_tail(self->deferred_commands);
+	self->request_id = deferred->request_id;
+	remote_server_dispatch_line(self, deferred->line);
+	g_free(deferred->line);
+	g_free(deferred);
+    }
+    self->request_id = request_id;
+}
+
+static gboolean   stream_job_finished      (gpointer           user_data)
+{
+    finish_stream_job((StreamJob*) user_data);
+    return FALSE;
+}
+
+static void       stream_job_thread        (gpointer           data,
+					    gpointer           user_data)
+{
+    encode_stream_job((StreamJob*) data);
+    g_idle_add_full(G_PRIORITY_DEFAULT, stream_job_finished, data, NULL);
+}
+
+static void       start_stream_job         (RemoteServerConn*  self,
+					    guint32            request_id,
+					    HistogramStreamFormat format,
+					    const char*        push_status)
+{
+    StreamJob* job = g_new0(StreamJob, 1);
 
     if (!self->buffer) {
 	/* Allocate it with an initial size of 128kB */
@@ -422,19 +1417,326 @@ static void       cmd_get_histogram_stream (RemoteServerConn*  self,
 	self->buffer = g_malloc(self->buffer_size);
     }
 
-    size = histogram_imager_export_stream(HISTOGRAM_IMAGER(self->map),
-					  self->buffer, self->buffer_size);
-    remote_server_send_binary(self, self->buffer, size);
+    job->conn = self;
+    job->map = g_object_ref(self->map);
+    job->pending = histogram_imager_detach_export(HISTOGRAM_IMAGER(self->map));
+    job->clear_serial = HISTOGRAM_IMAGER(self->map)->clear_serial;
+    job->format = format;
+    job->compression_level = self->compression_level;
+    job->request_id = request_id;
+    job->epoch = self->epoch;
+    job->push_status = g_strdup(push_status);
+
+    job->buffer = self->buffer;
+    job->buffer_size = self->buffer_size;
+    job->zbuffer = self->zbuffer;
+    job->zbuffer_size = self->zbuffer_size;
+    self->buffer = NULL;
+    self->zbuffer = NULL;
+    self->zbuffer_size = 0;
+    self->stream_job = job;
+
+    /* Version 1 clients match responses to requests by their order,
+     * so their streams have to be finished before the next command.
+     */
+    if (self->server->stream_pool && self->protocol >= 2) {
+	g_thread_pool_push(self->server->stream_pool, job, NULL);
+    }
+    else {
+	encode_stream_job(job);
+	finish_stream_job(job);
+    }
+}
+
+static void       cmd_get_histogram_stream (RemoteServerConn*  self,
+					    const char*        command,
+					    const char*        parameters)
+{
+    HistogramStreamFormat format = HISTOGRAM_STREAM_VAR_INT;
 
-    /* If we used more than half the buffer, double its size.
-     * This ensures that if we do run out of room, we'll have plenty
-     * of space to send the remainder of the buffer next time.
+    /* Clients that can merge stream VByte blocks ask for them by name.
+     * Older servers ignore the argument and send var-ints, which the
+     * client can tell apart by the stream's first byte.
      */
-    if (size > (self->buffer_size / 2)) {
-	g_free(self->buffer);
-	self->buffer_size *= 2;
-	self->buffer = g_malloc(self->buffer_size);
+    if (!strcmp(parameters, "vbyte"))
+	format = HISTOGRAM_STREAM_VBYTE;
+
+    start_stream_job(self, self->request_id, format, NULL);
+}
+
+static void       cmd_get_histogram_shm    (RemoteServerConn*  self,
+					    const char*        command,
+					    const char*        parameters)
+{
+    /* For clients on the same machine. Rather than encoding a stream,
+     * add our new counts to a histogram in shared memory and tell the
+     * client where it is. The client empties it again before asking
+     * for more, so only one of us touches it at a time.
+     */
+    HistogramImager* hi = HISTOGRAM_IMAGER(self->map);
+    HistogramExport* pending = histogram_imager_detach_export(hi);
+
+    if (self->shared && (self->shared->buffer.hist_width != hi->hist_width ||
+			 self->shared->buffer.hist_height != hi->hist_height)) {
+	shared_histogram_free(self->shared);
+	self->shared = NULL;
+    }
+    if (!self->shared)
+	self->shared = shared_histogram_new(hi->hist_width, hi->hist_height);
+
+    if (!self->shared) {
+	histogram_imager_attach_export(hi, pending);
+	remote_server_send_response(self, FYRE_RESPONSE_UNSUPPORTED,
+				    "Shared memory is not available");
+	return;
+    }
+
+    /* A leftover export that doesn't match the shared buffer would be
+     * handed back to us every time, so nothing newer ever got through.
+     * Its counts are for a size we've moved on from anyway.
+     */
+    if (!histogram_export_add(pending, &self->shared->buffer)) {
+	histogram_imager_drop_export(hi, pending);
+	pending = histogram_imager_detach_export(hi);
+
+	if (!histogram_export_add(pending, &self->shared->buffer)) {
+	    histogram_imager_drop_export(hi, pending);
+	    remote_server_send_response(self, FYRE_RESPONSE_FALSE,
+					"Shared histogram size mismatch");
+	    return;
+	}
+    }
+    histogram_imager_attach_export(hi, pending);
+
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "shm=%s size=%lu epoch=%u",
+				self->shared->name, (unsigned long) self->shared->size, self->epoch);
+}
+
+static void       cmd_get_histogram_preview (RemoteServerConn*  self,
+					     const char*        command,
+					     const char*        parameters)
+{
+    /* A coarse picture of the counts we haven't sent yet, block-summed
+     * down to the requested size, for clients that want something to
+     * show before full-resolution streams arrive. The counts stay put,
+     * and still go out with the next stream. Buckets are sent as one
+     * block of stream VByte integers, row by row.
+     */
+    guint width = 0, height = 0;
+    guint32* preview;
+    guchar* data;
+    gsize size;
+    gchar* message;
+
+    sscanf(parameters, "%u %u", &width, &height);
+    if (width < 1 || height < 1 || width > MAX_PREVIEW_SIZE || height > MAX_PREVIEW_SIZE) {
+	remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "Bad preview size");
+	return;
+    }
+
+    preview = g_new0(guint32, width * height);
+    histogram_imager_add_preview(HISTOGRAM_IMAGER(self->map), preview, width, height);
+
+    data = g_malloc(STREAM_VBYTE_MAX_SIZE(width * height));
+    size = stream_vbyte_encode(preview, width * height, data);
+
+    message = g_strdup_printf("epoch=%u width=%u height=%u", self->epoch, width, height);
+    remote_server_send_binary(self, message, data, size);
+
+    g_free(message);
+    g_free(data);
+    g_free(preview);
+}
+
+static void       push_histogram           (RemoteServerConn*  self)
+{
+    /* Push a histogram delta to our subscriber, if we have room in the
+     * flow control window and it's either been long enough or we expect
+     * enough data. We don't know the size of a delta without encoding
+     * it, so estimate it from the number of samples plotted since our
+     * last push, at about two bytes each.
+     */
+    HistogramImager *hi = HISTOGRAM_IMAGER(self->map);
+    gchar *status;
+
+    if (!self->subscription_id || self->pushes_in_flight >= self->push_window)
+	return;
+
+    /* Wait for the stream we're already encoding. We'll be back here
+     * as soon as the next calculation step finishes.
+     */
+    if (self->stream_job)
+	return;
+
+    if (hi->total_points_plotted < self->push_points)
+	self->push_points = 0;
+    if (hi->total_points_plotted == self->push_points)
+	return;
+
+    if (g_timer_elapsed(self->push_timer, NULL) < self->push_interval &&
+	(!self->push_bytes || (hi->total_points_plotted - self->push_points) * 2 < self->push_bytes))
+	return;
+
+    g_timer_start(self->push_timer);
+    self->push_points = hi->total_points_plotted;
+    self->pushes_in_flight++;
+
+    status = calc_status_message(self);
+    start_stream_job(self, 0, self->push_format, status);
+    g_free(status);
+}
+
+static void       on_push_calc_finished    (IterativeMap*      map,
+					    RemoteServerConn*  self)
+{
+    push_histogram(self);
+}
+
+static gboolean   push_timeout_callback    (gpointer           user_data)
+{
+    /* Also check periodically, so the last samples still
+     * get pushed after calculation has stopped.
+     */
+    push_histogram((RemoteServerConn*) user_data);
+    return TRUE;
+}
+
+static void       unsubscribe              (RemoteServerConn*  self)
+{
+    if (!self->subscription_id)
+	return;
+
+    g_signal_handlers_disconnect_by_func(self->map, G_CALLBACK(on_push_calc_finished), self);
+    g_source_remove(self->push_timeout);
+    g_timer_destroy(self->push_timer);
+    self->subscription_id = 0;
+}
+
+static void       cmd_subscribe_histogram  (RemoteServerConn*  self,
+					    const char*        command,
+					    const char*        parameters)
+{
+    /* Start pushing histogram deltas, or change the settings of an
+     * existing subscription. Parameters are key=value pairs:
+     *
+     *   interval   Longest time between pushes, in seconds
+     *   bytes      Push sooner, once about this much data is waiting
+     *   window     How many pushes can be waiting to be acknowledged
+     *   format     'vbyte' or 'varint'
+     */
+    gchar **tokens, **token;
+    gchar *value;
+
+    if (self->protocol < 2) {
+	/* Pushed responses need request IDs */
+	remote_server_send_response(self, FYRE_RESPONSE_UNSUPPORTED,
+				    "Subscriptions require protocol version 2");
+	return;
     }
+
+    unsubscribe(self);
+    self->push_interval = 1.0;
+    self->push_bytes = 0;
+    self->push_window = 2;
+    self->push_format = HISTOGRAM_STREAM_VAR_INT;
+
+    tokens = g_strsplit(parameters, " ", 0);
+    for (token=tokens; *token; token++) {
+	value = strchr(*token, '=');
+	if (!value)
+	    continue;
+	*(value++) = '\0';
+
+	if (!strcmp(*token, "interval"))
+	    self->push_interval = atof(value);
+	else if (!strcmp(*token, "bytes"))
+	    self->push_bytes = strtoul(value, NULL, 10);
+	else if (!strcmp(*token, "window"))
+	    self->push_window = MAX(atoi(value), 1);
+	else if (!strcmp(*token, "format") && !strcmp(value, "vbyte"))
+	    self->push_format = HISTOGRAM_STREAM_VBYTE;
+    }
+    g_strfreev(tokens);
+
+    self->push_interval = CLAMP(self->push_interval, 0.01, 3600);
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "Subscribed");
+
+    self->subscription_id = self->request_id;
+    self->pushes_in_flight = 0;
+    self->push_points = HISTOGRAM_IMAGER(self->map)->total_points_plotted;
+    self->push_timer = g_timer_new();
+    self->push_timeout = g_timeout_add(self->push_interval * 1000, push_timeout_callback, self);
+    g_signal_connect(self->map, "calculation-finished", G_CALLBACK(on_push_calc_finished), self);
+}
+
+static void       cmd_unsubscribe_histogram (RemoteServerConn*  self,
+					     const char*        command,
+					     const char*        parameters)
+{
+    unsubscribe(self);
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "Unsubscribed");
+}
+
+static void       cmd_histogram_ack        (RemoteServerConn*  self,
+					    const char*        command,
+					    const char*        parameters)
+{
+    /* The client has merged one of our pushes. This is normally sent
+     * with a request ID of zero, so it doesn't get a response.
+     */
+    if (self->pushes_in_flight > 0)
+	self->pushes_in_flight--;
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
+    push_histogram(self);
+}
+
+static void       cmd_set_stream_compression (RemoteServerConn*  self,
+					      const char*        command,
+					      const char*        parameters)
+{
+    /* Compression is negotiated once per connection. Only zlib is
+     * supported so far, at its fastest level by default since most
+     * of the redundancy in our streams is easy to find.
+     */
+    int level = Z_BEST_SPEED;
+
+    if (!strcmp(parameters, "none")) {
+	self->compression_level = 0;
+	remote_server_send_response(self, FYRE_RESPONSE_OK, "Stream compression disabled");
+    }
+    else if (!strncmp(parameters, "zlib", 4)) {
+	if (parameters[4])
+	    level = atoi(parameters + 4);
+	if (level < Z_BEST_SPEED || level > Z_BEST_COMPRESSION) {
+	    remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "Invalid compression level");
+	    return;
+	}
+	self->compression_level = level;
+	remote_server_send_response(self, FYRE_RESPONSE_OK, "Stream compression set to zlib level %d", level);
+    }
+    else {
+	remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "Unsupported compression method");
+    }
+}
+
+static void       cmd_set_protocol     (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Switch protocol versions. Our response still uses the old
+     * version, and everything after it uses the new one.
+     */
+    int version = atoi(parameters);
+
+    if (version < 1 || version > FYRE_PROTOCOL_VERSION) {
+	remote_server_send_response(self, FYRE_RESPONSE_UNSUPPORTED,
+				    "Protocol version %d is not supported", version);
+	return;
+    }
+
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "Using protocol version %d", version);
+    self->protocol = version;
+    self->reading_frame_body = FALSE;
 }
 
 static void       cmd_is_gui_available (RemoteServerConn*  self,
@@ -511,15 +1813,26 @@ static void       gui_init_simple     (RemoteServerConn*     self)
 
 static void       remote_server_init_commands (RemoteServer*  self)
 {
+    remote_server_add_command(self, "set_protocol",         cmd_set_protocol);
     remote_server_add_command(self, "set_param",            cmd_set_param);
+    remote_server_add_command(self, "set_params",           cmd_set_params);
+    remote_server_add_command(self, "resume_session",       cmd_resume_session);
     remote_server_add_command(self, "set_gui_style",        cmd_set_gui_style);
     remote_server_add_command(self, "set_render_time",      cmd_set_render_time);
+    remote_server_add_command(self, "set_calc_threads",     cmd_set_calc_threads);
     remote_server_add_command(self, "is_gui_available",     cmd_is_gui_available);
     remote_server_add_command(self, "calc_start",           cmd_calc_start);
     remote_server_add_command(self, "calc_stop",            cmd_calc_stop);
+    remote_server_add_command(self, "calc_quota",           cmd_calc_quota);
     remote_server_add_command(self, "calc_step",            cmd_calc_step);
     remote_server_add_command(self, "calc_status",          cmd_calc_status);
     remote_server_add_command(self, "get_histogram_stream", cmd_get_histogram_stream);
+    remote_server_add_command(self, "get_histogram_shm",    cmd_get_histogram_shm);
+    remote_server_add_command(self, "get_histogram_preview", cmd_get_histogram_preview);
+    remote_server_add_command(self, "set_stream_compression", cmd_set_stream_compression);
+    remote_server_add_command(self, "subscribe_histogram",  cmd_subscribe_histogram);
+    remote_server_add_command(self, "unsubscribe_histogram", cmd_unsubscribe_histogram);
+    remote_server_add_command(self, "histogram_ack",        cmd_histogram_ack);
 
     remote_server_add_gui(self, "none",    gui_init_none);
     remote_server_add_gui(self, "simple",  gui_init_simple);
@@ -40,9 +40,29 @@ G_BEGIN_DECLS
 /******************************************************************* Public Methods */
 /************************************************************************************/
 
-void              remote_server_main_loop     (int        port_number,
-					       gboolean   have_gtk,
-					       gboolean   verbose);
+/* If 'relay_nodes' is non-NULL, it's a comma-separated list of servers
+ * in the same format as --cluster. Each connection then uses them as
+ * its own cluster, instead of doing all the work itself.
+ */
+void              remote_server_main_loop     (int          port_number,
+					       gboolean     have_gtk,
+					       gboolean     verbose,
+					       const gchar* relay_nodes);
+
+/* Run as a local worker for the process that started us. We listen on the
+ * loopback interface only, on any free port, which we announce on stdout
+ * as "port N". We exit as soon as our stdin is closed, since that means
+ * our parent has gone away.
+ */
+void              remote_server_worker_loop   (gboolean     have_gtk);
+
+/* A summary of what this machine can do, as "key=value" pairs separated
+ * by spaces. It's sent with the ready message, and with discovery replies.
+ * The first call runs a short benchmark, later calls return the same string.
+ * With 'relay_nodes', the first call also waits briefly for those nodes
+ * to report, and their cores, memory and speed are added to our own.
+ */
+const gchar*      remote_server_get_capabilities (const gchar* relay_nodes);
 
 
 /************************************************************************************/
@@ -65,6 +85,85 @@ void              remote_server_main_loop     (int        port_number,
 #define FYRE_RESPONSE_BAD_VALUE     501  /* Inappropriate parameter value */
 #define FYRE_RESPONSE_UNSUPPORTED   502  /* Command was recognized, but is not currently supported */
 
+/* Protocol version 1 is newline-terminated text, and every connection
+ * starts out speaking it. After 'set_protocol 2' succeeds, both sides
+ * switch to length-prefixed binary frames, each starting with:
+ *
+ *   32-bit big-endian length of everything after the request ID
+ *   32-bit big-endian request ID
+ *
+ * Request frames follow this with a command line, without a newline.
+ * An empty request frame is an empty command, and is answered as one.
+ * Response frames carry the ID of the request they answer, and follow
+ * it with a 16-bit big-endian response code, a 16-bit big-endian message
+ * length, the message, then any binary data. Request IDs let responses
+ * arrive in any order. Requests with ID zero never get a response.
+ *
+ * 'subscribe_histogram' asks the server to push histogram deltas without
+ * being polled. Pushes are BINARY responses carrying the subscription's
+ * request ID, with the same status message as calc_status. The client
+ * acknowledges each one with a 'histogram_ack' request of ID zero, and
+ * the server stops pushing while too many are unacknowledged.
+ */
+#define FYRE_PROTOCOL_VERSION       2
+#define FYRE_FRAME_HEADER_SIZE      8
+#define FYRE_FRAME_RESPONSE_SIZE    4
+#define FYRE_FRAME_MAX_LENGTH       (64 << 20)
+
+/* After 'set_stream_compression zlib' succeeds, every histogram stream
+ * is sent as an 8-byte header followed by the zlib-compressed stream.
+ * The header holds the uncompressed length and the time the server
+ * spent compressing, in microseconds, both as big-endian 32-bit integers.
+ */
+#define FYRE_STREAM_COMPRESSION_HEADER  8
+
+/* Every connection has a parameter epoch, starting at zero. It advances
+ * whenever 'set_param' changes a parameter that affects calculation, and
+ * the new epoch is reported as "ok epoch=N". 'set_params' takes several
+ * "name = value" pairs separated by semicolons, and applies them together
+ * with at most one epoch change. calc_status and pushed
+ * histograms report "epoch=N epoch_iterations=X" after their usual
+ * fields, and histogram streams carry "epoch=N" in their message. Results
+ * from an old epoch can be discarded, while changes that only affect
+ * rendering leave the epoch, and the work done so far, intact.
+ *
+ * 'get_histogram_shm' is for clients on the same machine. Instead of
+ * sending a stream, the server adds its new counts to a histogram in
+ * POSIX shared memory and answers with "shm=NAME size=BYTES epoch=N".
+ * The client merges and empties that histogram before its next request.
+ * The layout is described in shared-histogram.h.
+ *
+ * 'get_histogram_preview W H' answers with a BINARY response holding
+ * the counts the server hasn't sent yet, block-summed down to W by H
+ * buckets, as one block of W*H stream VByte integers in row order. Its
+ * message is "epoch=N width=W height=H". The counts still go out in the
+ * next histogram stream, so previews must not be merged into a histogram.
+ *
+ * 'calc_quota N' starts calculating, and pauses by itself after N more
+ * iterations. Until then, status messages end with "quota=X", giving
+ * the number of iterations left. calc_start and calc_stop cancel it.
+ *
+ * The ready message is followed by the server's capabilities:
+ *
+ *   cores=N          CPUs available for calculation
+ *   memory=N         Physical memory, in megabytes, if we know it
+ *   maps=LIST        Comma-separated map types the server can calculate
+ *   streams=LIST     Comma-separated histogram stream encodings
+ *   benchmark=X      Iterations per second, measured at startup
+ *   session=TOKEN    This connection's session, for resume_session
+ *
+ * Clients should ignore keys they don't know, and cope with missing ones.
+ *
+ * When a connection closes, the server keeps its map for a while, with
+ * its parameters, its epoch, and any counts it hasn't sent yet. Only so
+ * much memory goes to these, and the oldest are given up first. If the
+ * client reconnects, 'resume_session TOKEN' takes over that session in
+ * place of the new connection's own, answering "ok epoch=N" with the
+ * session's epoch, or FALSE if it's gone. TOKEN then stays valid for
+ * the new connection. Subscriptions, quotas, and stream compression
+ * aren't part of a session, and must be set up again.
+ */
+
 G_END_DECLS
 
 #endif /* __REMOTE_SERVER_H__ */
@@ -25,12 +25,14 @@
 #include "screensaver.h"
 #include "histogram-view.h"
 #include "de-jong.h"
+#include <math.h>
 
 static void screensaver_class_init(ScreenSaverClass *klass);
 static void screensaver_init(ScreenSaver *self);
 static void screensaver_dispose(GObject *gobject);
 
 static int screensaver_idle_handler(gpointer user_data);
+static int screensaver_decay_idle_handler(gpointer user_data);
 
 
 /************************************************************************************/
@@ -102,6 +104,10 @@ static void screensaver_dispose(GObject *gobject) {
 	g_object_unref(self->animation);
 	self->animation = NULL;
     }
+    if (self->timer) {
+	g_timer_destroy(self->timer);
+	self->timer = NULL;
+    }
 }
 
 ScreenSaver* screensaver_new(IterativeMap *map, Animation *animation) {
@@ -113,9 +119,18 @@ ScreenSaver* screensaver_new(IterativeMap *map, Animation *animation) {
     self->animation = ANIMATION(g_object_ref(animation));
     self->map = ITERATIVE_MAP(g_object_ref(map));
     self->view = g_object_ref(histogram_view_new(HISTOGRAM_IMAGER(self->map)));
+    self->framerate = 10;
+
+    if (HISTOGRAM_IMAGER(map)->decay_half_life > 0) {
+	/* The map's own histogram fades out as the animation plays,
+	 * so there's no need to keep a separate render of every frame.
+	 */
+	self->timer = g_timer_new();
+	screensaver_start(self);
+	return self;
+    }
 
     /* Allocate and interpolate all frames */
-    self->framerate = 10;
     self->num_frames = animation_get_length(self->animation) * self->framerate;
     self->frame_renders = g_new0(IterativeMap*, self->num_frames);
     self->frame_parameters = g_new0(ParameterHolderPair, self->num_frames);
@@ -150,7 +165,8 @@ ScreenSaver* screensaver_new(IterativeMap *map, Animation *animation) {
 void          screensaver_start    (ScreenSaver *self)
 {
     if (!self->idler)
-	self->idler = g_idle_add(screensaver_idle_handler, self);
+	self->idler = g_idle_add(self->timer ? screensaver_decay_idle_handler : screensaver_idle_handler,
+				 self);
 }
 
 void          screensaver_stop     (ScreenSaver *self)
@@ -188,4 +204,29 @@ static int screensaver_idle_handler(gpointer user_data) {
     return 1;
 }
 
+static int screensaver_decay_idle_handler(gpointer user_data) {
+    ScreenSaver *self = SCREENSAVER(user_data);
+    gdouble length = animation_get_length(self->animation);
+    AnimationIter iter;
+
+    /* Play the animation back and forth at its real speed. The parameters
+     * change a little every frame, and the histogram keeps up with them
+     * by letting older plots decay away rather than starting over.
+     */
+    if (length > 0) {
+	gdouble t = fmod(g_timer_elapsed(self->timer, NULL), length * 2);
+	if (t > length)
+	    t = length * 2 - t;
+	animation_iter_seek(self->animation, &iter, t);
+	animation_iter_load(self->animation, &iter, PARAMETER_HOLDER(self->map));
+    }
+
+    /* Leave some of each frame for drawing it */
+    iterative_map_calculate_timed(self->map, 0.75 / self->framerate);
+
+    if (GTK_WIDGET_DRAWABLE(self->view))
+	histogram_view_update(HISTOGRAM_VIEW(self->view));
+    return 1;
+}
+
 /* The End */
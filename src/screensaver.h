@@ -53,6 +53,11 @@ struct _ScreenSaver {
 
     GtkWidget *view;
 
+    /* In decay mode there's only one histogram, following
+     * the animation in real time according to this clock.
+     */
+    GTimer *timer;
+
     guint idler;
 };
 
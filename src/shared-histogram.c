@@ -0,0 +1,217 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * shared-histogram.c - Histogram buffers in POSIX shared memory, so
+ *                      worker processes on the same machine can hand
+ *                      over their counts without encoding them.
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include "shared-histogram.h"
+
+#ifdef HAVE_SHM_OPEN
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+    guint32 magic;
+    guint32 hist_width, hist_height;
+    guint32 tiles_width, tiles_height;
+} SharedHistogramHeader;
+
+
+/************************************************************************************/
+/********************************************************************** Mapping *****/
+/************************************************************************************/
+
+#ifdef HAVE_SHM_OPEN
+
+static gsize
+shared_histogram_size (guint hist_width,
+		       guint hist_height,
+		       guint tiles_width,
+		       guint tiles_height)
+{
+    return SHARED_HISTOGRAM_HEADER_SIZE +
+	sizeof (guint) * (gsize) hist_width * hist_height +
+	(gsize) tiles_width * tiles_height;
+}
+
+static SharedHistogram*
+shared_histogram_map (const gchar *name,
+		      int          fd,
+		      gsize        size)
+{
+    SharedHistogram *self;
+    SharedHistogramHeader *header;
+    gpointer memory;
+
+    memory = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+	return NULL;
+
+    self = g_new0 (SharedHistogram, 1);
+    self->name = g_strdup (name);
+    self->size = size;
+    self->memory = memory;
+
+    header = (SharedHistogramHeader*) memory;
+    self->buffer.hist_width = header->hist_width;
+    self->buffer.hist_height = header->hist_height;
+    self->buffer.tiles_width = header->tiles_width;
+    self->buffer.tiles_height = header->tiles_height;
+    self->buffer.histogram = (guint*) ((guchar*) memory + SHARED_HISTOGRAM_HEADER_SIZE);
+    self->buffer.dirty_tiles = (guint8*) (self->buffer.histogram +
+					  (gsize) header->hist_width * header->hist_height);
+    return self;
+}
+
+SharedHistogram*
+shared_histogram_new (guint hist_width,
+		      guint hist_height)
+{
+    static guint serial = 0;
+    SharedHistogram *self;
+    SharedHistogramHeader *header;
+    gchar *name;
+    gsize size;
+    int fd;
+    guint tiles_width = (hist_width + HISTOGRAM_IMAGER_TILE_SIZE - 1) >> HISTOGRAM_IMAGER_TILE_SHIFT;
+    guint tiles_height = (hist_height + HISTOGRAM_IMAGER_TILE_SIZE - 1) >> HISTOGRAM_IMAGER_TILE_SHIFT;
+
+    name = g_strdup_printf ("/fyre-%d-%u", (int) getpid (), serial++);
+    size = shared_histogram_size (hist_width, hist_height, tiles_width, tiles_height);
+
+    fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+	g_free (name);
+	return NULL;
+    }
+
+    /* New shared memory is always zero-filled, so the histogram starts out empty */
+    if (ftruncate (fd, size) < 0) {
+	close (fd);
+	shm_unlink (name);
+	g_free (name);
+	return NULL;
+    }
+
+    header = mmap (NULL, SHARED_HISTOGRAM_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header != MAP_FAILED) {
+	header->magic = SHARED_HISTOGRAM_MAGIC;
+	header->hist_width = hist_width;
+	header->hist_height = hist_height;
+	header->tiles_width = tiles_width;
+	header->tiles_height = tiles_height;
+	munmap (header, SHARED_HISTOGRAM_HEADER_SIZE);
+	self = shared_histogram_map (name, fd, size);
+    }
+    else {
+	self = NULL;
+    }
+
+    close (fd);
+    if (self)
+	self->is_owner = TRUE;
+    else
+	shm_unlink (name);
+    g_free (name);
+    return self;
+}
+
+SharedHistogram*
+shared_histogram_open (const gchar *name,
+		       gsize        size)
+{
+    SharedHistogram *self;
+    SharedHistogramHeader *header;
+    struct stat st;
+    int fd;
+
+    fd = shm_open (name, O_RDWR, 0);
+    if (fd < 0)
+	return NULL;
+
+    if (size < SHARED_HISTOGRAM_HEADER_SIZE || fstat (fd, &st) < 0 || (gsize) st.st_size != size) {
+	close (fd);
+	return NULL;
+    }
+
+    self = shared_histogram_map (name, fd, size);
+    close (fd);
+    shm_unlink (name);
+    if (!self)
+	return NULL;
+
+    /* Don't trust the header any further than the size we were given */
+    header = (SharedHistogramHeader*) self->memory;
+    if (header->magic != SHARED_HISTOGRAM_MAGIC ||
+	header->tiles_width != (header->hist_width + HISTOGRAM_IMAGER_TILE_SIZE - 1) >> HISTOGRAM_IMAGER_TILE_SHIFT ||
+	header->tiles_height != (header->hist_height + HISTOGRAM_IMAGER_TILE_SIZE - 1) >> HISTOGRAM_IMAGER_TILE_SHIFT ||
+	shared_histogram_size (header->hist_width, header->hist_height,
+			       header->tiles_width, header->tiles_height) != size) {
+	shared_histogram_free (self);
+	return NULL;
+    }
+
+    return self;
+}
+
+void
+shared_histogram_free (SharedHistogram *self)
+{
+    munmap (self->memory, self->size);
+
+    /* Whoever opened it has probably unlinked it already */
+    if (self->is_owner)
+	shm_unlink (self->name);
+
+    g_free (self->name);
+    g_free (self);
+}
+
+#else /* !HAVE_SHM_OPEN */
+
+SharedHistogram*
+shared_histogram_new (guint hist_width,
+		      guint hist_height)
+{
+    return NULL;
+}
+
+SharedHistogram*
+shared_histogram_open (const gchar *name,
+		       gsize        size)
+{
+    return NULL;
+}
+
+void
+shared_histogram_free (SharedHistogram *self)
+{
+}
+
+#endif /* HAVE_SHM_OPEN */
+
+/* The End */
@@ -0,0 +1,69 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * shared-histogram.h - Histogram buffers in POSIX shared memory, so
+ *                      worker processes on the same machine can hand
+ *                      over their counts without encoding them.
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __SHARED_HISTOGRAM_H__
+#define __SHARED_HISTOGRAM_H__
+
+#include <glib.h>
+#include "histogram-imager.h"
+
+G_BEGIN_DECLS
+
+/* A shared memory object starts with a header describing the histogram,
+ * padded so the buckets that follow are well aligned, then the buckets,
+ * then one dirty flag per tile.
+ */
+#define SHARED_HISTOGRAM_MAGIC        0x46794831   /* "FyH1" */
+#define SHARED_HISTOGRAM_HEADER_SIZE  64
+
+typedef struct {
+    gchar*           name;
+    gsize            size;
+    gpointer         memory;
+    gboolean         is_owner;
+    HistogramBuffer  buffer;
+} SharedHistogram;
+
+/* Create a new, empty shared histogram of the given size. Its name can
+ * be given to another process for shared_histogram_open(). Returns NULL
+ * if shared memory isn't available.
+ */
+SharedHistogram*  shared_histogram_new      (guint             hist_width,
+					     guint             hist_height);
+
+/* Map a shared histogram created by another process. The name is
+ * unlinked once it's mapped, since nobody else needs to find it.
+ * Returns NULL if it doesn't exist or doesn't look like a histogram.
+ */
+SharedHistogram*  shared_histogram_open     (const gchar*      name,
+					     gsize             size);
+
+void              shared_histogram_free     (SharedHistogram*  self);
+
+G_END_DECLS
+
+#endif /* __SHARED_HISTOGRAM_H__ */
+
+/* The End */
@@ -0,0 +1,196 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * stream-vbyte.c - Encoding and decoding blocks of 32-bit integers in
+ *                  the "stream VByte" format, with an SSSE3 decoder
+ *                  used whenever the CPU supports it.
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "stream-vbyte.h"
+#include <string.h>
+
+/* The SSSE3 decoder is compiled with a per-function target attribute,
+ * so it's available without building all of Fyre for newer CPUs. We
+ * only use it after checking the CPU at runtime.
+ */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HAVE_STREAM_VBYTE_SSSE3
+#include <tmmintrin.h>
+#endif
+
+/* For every control byte, the total number of data bytes in its group */
+static guint8 length_table[256];
+
+#ifdef HAVE_STREAM_VBYTE_SSSE3
+/* For every control byte, a pshufb mask that expands its group's
+ * data bytes into four little-endian 32-bit integers.
+ */
+static guint8 shuffle_table[256][16] __attribute__ ((aligned (16)));
+static gboolean have_ssse3 = FALSE;
+#endif
+
+static gboolean is_initialized = FALSE;
+
+
+/************************************************************************************/
+/*************************************************************************** Tables */
+/************************************************************************************/
+
+void
+stream_vbyte_init (void)
+{
+    guint control, k, b, len, offset;
+
+    if (is_initialized)
+	return;
+
+    for (control=0; control<256; control++) {
+	offset = 0;
+	for (k=0; k<4; k++) {
+	    len = ((control >> (k << 1)) & 3) + 1;
+#ifdef HAVE_STREAM_VBYTE_SSSE3
+	    for (b=0; b<4; b++)
+		shuffle_table[control][(k << 2) + b] = b < len ? offset + b : 0xFF;
+#endif
+	    offset += len;
+	}
+	length_table[control] = offset;
+    }
+
+#ifdef HAVE_STREAM_VBYTE_SSSE3
+    __builtin_cpu_init ();
+    have_ssse3 = __builtin_cpu_supports ("ssse3");
+#endif
+
+    is_initialized = TRUE;
+}
+
+
+/************************************************************************************/
+/************************************************************************* Encoding */
+/************************************************************************************/
+
+gsize
+stream_vbyte_encode (const guint32 *input,
+		     guint          n,
+		     guchar        *output)
+{
+    guchar *control = output;
+    guchar *data = output + STREAM_VBYTE_CONTROL_SIZE(n);
+    guint32 value;
+    guint i;
+    int len;
+
+    memset (control, 0, STREAM_VBYTE_CONTROL_SIZE(n));
+
+    for (i=0; i<n; i++) {
+	value = input[i];
+	len = stream_vbyte_length (value);
+	control[i >> 2] |= (len - 1) << ((i & 3) << 1);
+
+	*(data++) = value & 0xFF;
+	if (len > 1)
+	    *(data++) = 0xFF & (value >> 8);
+	if (len > 2)
+	    *(data++) = 0xFF & (value >> 16);
+	if (len > 3)
+	    *(data++) = value >> 24;
+    }
+
+    return data - output;
+}
+
+
+/************************************************************************************/
+/************************************************************************* Decoding */
+/************************************************************************************/
+
+#ifdef HAVE_STREAM_VBYTE_SSSE3
+static guint __attribute__ ((target ("ssse3")))
+stream_vbyte_decode_ssse3 (const guchar  *control,
+			   const guchar **data,
+			   const guchar  *data_end,
+			   guint32       *output,
+			   guint          n)
+{
+    /* Decode whole groups of four integers with one unaligned load and
+     * one shuffle each. We always load 16 bytes, so stop as soon as we
+     * get that close to the end of the input and let the scalar
+     * decoder finish up.
+     */
+    const guchar *p = *data;
+    guint i;
+
+    for (i=0; i+4 <= n && data_end - p >= 16; i+=4) {
+	guint8 c = *(control++);
+	__m128i bytes = _mm_loadu_si128 ((const __m128i*) p);
+	__m128i mask = _mm_load_si128 ((const __m128i*) shuffle_table[c]);
+	_mm_storeu_si128 ((__m128i*) (output + i), _mm_shuffle_epi8 (bytes, mask));
+	p += length_table[c];
+    }
+
+    *data = p;
+    return i;
+}
+#endif
+
+gsize
+stream_vbyte_decode (const guchar  *input,
+		     gsize          input_size,
+		     guint32       *output,
+		     guint          n)
+{
+    const guchar *control = input;
+    const guchar *end = input + input_size;
+    const guchar *data;
+    guint32 value;
+    guint i = 0;
+    int len;
+
+    if (input_size < STREAM_VBYTE_CONTROL_SIZE(n))
+	return 0;
+    data = input + STREAM_VBYTE_CONTROL_SIZE(n);
+
+#ifdef HAVE_STREAM_VBYTE_SSSE3
+    if (have_ssse3)
+	i = stream_vbyte_decode_ssse3 (control, &data, end, output, n);
+#endif
+
+    for (; i<n; i++) {
+	len = ((control[i >> 2] >> ((i & 3) << 1)) & 3) + 1;
+	if (end - data < len)
+	    return 0;
+
+	value = data[0];
+	if (len > 1)
+	    value |= data[1] << 8;
+	if (len > 2)
+	    value |= data[2] << 16;
+	if (len > 3)
+	    value |= (guint32) data[3] << 24;
+	data += len;
+	output[i] = value;
+    }
+
+    return data - input;
+}
+
+/* The End */
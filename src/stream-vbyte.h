@@ -0,0 +1,81 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * stream-vbyte.h - Encoding and decoding blocks of 32-bit integers in
+ *                  the "stream VByte" format. Each group of four
+ *                  integers shares one control byte holding their
+ *                  lengths, and the integers themselves are stored
+ *                  separately, so decoding needs no per-byte branches
+ *                  and can be done with SIMD shuffles.
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __STREAM_VBYTE_H__
+#define __STREAM_VBYTE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A block of 'n' integers is stored as (n+3)/4 control bytes followed
+ * by the data bytes. Control bytes hold four 2-bit fields, lowest bits
+ * first, each giving one less than the length of an integer. Integers
+ * are stored little-endian in 1 to 4 bytes.
+ */
+#define STREAM_VBYTE_CONTROL_SIZE(n)   (((n) + 3) >> 2)
+#define STREAM_VBYTE_MAX_SIZE(n)       (STREAM_VBYTE_CONTROL_SIZE(n) + (n) * 4)
+
+/* Number of data bytes needed to store 'i' */
+static inline int stream_vbyte_length(guint32 i)
+{
+    if (i < (1<<8))
+	return 1;
+    else if (i < (1<<16))
+	return 2;
+    else if (i < (1<<24))
+	return 3;
+    else
+	return 4;
+}
+
+/* Build lookup tables, and check whether SIMD decoding is available.
+ * This must be called once before stream_vbyte_decode().
+ */
+void      stream_vbyte_init      (void);
+
+/* Encodes 'n' integers into 'output', which must have room for
+ * STREAM_VBYTE_MAX_SIZE(n) bytes. Returns the number of bytes written.
+ */
+gsize     stream_vbyte_encode    (const guint32 *input,
+				  guint          n,
+				  guchar        *output);
+
+/* Decodes 'n' integers from 'input'. Returns the number of bytes
+ * consumed, or zero if 'input_size' bytes weren't enough to hold them.
+ */
+gsize     stream_vbyte_decode    (const guchar  *input,
+				  gsize          input_size,
+				  guint32       *output,
+				  guint          n);
+
+G_END_DECLS
+
+#endif /* __STREAM_VBYTE_H__ */
+
+/* The End */